@@ -16,12 +16,12 @@ mkdir -p $HOME/os161/root
 bmake
 bmake install
 
-# configure kernel with the sample DUMBVM configuration
+# configure kernel with the ASST3 configuration (coremap-based VM)
 cd kern/conf/
-./config DUMBVM
+./config ASST3
 
-# compile kernel with the DUMBVM configuration
-cd ../compile/DUMBVM
+# compile kernel with the ASST3 configuration
+cd ../compile/ASST3
 bmake depend
 bmake 
 bmake install
@@ -67,6 +67,9 @@
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
 
+/* And the reverse, for kernel addresses in kseg0. */
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
+
 /*
  * The top of user space. (Actually, the address immediately above the
  * last valid user address.)
@@ -117,13 +120,11 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* page to invalidate */
 };
 
 #define TLBSHOOTDOWN_MAX 16
+#define TLBSHOOTDOWN_ALL (TLBSHOOTDOWN_MAX + 1)
 
 
 #endif /* _MIPS_VM_H_ */
@@ -109,11 +109,28 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
             case SYS__exit:
                 sys__exit(tf->tf_a0);
                 panic("Returning from exit\n");
                 break;
 
+	    case SYS_getrusage:
+		err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity(tf->tf_a0);
+		break;
+
+	    case SYS_getaffinity:
+		err = sys_getaffinity((userptr_t)tf->tf_a0);
+		break;
+
 	    /* Add stuff here */
 
 	    default:
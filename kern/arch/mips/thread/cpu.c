@@ -38,6 +38,7 @@
 #include <platform/maxcpus.h>
 #include <cpu.h>
 #include <thread.h>
+#include <vm.h>
 
 ////////////////////////////////////////////////////////////
 
@@ -280,10 +281,18 @@ wait(void)
 
 /*
  * Idle the processor until something happens.
+ *
+ * If the VM system has background work (pre-zeroing pages), do a
+ * piece of that instead of waiting, then let any pending interrupts
+ * in and return so the caller rechecks its run queue.
  */
 void
 cpu_idle(void)
 {
+	if (vm_idle()) {
+		cpu_irqonoff();
+		return;
+	}
 	wait();
         cpu_irqonoff();
 }
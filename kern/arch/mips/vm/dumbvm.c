@@ -126,6 +126,13 @@ free_kpages(vaddr_t addr)
 	(void)addr;
 }
 
+bool
+vm_idle(void)
+{
+	/* nothing */
+	return false;
+}
+
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
@@ -133,6 +140,12 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -216,6 +229,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+	vmstat_inc(NULL, VMS_TLBMISSES);
+
 	for (i=0; i<NUM_TLB; i++) {
 		tlb_read(&ehi, &elo, i);
 		if (elo & TLBLO_VALID) {
@@ -229,9 +244,14 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return 0;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	/* No free slot; throw out a random entry. */
+	vmstat_inc(NULL, VMS_TLBEVICTIONS);
+	ehi = faultaddress;
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x (random)\n", faultaddress, paddr);
+	tlb_random(ehi, elo);
 	splx(spl);
-	return EFAULT;
+	return 0;
 }
 
 struct addrspace *
@@ -52,12 +52,18 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/* Cycles per hardclock, and the most hardclocks c0_compare can span */
+#define TIMER_PERIOD	(CPU_FREQUENCY / HZ)
+#define TIMER_MAXTICKS	(0xffffffffU / TIMER_PERIOD)
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
  * asserted. Writing to c0_compare again clears the interrupt.
+ * (On System/161 it also resets c0_count to zero, so the value
+ * written is the number of cycles until the next interrupt.)
  */
 static
 void
@@ -75,6 +81,22 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -115,7 +137,43 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TIMER_PERIOD);
+}
+
+/*
+ * Stop the periodic timer interrupt on the current cpu, and instead
+ * interrupt once, TICKS hardclock periods from now. If TICKS is 0 or
+ * too big for the on-chip timer, wait as long as it can. Returns the
+ * number of periods it will actually be.
+ */
+unsigned
+mainbus_timer_oneshot(unsigned ticks)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (ticks == 0 || ticks > TIMER_MAXTICKS) {
+		ticks = TIMER_MAXTICKS;
+	}
+	mips_timer_set(ticks * TIMER_PERIOD);
+	return ticks;
+}
+
+/*
+ * Go back to the periodic timer interrupt after mainbus_timer_oneshot
+ * without waiting for the one-shot interrupt. Returns the number of
+ * whole periods that went by; the part of a period left over counts
+ * towards the first new one, so the clock doesn't lose time.
+ */
+unsigned
+mainbus_timer_periodic(void)
+{
+	uint32_t count;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	count = mips_timer_get();
+	mips_timer_set(TIMER_PERIOD - count % TIMER_PERIOD);
+	return count / TIMER_PERIOD;
 }
 
 /*
@@ -305,7 +363,7 @@ mainbus_interrupt(struct trapframe *tf)
 	}
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(TIMER_PERIOD);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
@@ -47,6 +47,7 @@
 #include <lib.h>
 #include <array.h>
 #include <uio.h>
+#include <clock.h>
 #include <membar.h>
 #include <synch.h>
 #include <lamebus/emu.h>
@@ -91,6 +92,9 @@
 #define EMU_RES_UNKNOWN      12
 #define EMU_RES_UNSUPP       13
 
+/* Wait before retrying a failed close, times the retries so far. (nsecs) */
+#define EMU_RETRY_DELAY      10000000
+
 ////////////////////////////////////////////////////////////
 //
 // Hardware ops
@@ -250,6 +254,7 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 			kprintf("emu%d: I/O error on close, retrying\n",
 				sc->e_unit);
 			retries++;
+			thread_sleep_ns((uint64_t)EMU_RETRY_DELAY * retries);
 			continue;
 		}
 		break;
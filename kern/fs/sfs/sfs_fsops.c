@@ -111,6 +111,11 @@ sfs_freemapio(struct sfs_fs *sfs, enum uio_rw rw)
 			return result;
 		}
 	}
+
+	if (rw == UIO_READ) {
+		/* The data changed behind the bitmap's back. */
+		bitmap_rescan(sfs->sfs_freemap);
+	}
 	return 0;
 }
 
@@ -521,6 +526,11 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENXIO;
 	}
 
+	result = sfs_vnode_cacheinit();
+	if (result) {
+		return result;
+	}
+
 	sfs = sfs_fs_create();
 	if (sfs == NULL) {
 		return ENOMEM;
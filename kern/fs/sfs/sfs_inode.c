@@ -40,9 +40,60 @@
 #include <current.h>
 #include <vfs.h>
 #include <buf.h>
+#include <kmemcache.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
+/*
+ * Cache of sfs_vnodes, shared by all mounted volumes. A cached vnode
+ * keeps its lock.
+ */
+static struct kmem_cache *sfs_vnode_cache;
+
+
+/*
+ * Cache constructor and destructor for sfs_vnode.
+ */
+static
+int
+sfs_vnode_ctor(void *obj)
+{
+	struct sfs_vnode *sv = obj;
+
+	sv->sv_lock = lock_create("sfs_vnode");
+	if (sv->sv_lock == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+sfs_vnode_dtor(void *obj)
+{
+	struct sfs_vnode *sv = obj;
+
+	lock_destroy(sv->sv_lock);
+}
+
+/*
+ * Make the vnode cache, if it doesn't exist yet. Called at mount
+ * time; mounts are serialized by the VFS layer.
+ */
+int
+sfs_vnode_cacheinit(void)
+{
+	if (sfs_vnode_cache == NULL) {
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    sfs_vnode_ctor,
+						    sfs_vnode_dtor);
+		if (sfs_vnode_cache == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
 
 /*
  * Constructor for sfs_vnode.
@@ -53,15 +104,10 @@ sfs_vnode_create(uint32_t ino, unsigned type)
 {
 	struct sfs_vnode *sv;
 
-	sv = kmalloc(sizeof(*sv));
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv == NULL) {
 		return NULL;
 	}
-	sv->sv_lock = lock_create("sfs_vnode");
-	if (sv->sv_lock == NULL) {
-		kfree(sv);
-		return NULL;
-	}
 	sv->sv_ino = ino;
 	sv->sv_type = type;
 	sv->sv_dinobuf = NULL;
@@ -76,8 +122,8 @@ static
 void
 sfs_vnode_destroy(struct sfs_vnode *victim)
 {
-	lock_destroy(victim->sv_lock);
-	kfree(victim);
+	KASSERT(!lock_do_i_hold(victim->sv_lock));
+	kmem_cache_free(sfs_vnode_cache, victim);
 }
 
 /*
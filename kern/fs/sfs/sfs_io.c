@@ -35,6 +35,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <uio.h>
 #include <synch.h>
 #include <vfs.h>
@@ -54,8 +55,13 @@
  * except sfs_device.
  */
 
+/* Wait before retrying a failed I/O, times the retries so far. (nsecs) */
+#define SFS_RETRY_DELAY		10000000
+
 /*
- * Read or write a block, retrying I/O errors.
+ * Read or write a block, retrying I/O errors. Back off a little more
+ * each time, so a device that's having a transient problem has a
+ * chance to get over it.
  */
 static
 int
@@ -85,10 +91,12 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 			kprintf("sfs: %s: block %llu I/O error, retrying\n",
 				sfs->sfs_sb.sb_volname,
 				uio->uio_offset / SFS_BLOCKSIZE);
+			thread_sleep_ns(SFS_RETRY_DELAY);
 			goto retry;
 		}
 		else if (tries < 10) {
 			tries++;
+			thread_sleep_ns((uint64_t)SFS_RETRY_DELAY * tries);
 			goto retry;
 		}
 		else {
@@ -383,13 +383,17 @@ sfs_fsync(struct vnode *v)
 
 /*
  * Called for mmap().
+ *
+ * The VM system maps file pages itself, reading and writing them
+ * with VOP_READ and VOP_WRITE (and so through the buffer cache), so
+ * any regular file can be mapped and there's nothing to do here.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 /*
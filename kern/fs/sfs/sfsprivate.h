@@ -95,6 +95,7 @@ int sfs_lookonce(struct sfs_vnode *sv, const char *name,
 		int *slot);
 
 /* Functions in sfs_inode.c */
+int sfs_vnode_cacheinit(void);
 int sfs_dinode_load(struct sfs_vnode *sv);
 void sfs_dinode_unload(struct sfs_vnode *sv);
 struct sfs_dinode *sfs_dinode_map(struct sfs_vnode *sv);
@@ -36,10 +36,53 @@
 
 
 #include <vm.h>
+#include <vmstat.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
 
+#if !OPT_DUMBVM
+#include <array.h>
+
+struct pagetable;
+
+/*
+ * A region is a range of virtual pages with a common set of
+ * permissions: one for each loadable ELF segment, plus the stack.
+ *
+ * A region may be backed by a file (an ELF segment is backed by the
+ * executable): the RG_FILESIZE bytes starting at RG_FILEVADDR come
+ * from RG_VNODE at RG_FILEOFFSET the first time each page is touched,
+ * and the rest of the region is zero-filled. The region holds a
+ * reference to the vnode.
+ *
+ * Pages of read-only file-backed regions with no zero-fill part (the
+ * text segment, usually), and of mmap'd files, are shared with every
+ * other address space mapping the same file through the page cache;
+ * rg_cached is set for these.
+ */
+struct region {
+	vaddr_t rg_vbase;		/* first address (page-aligned) */
+	size_t rg_npages;		/* length in pages */
+	bool rg_readable;
+	bool rg_writeable;
+	bool rg_executable;
+	struct vnode *rg_vnode;		/* backing file, or NULL */
+	off_t rg_fileoffset;		/* file offset of rg_filevaddr */
+	vaddr_t rg_filevaddr;		/* address of first file byte */
+	size_t rg_filesize;		/* number of file bytes */
+	bool rg_cached;			/* pages come from the page cache */
+	bool rg_mmap;			/* made by as_mmap */
+};
+
+#ifndef ADDRSPACEINLINE
+#define ADDRSPACEINLINE INLINE
+#endif
+
+DECLARRAY(region, ADDRSPACEINLINE);
+DEFARRAY(region, ADDRSPACEINLINE);
+#endif /* !OPT_DUMBVM */
+
 
 /*
  * Address space - data structure associated with the virtual memory
@@ -58,7 +101,12 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+	struct regionarray as_regions;	/* defined regions */
+	struct region *as_stack;	/* stack region, or NULL */
+	size_t as_stackmax;		/* most pages the stack may grow to */
+	struct pagetable *as_pt;	/* resident pages */
+	bool as_loading;		/* true while load_elf is running */
+	struct vmstats as_stats;	/* what happened to it */
 #endif
 };
 
@@ -99,6 +147,23 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_growstack - called by vm_fault for an address outside every
+ *                region. If it's below the stack but within the
+ *                stack size limit, extend the stack down to it and
+ *                return the stack region; otherwise return NULL.
+ *
+ *    as_define_fileregion - like as_define_region, but the first
+ *                FILESIZE bytes of the region are read on demand
+ *                from a file. Used by load_elf.
+ *
+ *    as_mmap   - map part of a file at an address of the VM system's
+ *                choosing. Pages are shared with the page cache.
+ *
+ *    as_munmap - remove a mapping made by as_mmap.
+ *
+ *    as_findregion - return the region containing VADDR, or NULL if
+ *                there is none. Used by vm_fault.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -118,6 +183,31 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if !OPT_DUMBVM
+int               as_define_fileregion(struct addrspace *as,
+                                       vaddr_t vaddr, size_t memsize,
+                                       struct vnode *v, off_t offset,
+                                       size_t filesize,
+                                       int readable,
+                                       int writeable,
+                                       int executable);
+int               as_mmap(struct addrspace *as, struct vnode *v,
+                          off_t offset, size_t len, bool writeable,
+                          vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr,
+                            size_t len);
+struct region    *as_findregion(struct addrspace *as, vaddr_t vaddr);
+struct region    *as_growstack(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Stack size limit, in pages, for address spaces created from now on.
+ * The stack starts out one page long and grows on demand up to this.
+ * (This must be > 64K so argument blocks of size ARG_MAX will fit.)
+ */
+#define VM_STACKMINPAGES	18
+extern size_t as_stacklimit;
+#endif
+
 
 /*
  * Functions in loadelf.c
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _CALLOUT_H_
+#define _CALLOUT_H_
+
+/*
+ * Callouts: functions to be called from the timer interrupt a given
+ * number of hardclocks from now.
+ *
+ * Each cpu keeps its pending callouts in a hierarchical timing wheel
+ * (see callout.c), advanced by hardclock(), so scheduling and
+ * cancelling are constant-time whatever the number pending. A callout
+ * runs on the cpu that scheduled it, in interrupt context, with no
+ * spinlocks held; it must not sleep. Resolution is one hardclock
+ * (1/HZ second); a callout runs on the first hardclock at least the
+ * requested number of ticks away. Delays longer than CALLOUT_MAXTICKS
+ * (about four months) are cut down to that. Because the current tick
+ * is already partly over, N ticks can be up to one tick short of N/HZ
+ * seconds; code that must not wake early should work from a deadline
+ * with callout_ticks_until and go back to sleep if it isn't there yet.
+ *
+ * The struct callout belongs to the caller, typically embedded in
+ * some other structure or on the stack.
+ *
+ * Functions:
+ *     callout_init     - set up C to call FUNC(ARG).
+ *     callout_schedule - run C in TICKS hardclocks (at least 1). If
+ *                        it's already pending it's rescheduled.
+ *     callout_cancel   - stop C if it's pending. On return C is
+ *                        neither pending nor running (unless this is
+ *                        called from C's own function), so it may
+ *                        then be freed. Returns true if C was pending.
+ *     callout_pending  - true if C is scheduled and hasn't run yet.
+ *     callout_ticks    - convert a time in nanoseconds to hardclock
+ *                        ticks, rounding up.
+ *     callout_ticks_until - number of ticks (rounded up, at most
+ *                        CALLOUT_MAXTICKS) until DEADLINE, from
+ *                        gettime(), or 0 if it has passed.
+ */
+
+struct cpu;
+struct timespec;
+
+#define CALLOUT_MAXTICKS	((1U << 30) - 1)
+
+struct callout {
+	struct callout *co_next;	/* Link in wheel slot */
+	struct callout **co_prevp;	/* Link in wheel slot; NULL if idle */
+	unsigned co_expire;		/* Wheel time to run at */
+	void (*co_func)(void *);	/* Function to call */
+	void *co_arg;			/* Argument for co_func */
+	struct cpu *volatile co_cpu;	/* Wheel it was last put on */
+};
+
+void callout_init(struct callout *c, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *c, unsigned ticks);
+bool callout_cancel(struct callout *c);
+bool callout_pending(struct callout *c);
+uint64_t callout_ticks(uint64_t nsecs);
+unsigned callout_ticks_until(const struct timespec *deadline);
+
+/*
+ * Machinery. callout_wheel_create makes a cpu's wheel (called from
+ * cpu_create); callout_hardclock advances the current cpu's wheel by
+ * TICKS ticks and runs what has come due (called from hardclock).
+ * callout_next returns how many ticks it will be before the current
+ * cpu's wheel next has anything to do, or 0 if it's empty; this may
+ * be early, but is never late (used to idle without ticking).
+ */
+struct callout_wheel *callout_wheel_create(void);
+void callout_hardclock(unsigned ticks);
+unsigned callout_next(void);
+
+
+#endif /* _CALLOUT_H_ */
@@ -40,6 +40,10 @@
 /*
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
+ *
+ * hardclock_idle() is called by an idle CPU, with interrupts off, to
+ * stop the periodic hardclock until it has something to run again;
+ * hardclock_unidle() restarts it.
  */
 
 /* hardclocks per second */
@@ -47,6 +51,8 @@
 
 void hardclock_bootstrap(void);
 void hardclock(void);
+void hardclock_idle(void);
+void hardclock_unidle(void);
 
 /*
  * timerclock() is called on one CPU once a second to allow simple
@@ -75,9 +81,13 @@ void timespec_sub(const struct timespec *t1,
 
 /*
  * clocksleep() suspends execution for the requested number of seconds,
- * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * like userlevel sleep(3). (Don't confuse it with wchan_sleep.) It
+ * wakes on the once-a-second timerclock, so it's only accurate to a
+ * second; thread_sleep_ns() sleeps for NSECS nanoseconds, accurate
+ * to a hardclock.
  */
 void clocksleep(int seconds);
+void thread_sleep_ns(uint64_t nsecs);
 
 
 #endif /* _CLOCK_H_ */
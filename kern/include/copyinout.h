@@ -30,6 +30,7 @@
 #ifndef _COPYINOUT_H_
 #define _COPYINOUT_H_
 
+struct uio;
 
 /*
  * copyin/copyout/copyinstr/copyoutstr are standard BSD kernel functions.
@@ -50,6 +51,9 @@
  * returns the actual length of string found in GOT. DEST is always
  * null-terminated on success. LEN and GOT include the null terminator.
  *
+ * copyuio does the work of uiomove (see uio.h) when the uio's buffers
+ * are in user space. Use uiomove instead of calling it directly.
+ *
  * All of these functions return 0 on success, EFAULT if a memory
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
@@ -68,6 +72,7 @@ int copyin(const_userptr_t usersrc, void *dest, size_t len);
 int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
+int copyuio(void *ptr, size_t n, struct uio *uio);
 
 
 #endif /* _COPYINOUT_H_ */
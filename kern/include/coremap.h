@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+#include <pagetable.h>
+
+/*
+ * Physical memory management.
+ *
+ * The coremap has one entry for every physical page frame in the
+ * machine. Each frame is either fixed (belongs to the kernel image or
+ * was handed out by ram_stealmem before the VM system came up), free,
+ * part of a kernel allocation, or holds a page of some user address
+ * space. Free frames are kept in a buddy system, and single kernel
+ * pages are recycled through per-cpu caches (see coremap.c).
+ *
+ * Functions:
+ *     coremap_bootstrap  - take over physical memory from ram.c.
+ *                          Called from vm_bootstrap.
+ *     coremap_allockernel - allocate NPAGES physically contiguous
+ *                          frames for the kernel. Returns 0 if no
+ *                          such run of frames is free.
+ *     coremap_freekernel - release a run of frames returned by
+ *                          coremap_allockernel, given its first
+ *                          frame. Frames that predate the coremap
+ *                          are silently leaked.
+ *     coremap_allocuser  - allocate one frame to hold the page at
+ *                          VADDR in address space AS, zeroed if ZERO
+ *                          is true. The frame comes back pinned.
+ *                          Waits for the pageout daemon if memory is
+ *                          short; returns 0 if memory is exhausted
+ *                          all the same.
+ *     coremap_pin        - pin the user frame PADDR mapped by PTE,
+ *                          waiting if it's busy. Returns false if PTE
+ *                          stopped mapping PADDR in the meantime.
+ *     coremap_unpin      - unpin a user frame and mark it used.
+ *     coremap_share      - add another mapping to a pinned user frame,
+ *                          for copy-on-write.
+ *     coremap_disown     - forget the owner of a pinned user frame,
+ *                          so it is never paged out (page cache).
+ *     coremap_pinshared  - pin an ownerless user frame the caller
+ *                          holds a reference to, waiting if it's busy.
+ *     coremap_trypinshared - same, but fail instead of waiting.
+ *     coremap_cowclaim   - on a fault on a copy-on-write page, take
+ *                          over the (pinned) frame if the caller's
+ *                          mapping is the only one left. Returns false
+ *                          if it is still shared (and, for a write,
+ *                          the caller must copy the page instead).
+ *     coremap_freeuser   - drop one mapping of a pinned user frame and
+ *                          unpin it; the frame is released when the
+ *                          last mapping goes.
+ *     coremap_zeroone    - zero a free frame for the zero pool, if
+ *                          it's worth it. Never sleeps. Returns true
+ *                          if it did anything.
+ *     coremap_bootstrapped - true once coremap_bootstrap has run.
+ *     coremap_printstats - print memory usage.
+ *
+ * Functions for the pageout daemon (see vm/pageout.c):
+ *     coremap_pageout_start - register the calling thread as the
+ *                          pageout daemon.
+ *     coremap_pageout_wait - sleep until free memory is low or
+ *                          somebody is waiting for memory.
+ *     coremap_clock      - pick a victim frame with the clock
+ *                          algorithm. Returns it pinned, with its
+ *                          owner in *AS and *VADDR, or 0 if nothing
+ *                          can be evicted.
+ *     coremap_pinvictim  - pin PADDR as a victim too if it holds page
+ *                          VADDR of AS and is idle.
+ *     coremap_evicted    - release a victim whose page is now in swap.
+ *     coremap_pageout_stuck - report that nothing could be paged out.
+ */
+
+struct addrspace;
+
+void coremap_bootstrap(void);
+bool coremap_bootstrapped(void);
+
+paddr_t coremap_allockernel(unsigned npages);
+void coremap_freekernel(paddr_t paddr);
+
+paddr_t coremap_allocuser(struct addrspace *as, vaddr_t vaddr, bool zero);
+bool coremap_pin(paddr_t paddr, const pte_t *pte);
+void coremap_unpin(paddr_t paddr);
+void coremap_share(paddr_t paddr);
+void coremap_disown(paddr_t paddr);
+void coremap_pinshared(paddr_t paddr);
+bool coremap_trypinshared(paddr_t paddr);
+bool coremap_cowclaim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_freeuser(paddr_t paddr);
+bool coremap_zeroone(void);
+
+void coremap_pageout_start(void);
+void coremap_pageout_wait(void);
+paddr_t coremap_clock(struct addrspace **as, vaddr_t *vaddr);
+bool coremap_pinvictim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_evicted(paddr_t paddr);
+void coremap_pageout_stuck(void);
+
+void coremap_printstats(void);
+
+
+#endif /* _COREMAP_H_ */
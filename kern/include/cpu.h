@@ -34,6 +34,16 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <vmstat.h>
+
+struct addrspace;
+struct callout_wheel;
+
+/*
+ * Number of scheduling priorities. Each cpu has one run queue per
+ * priority; 0 is the highest. See schedule() in thread.c.
+ */
+#define SCHED_NPRIO	4
 
 
 /*
@@ -61,13 +71,45 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	bool c_tickless;		/* Idle with periodic hardclock off */
+	unsigned c_ticklessticks;	/* ...until the one-shot, in ticks */
+	unsigned c_ticksowed;		/* Ticks hardclock has to make up */
+
+	/*
+	 * TLB refill state and VM statistics.
+	 * Accessed only by this cpu, with interrupts off.
+	 */
+	unsigned c_tlbhand;		/* Next TLB slot to (re)fill */
+	struct vmstats c_vmstats;	/* VM events on this cpu */
+
+	/*
+	 * Pending callouts; see <callout.h>.
+	 * Protected by the wheel's own lock.
+	 */
+	struct callout_wheel *c_callouts;
+
+	/*
+	 * Exited threads kept, stacks and all, for thread_fork to
+	 * reuse. Mostly used by this cpu, but the thread pool shrinker
+	 * empties every cpu's, so it has a lock.
+	 */
+	struct threadlist c_threadpool;
+	struct spinlock c_threadpool_lock;
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * c_isidle and c_runcount are only changed with the lock held,
+	 * but other cpus also read them without it, as load hints for
+	 * choosing whom to steal work from or push work to. Such a
+	 * reading may be stale and must be rechecked under the lock
+	 * before acting on it.
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	volatile bool c_isidle;		/* True if this cpu is idle */
+	struct threadlist c_runqueues[SCHED_NPRIO]; /* Run queues, by priority */
+	volatile unsigned c_runcount;	/* Threads on all run queues */
+	struct thread *c_leaving;	/* Switched out, must go elsewhere */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -82,10 +124,22 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * If more than TLBSHOOTDOWN_MAX requests pile up, the queue
+	 * is replaced by a request to flush the whole TLB
+	 * (c_numshootdown is then TLBSHOOTDOWN_ALL). Every time the
+	 * cpu finishes a batch it bumps c_shootdown_done, which is how
+	 * senders find out their requests have been carried out.
+	 *
+	 * c_tlbas is the address space most recently activated on the
+	 * cpu, i.e. the only one whose mappings can be in its TLB.
+	 * Shootdowns for other address spaces skip the cpu.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	volatile unsigned c_shootdown_done; /* Batches completed */
+	const struct addrspace *c_tlbas; /* Address space in the TLB */
 	struct spinlock c_ipi_lock;
 };
 
@@ -107,6 +161,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * cpu_count returns the number of cpus; cpu_get returns the cpu whose
+ * c_number is NUM.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -150,6 +211,16 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch queues N shootdowns on TARGET, if TARGET may
+ * have mappings of AS in its TLB (or unconditionally if AS is NULL),
+ * raising at most one interrupt; it returns false if it skipped the
+ * cpu, and otherwise a ticket for ipi_tlbshootdown_wait in *TICKET.
+ * ipi_tlbshootdown_wait waits until TARGET has carried out everything
+ * queued before the ticket was issued. It spins on TARGET's counter
+ * only, with interrupts on, so cpus shooting at each other at the
+ * same time can't deadlock.
+ * ipi_tlbshootdown_setas records that the current cpu's TLB now holds
+ * mappings of AS (called on as_activate).
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -164,6 +235,11 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+bool ipi_tlbshootdown_batch(struct cpu *target, const struct addrspace *as,
+			    const struct tlbshootdown *mappings, unsigned n,
+			    unsigned *ticket);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
+void ipi_tlbshootdown_setas(const struct addrspace *as);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HASHTABLE_H_
+#define _HASHTABLE_H_
+
+#include <cdefs.h>
+#include <lib.h>
+
+#ifndef HASHTABLEINLINE
+#define HASHTABLEINLINE INLINE
+#endif
+
+/*
+ * Intrusive hash table with chaining.
+ *
+ * The table doesn't allocate anything per entry: each object that
+ * goes in a table has a struct hashnode in it, much like the
+ * threadlistnode in a thread. The node remembers the object's hash
+ * value, so the table can grow and shrink (by powers of two, keeping
+ * the average chain length between 1/8 and 2) without calling back
+ * into the caller.
+ *
+ * ->hn_self always points to the object that contains the hashnode,
+ * for the same reason as in threadlist.h.
+ *
+ * Base operations, on hashnodes:
+ *
+ * init - initialize a table in space externally allocated. No
+ *       buckets are allocated until the first add.
+ * cleanup - clean up a table. It must be empty.
+ * num - return the number of entries.
+ * add - add NODE with hash value HASH. Fails with ENOMEM only if the
+ *       table has no buckets yet and they can't be allocated; failing
+ *       to grow a table that has buckets just leaves it as is.
+ * remove - remove NODE, which must be in the table.
+ * bucket - return the first node whose hash is in the same bucket
+ *       as HASH; follow hn_next from there, and check hn_hash and the
+ *       key itself. This is how lookups are done.
+ * next - iterate: return the node after PREV in no particular order,
+ *       or the first node if PREV is NULL, or NULL at the end. The
+ *       table must not change during iteration. (To empty a table,
+ *       keep removing whatever next(NULL) returns.)
+ *
+ * Hash functions:
+ *
+ * hash_u32 - mix the bits of an integer key.
+ * hash_string - hash a null-terminated string (FNV-1a).
+ *
+ * Typed tables are declared like typed arrays (see array.h):
+ *
+ * DECLHASH(NAME, T, K, INLINE) declares "struct NAME", a table of
+ * "T" objects with keys of type "K", and these operations:
+ *
+ *    NAME_init, NAME_cleanup, NAME_num - as above
+ *    int NAME_add(struct NAME *, T *obj)
+ *    void NAME_remove(struct NAME *, T *obj)
+ *    T *NAME_find(const struct NAME *, K key)
+ *    T *NAME_next(const struct NAME *, T *prev)
+ *
+ * DEFHASH(NAME, T, K, FIELD, KEYOF, HASHFN, EQFN, INLINE) defines
+ * them. FIELD is the name of the struct hashnode in T; KEYOF(obj)
+ * returns the key of an object, HASHFN(key) returns a uint32_t hash
+ * of a key, and EQFN(key1, key2) tells if two keys are the same. Any
+ * of the last three may be macros.
+ *
+ * For example:
+ *
+ *    struct widget { unsigned w_id; struct hashnode w_hashnode; };
+ *    #define widget_id(w) ((w)->w_id)
+ *    #define widget_ideq(a, b) ((a) == (b))
+ *    DECLHASH(widgettable, struct widget, unsigned, WIDGETINLINE);
+ *    DEFHASH(widgettable, struct widget, unsigned, w_hashnode,
+ *            widget_id, hash_u32, widget_ideq, WIDGETINLINE);
+ *
+ * with WIDGETINLINE handled like ARRAYINLINE in array.h.
+ *
+ * Note that hashnode_init must be called on each object's node
+ * before it is first added, to set hn_self.
+ */
+
+struct hashnode {
+	struct hashnode *hn_next;	/* next in bucket */
+	uint32_t hn_hash;		/* hash value of the key */
+	void *hn_self;			/* containing object */
+};
+
+struct hashtable {
+	struct hashnode **ht_buckets;
+	unsigned ht_nbuckets;		/* power of 2, or 0 */
+	unsigned ht_num;		/* number of entries */
+};
+
+void hashnode_init(struct hashnode *hn, void *self);
+
+void hashtable_init(struct hashtable *ht);
+void hashtable_cleanup(struct hashtable *ht);
+HASHTABLEINLINE unsigned hashtable_num(const struct hashtable *ht);
+int hashtable_add(struct hashtable *ht, struct hashnode *hn, uint32_t hash);
+void hashtable_remove(struct hashtable *ht, struct hashnode *hn);
+HASHTABLEINLINE struct hashnode *hashtable_bucket(const struct hashtable *ht,
+						 uint32_t hash);
+struct hashnode *hashtable_next(const struct hashtable *ht,
+				struct hashnode *prev);
+
+HASHTABLEINLINE uint32_t hash_u32(uint32_t key);
+uint32_t hash_string(const char *s);
+
+HASHTABLEINLINE unsigned
+hashtable_num(const struct hashtable *ht)
+{
+	return ht->ht_num;
+}
+
+HASHTABLEINLINE struct hashnode *
+hashtable_bucket(const struct hashtable *ht, uint32_t hash)
+{
+	if (ht->ht_nbuckets == 0) {
+		return NULL;
+	}
+	return ht->ht_buckets[hash & (ht->ht_nbuckets - 1)];
+}
+
+/*
+ * Multiplicative hashing (Knuth), folded so the low bits, which pick
+ * the bucket, depend on all of the key.
+ */
+HASHTABLEINLINE uint32_t
+hash_u32(uint32_t key)
+{
+	key *= 0x9e3779b1;
+	return key ^ (key >> 16);
+}
+
+#define DECLHASH(NAME, T, K, INLINE) \
+	struct NAME {						\
+		struct hashtable ht;				\
+	};							\
+								\
+	INLINE void NAME##_init(struct NAME *h);		\
+	INLINE void NAME##_cleanup(struct NAME *h);		\
+	INLINE unsigned NAME##_num(const struct NAME *h);	\
+	INLINE int NAME##_add(struct NAME *h, T *obj);		\
+	INLINE void NAME##_remove(struct NAME *h, T *obj);	\
+	INLINE T *NAME##_find(const struct NAME *h, K key);	\
+	INLINE T *NAME##_next(const struct NAME *h, T *prev)
+
+#define DEFHASH(NAME, T, K, FIELD, KEYOF, HASHFN, EQFN, INLINE) \
+	INLINE void						\
+	NAME##_init(struct NAME *h)				\
+	{							\
+		hashtable_init(&h->ht);				\
+	}							\
+								\
+	INLINE void						\
+	NAME##_cleanup(struct NAME *h)				\
+	{							\
+		hashtable_cleanup(&h->ht);			\
+	}							\
+								\
+	INLINE unsigned						\
+	NAME##_num(const struct NAME *h)			\
+	{							\
+		return hashtable_num(&h->ht);			\
+	}							\
+								\
+	INLINE int						\
+	NAME##_add(struct NAME *h, T *obj)			\
+	{							\
+		KASSERT(obj->FIELD.hn_self == obj);		\
+		return hashtable_add(&h->ht, &obj->FIELD,	\
+				     HASHFN(KEYOF(obj)));	\
+	}							\
+								\
+	INLINE void						\
+	NAME##_remove(struct NAME *h, T *obj)			\
+	{							\
+		hashtable_remove(&h->ht, &obj->FIELD);		\
+	}							\
+								\
+	INLINE T *						\
+	NAME##_find(const struct NAME *h, K key)		\
+	{							\
+		struct hashnode *hn;				\
+		uint32_t hash;					\
+		T *obj;						\
+								\
+		hash = HASHFN(key);				\
+		for (hn = hashtable_bucket(&h->ht, hash);	\
+		     hn != NULL; hn = hn->hn_next) {		\
+			obj = hn->hn_self;			\
+			if (hn->hn_hash == hash &&		\
+			    EQFN(KEYOF(obj), key)) {		\
+				return obj;			\
+			}					\
+		}						\
+		return NULL;					\
+	}							\
+								\
+	INLINE T *						\
+	NAME##_next(const struct NAME *h, T *prev)		\
+	{							\
+		struct hashnode *hn;				\
+								\
+		hn = hashtable_next(&h->ht,			\
+				    prev == NULL ? NULL : &prev->FIELD); \
+		return hn == NULL ? NULL : hn->hn_self;		\
+	}
+
+
+#endif /* _HASHTABLE_H_ */
@@ -67,6 +67,20 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+
+	/* OS/161 VM statistics; see <vmstat.h> in the kernel. */
+	__counter_t ru_readflt;		/* faults on reads (count) */
+	__counter_t ru_writeflt;	/* faults on writes (count) */
+	__counter_t ru_tlbmiss;		/* TLB entries loaded (count) */
+	__counter_t ru_tlbevict;	/* ...replacing a valid entry (count) */
+	__counter_t ru_zerofill;	/* pages zero-filled (count) */
+	__counter_t ru_cowbreak;	/* copy-on-write pages split (count) */
+	__counter_t ru_pagein;		/* pages read from disk (count) */
+	__counter_t ru_pageout;		/* pages written to swap (count) */
+
+	/* OS/161 scheduler statistics, for the calling thread. */
+	__counter_t ru_migrations;	/* moves to another cpu (count) */
+	__counter_t ru_xcpuwakeups;	/* wakeups onto another cpu (count) */
 };
 
 /* limit codes for getrusage/setrusage */
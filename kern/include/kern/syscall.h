@@ -86,7 +86,7 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -196,6 +196,8 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+#define SYS_setaffinity  121
+#define SYS_getaffinity  122
 
 /*CALLEND*/
 
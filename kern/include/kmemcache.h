@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Object caches for frequently created kernel objects.
+ *
+ * A cache hands out objects of one size that are already in their
+ * constructed state: the constructor runs when an object is first
+ * made, not on every allocation, and the destructor only when the
+ * cache finally gives the memory back to kmalloc. So things like
+ * embedded spinlocks, wait channels, and subsidiary locks survive
+ * from one use of an object to the next. Callers must return objects
+ * to the cache in the same constructed state they got them in.
+ *
+ * Each cache keeps at most KMEM_CACHE_DEPTH free objects; past that,
+ * freed objects are destroyed and returned to kmalloc, which has its
+ * own per-cpu caching underneath.
+ *
+ * Functions:
+ *     kmem_cache_create  - make a cache of SIZE-byte objects. CTOR,
+ *                          which may be NULL, returns an error code
+ *                          if it can't construct the object; DTOR,
+ *                          also optional, undoes it.
+ *     kmem_cache_destroy - destroy a cache. All its objects must have
+ *                          been freed.
+ *     kmem_cache_alloc   - get a constructed object, or NULL if out
+ *                          of memory.
+ *     kmem_cache_free    - return a constructed object.
+ *     kmem_cache_reap    - destroy the free objects held by a cache.
+ *     kmem_cache_reapall - same, for every cache.
+ *     kmem_cache_printstats - print usage counts for every cache.
+ */
+
+#define KMEM_CACHE_DEPTH 32
+
+struct kmem_cache;
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_reap(struct kmem_cache *kc);
+void kmem_cache_reapall(void);
+void kmem_cache_printstats(void);
+
+
+#endif /* _KMEMCACHE_H_ */
@@ -125,6 +125,15 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ *
+ * kheap_drain returns blocks cached in the per-cpu magazines to the
+ * heap pages so that wholly free pages can be released, and returns
+ * the number of pages that were.
+ *
+ * kheap_profile_start turns on the sampling allocation profiler,
+ * recording one allocation in RATE (0 for the default);
+ * kheap_profile_stop turns it off; kheap_profile_dump prints what it
+ * saw and proposes additional block sizes.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +141,10 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+unsigned kheap_drain(void);
+void kheap_profile_start(unsigned rate);
+void kheap_profile_stop(void);
+void kheap_profile_dump(void);
 
 /*
  * C string functions.
@@ -194,5 +207,14 @@ void kprintf_bootstrap(void);
 #define DIVROUNDUP(a,b) (((a)+(b)-1)/(b))
 #define ROUNDUP(a,b)    (DIVROUNDUP(a,b)*(b))
 
+/*
+ * Bit scanning. For nonzero X, ctz32 returns the index of the lowest
+ * set bit and clz32 the number of zero bits above the highest one.
+ * (Not __builtin_ctz/__builtin_clz: MIPS-I has no instruction for
+ * them and we don't link libgcc.)
+ */
+unsigned ctz32(uint32_t x);
+unsigned clz32(uint32_t x);
+
 
 #endif /* _LIB_H_ */
@@ -55,6 +55,13 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Switch the current cpu's hardclock interrupt between periodic and
+ * one-shot, for idling without ticks. (Low-level; see clock.c.)
+ */
+unsigned mainbus_timer_oneshot(unsigned ticks);
+unsigned mainbus_timer_periodic(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache: frames holding pages of files mapped into user address
+ * spaces, shared by every address space that maps the same page of
+ * the same file. Executable text and mmap'd files come from here.
+ *
+ * Pages are keyed by (vnode, file offset of the page). A cached frame
+ * has no single owner as far as the coremap is concerned, so the
+ * pageout daemon leaves it alone; the page cache keeps track of its
+ * mappings instead and frees the frame when the last one goes. Page
+ * table entries that map page cache frames are marked PTE_FILE.
+ *
+ * When memory runs out, the page cache's shrinker unmaps and drops
+ * clean pages that have only one mapping; they are read in again on
+ * the next fault. Shared and dirty pages stay resident until they are
+ * unmapped, so a file mapped by several processes at once, or
+ * written through a mapping, still can't be bigger than memory.
+ *
+ * A page written through a writeable mapping is marked dirty, and is
+ * written back to the file with VOP_WRITE when the last mapping goes.
+ * That puts the data in the buffer cache, which takes it from there.
+ * Until then read() and write() on the file don't see it, and the
+ * page doesn't see write()s; the file system cache and this one are
+ * not unified.
+ *
+ * The vnode pointer is a safe key because every mapping comes from a
+ * region that holds a reference to the vnode.
+ *
+ * Functions:
+ *     pagecache_get    - get the page at OFFSET in V, which AS maps
+ *                        at VADDR, reading it in if it isn't cached.
+ *                        The frame is returned pinned, in *RET, with
+ *                        a mapping added for the caller.
+ *     pagecache_share  - add a mapping at VADDR in AS to a pinned
+ *                        cached frame, for as_copy.
+ *     pagecache_dirty  - note that a pinned cached frame is about to
+ *                        be written to.
+ *     pagecache_release - drop the mapping at VADDR in AS of a pinned
+ *                        cached frame and unpin it; the frame is
+ *                        written back if dirty and freed when the
+ *                        last mapping goes.
+ *     pagecache_bootstrap - register the shrinker.
+ *     pagecache_printstats - print usage counts.
+ */
+
+struct addrspace;
+struct vnode;
+
+int pagecache_get(struct vnode *v, off_t offset,
+		  struct addrspace *as, vaddr_t vaddr, paddr_t *ret);
+int pagecache_share(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void pagecache_dirty(paddr_t paddr);
+void pagecache_release(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void pagecache_bootstrap(void);
+void pagecache_printstats(void);
+
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Per-address-space page tables.
+ *
+ * Two-level table indexed by user virtual page number. The top level
+ * has one slot per 4M of user address space and is allocated with the
+ * address space; second-level tables (one page each) are allocated
+ * only when some page in their 4M range is first touched.
+ *
+ * Each page table entry (pte_t) holds the physical frame of a resident
+ * page plus flag bits in the low-order bits the frame doesn't use.
+ *
+ * PTE_WRITE is set if the page's region is writeable, so TLB refills
+ * can be done from the entry alone.
+ *
+ * PTE_COW marks a frame shared with another address space by as_copy.
+ * It is entered in the TLB read-only even if its region is writeable;
+ * the first write takes a VM_FAULT_READONLY and gets a private copy.
+ *
+ * PTE_FILE marks a frame that belongs to the page cache (see
+ * pagecache.h). Such frames never go to swap, and are shared and
+ * released through the page cache rather than the coremap; when
+ * memory is short the page cache may drop a clean one and clear its
+ * entry. They are entered in the TLB read-only until the first write,
+ * which marks the page dirty.
+ *
+ * A page that has been paged out has PTE_SWAP set instead of
+ * PTE_VALID, and the swap slot holding it where the frame would be.
+ * Swap slots, like frames, can be shared by as_copy.
+ *
+ * Functions:
+ *     pt_create  - allocate an empty page table. Returns NULL on error.
+ *     pt_destroy - free a page table. The caller is responsible for
+ *                  having released any frames its entries refer to.
+ *     pt_lookup  - return a pointer to the entry for VADDR. If the
+ *                  second-level table for VADDR does not exist, it is
+ *                  allocated if CREATE is true; otherwise (or if
+ *                  allocation fails) NULL is returned.
+ */
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* physical frame of resident page */
+#define PTE_VALID	0x00000001	/* page is resident */
+#define PTE_COW		0x00000002	/* frame is shared copy-on-write */
+#define PTE_SWAP	0x00000004	/* page is in swap */
+#define PTE_WRITE	0x00000008	/* region is writeable */
+#define PTE_FILE	0x00000010	/* frame is in the page cache */
+
+#define PTE_ISVALID(pte)	(((pte) & PTE_VALID) != 0)
+#define PTE_ISCOW(pte)		(((pte) & PTE_COW) != 0)
+#define PTE_ISWRITE(pte)	(((pte) & PTE_WRITE) != 0)
+#define PTE_ISFILE(pte)		(((pte) & PTE_FILE) != 0)
+#define PTE_PADDR(pte)		((paddr_t)((pte) & PTE_FRAME))
+#define PTE_ISSWAPPED(pte)	(((pte) & PTE_SWAP) != 0)
+#define PTE_SWAPSLOT(pte)	((unsigned)((pte) >> 12))
+#define PTE_MKSWAP(slot)	(((pte_t)(slot) << 12) | PTE_SWAP)
+
+/* Geometry. */
+#define PT_L2BITS	10
+#define PT_L2SIZE	(1 << PT_L2BITS)		/* entries per L2 */
+#define PT_L1SHIFT	(12 + PT_L2BITS)
+#define PT_L1SIZE	(USERSPACETOP >> PT_L1SHIFT)	/* L1 slots */
+
+#define PT_L1INDEX(va)	((va) >> PT_L1SHIFT)
+#define PT_L2INDEX(va)	(((va) >> 12) & (PT_L2SIZE - 1))
+#define PT_VADDR(l1, l2) \
+	(((vaddr_t)(l1) << PT_L1SHIFT) | ((vaddr_t)(l2) << 12))
+
+struct pagetable {
+	pte_t *pt_l2[PT_L1SIZE];
+};
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+
+#endif /* _PAGETABLE_H_ */
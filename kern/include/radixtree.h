@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RADIXTREE_H_
+#define _RADIXTREE_H_
+
+#include <cdefs.h>
+#include <lib.h>
+
+#ifndef RADIXTREEINLINE
+#define RADIXTREEINLINE INLINE
+#endif
+
+/*
+ * Radix tree: a map from 32-bit integer keys to non-NULL pointers,
+ * for sparse integer-keyed tables (process ids, page numbers, block
+ * numbers, ...).
+ *
+ * Each node has 64 slots and uses 6 bits of the key. The tree is only
+ * as tall as the largest key needs (a tree of keys under 64 is one
+ * node), so dense small keys cost about as much as an array. Lookup
+ * is at most six steps and never compares keys.
+ *
+ * Operations:
+ *
+ * init - initialize a tree in space externally allocated.
+ * cleanup - clean up a tree. It must be empty.
+ * num - return the number of entries.
+ * get - return the value for KEY, or NULL.
+ * add - set the value for KEY, which must not be present, to VAL,
+ *       which must not be NULL. May fail with ENOMEM, in which case
+ *       nothing changes.
+ * remove - remove KEY and return what its value was (NULL if it
+ *       wasn't there).
+ * next - return the value of the entry with the smallest key that
+ *       is >= *KEY, and set *KEY to that key; or NULL if there is no
+ *       such entry. For iterating in key order: start with 0, and
+ *       after each entry go on from its key + 1 (stopping if that
+ *       wraps to 0).
+ *
+ * Typed trees, whose values are pointers to T:
+ *
+ * DECLRADIX_BYTYPE(NAME, T, INLINE) declares "struct NAME" and
+ * NAME_init, NAME_cleanup, NAME_num, NAME_get, NAME_add, NAME_remove,
+ * and NAME_next, the same as above but typed. DEFRADIX_BYTYPE defines
+ * them. DECLRADIX(T, INLINE) and DEFRADIX(T, INLINE) make a
+ * "struct Tradix" of "struct T". INLINE is handled as for arrays (see
+ * array.h).
+ */
+
+#define RADIX_BITS	6
+#define RADIX_FANOUT	(1 << RADIX_BITS)
+#define RADIX_MASK	(RADIX_FANOUT - 1)
+#define RADIX_MAXHEIGHT	DIVROUNDUP(32, RADIX_BITS)
+
+struct radixnode;
+
+struct radixtree {
+	struct radixnode *rt_root;
+	unsigned rt_height;		/* levels of nodes; 0 if empty */
+	unsigned rt_num;		/* number of entries */
+};
+
+void radixtree_init(struct radixtree *rt);
+void radixtree_cleanup(struct radixtree *rt);
+RADIXTREEINLINE unsigned radixtree_num(const struct radixtree *rt);
+void *radixtree_get(const struct radixtree *rt, uint32_t key);
+int radixtree_add(struct radixtree *rt, uint32_t key, void *val);
+void *radixtree_remove(struct radixtree *rt, uint32_t key);
+void *radixtree_next(const struct radixtree *rt, uint32_t *key);
+
+RADIXTREEINLINE unsigned
+radixtree_num(const struct radixtree *rt)
+{
+	return rt->rt_num;
+}
+
+#define DECLRADIX_BYTYPE(NAME, T, INLINE) \
+	struct NAME {						\
+		struct radixtree rt;				\
+	};							\
+								\
+	INLINE void NAME##_init(struct NAME *r);		\
+	INLINE void NAME##_cleanup(struct NAME *r);		\
+	INLINE unsigned NAME##_num(const struct NAME *r);	\
+	INLINE T *NAME##_get(const struct NAME *r, uint32_t key); \
+	INLINE int NAME##_add(struct NAME *r, uint32_t key, T *val); \
+	INLINE T *NAME##_remove(struct NAME *r, uint32_t key);	\
+	INLINE T *NAME##_next(const struct NAME *r, uint32_t *key)
+
+#define DEFRADIX_BYTYPE(NAME, T, INLINE) \
+	INLINE void						\
+	NAME##_init(struct NAME *r)				\
+	{							\
+		radixtree_init(&r->rt);				\
+	}							\
+								\
+	INLINE void						\
+	NAME##_cleanup(struct NAME *r)				\
+	{							\
+		radixtree_cleanup(&r->rt);			\
+	}							\
+								\
+	INLINE unsigned						\
+	NAME##_num(const struct NAME *r)			\
+	{							\
+		return radixtree_num(&r->rt);			\
+	}							\
+								\
+	INLINE T *						\
+	NAME##_get(const struct NAME *r, uint32_t key)		\
+	{							\
+		return (T *)radixtree_get(&r->rt, key);		\
+	}							\
+								\
+	INLINE int						\
+	NAME##_add(struct NAME *r, uint32_t key, T *val)	\
+	{							\
+		return radixtree_add(&r->rt, key, (void *)val);	\
+	}							\
+								\
+	INLINE T *						\
+	NAME##_remove(struct NAME *r, uint32_t key)		\
+	{							\
+		return (T *)radixtree_remove(&r->rt, key);	\
+	}							\
+								\
+	INLINE T *						\
+	NAME##_next(const struct NAME *r, uint32_t *key)	\
+	{							\
+		return (T *)radixtree_next(&r->rt, key);	\
+	}
+
+#define DECLRADIX(T, INLINE) DECLRADIX_BYTYPE(T##radix, struct T, INLINE)
+#define DEFRADIX(T, INLINE) DEFRADIX_BYTYPE(T##radix, struct T, INLINE)
+
+
+#endif /* _RADIXTREE_H_ */
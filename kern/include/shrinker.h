@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SHRINKER_H_
+#define _SHRINKER_H_
+
+/*
+ * Shrinkers: callbacks that give memory back when physical memory
+ * runs out.
+ *
+ * Subsystems that hold memory they could do without (caches, mostly)
+ * register a callback. When the page allocator is about to fail an
+ * allocation it runs the callbacks in priority order, lowest first,
+ * asking each to free up to the number of pages still wanted, and
+ * then tries again.
+ *
+ * A callback is called with no spinlocks held and may sleep. It
+ * should return the number of pages it actually returned to the page
+ * allocator (an estimate is fine), and must not itself wait for
+ * memory: an allocation made from inside a callback that fails fails
+ * without running the shrinkers again.
+ *
+ * Functions:
+ *     shrinker_register  - add a callback. Done at boot time.
+ *     shrinker_run       - run callbacks until NPAGES have been freed
+ *                          or there are no more. Returns the number
+ *                          freed. Returns 0 without doing anything if
+ *                          called from an interrupt, with a spinlock
+ *                          held, or while another thread (or this
+ *                          one, from inside a callback) is running
+ *                          them.
+ *     shrinker_printstats - print the callbacks and what they've done.
+ */
+
+/* Priorities for shrinker_register. */
+#define SHRINK_PRIO_CACHE	10	/* caches of clean data */
+#define SHRINK_PRIO_HEAP	20	/* free memory held by allocators */
+
+typedef unsigned (*shrinker_func)(unsigned npages);
+
+int shrinker_register(const char *name, unsigned priority,
+		      shrinker_func func);
+unsigned shrinker_run(unsigned npages);
+void shrinker_printstats(void);
+
+
+#endif /* _SHRINKER_H_ */
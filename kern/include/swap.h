@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Paged-out user pages live in page-sized slots on the swap device
+ * (SWAP_DEVICE, attached with vfs_swapon at boot). Each slot has a
+ * count of the page table entries that refer to it, so as_copy can
+ * share swapped pages the same way it shares resident ones.
+ *
+ * Functions:
+ *     swap_bootstrap - attach the swap device. If it isn't there,
+ *                      paging to disk is disabled.
+ *     swap_enabled   - true if there is swap.
+ *     swap_alloc     - allocate NSLOTS consecutive slots; the first
+ *                      is returned in *SLOT. Returns ENOSPC if there
+ *                      is no run that long.
+ *     swap_share     - add a reference to a slot.
+ *     swap_free      - drop a reference to a slot.
+ *     swap_pagein    - read SLOT into the frame PADDR.
+ *     swap_pageout   - write the NPAGES frames in PADDRS to the
+ *                      consecutive slots starting at SLOT, in one
+ *                      device operation.
+ *
+ * The pageout daemon (vm/pageout.c) is started by pageout_bootstrap
+ * if there is swap. It keeps a reserve of free frames by writing out
+ * pages the coremap clock picks, in clusters of up to
+ * PAGEOUT_CLUSTER virtually adjacent pages.
+ */
+
+#define SWAP_DEVICE "lhd1:"
+#define PAGEOUT_CLUSTER 8
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+
+int swap_alloc(unsigned nslots, unsigned *slot);
+void swap_share(unsigned slot);
+void swap_free(unsigned slot);
+
+int swap_pagein(unsigned slot, paddr_t paddr);
+int swap_pageout(unsigned slot, const paddr_t *paddrs, unsigned npages);
+
+void pageout_bootstrap(void);
+
+
+#endif /* _SWAP_H_ */
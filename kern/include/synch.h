@@ -37,6 +37,12 @@
 
 #include <spinlock.h>
 
+/*
+ * Set up the object caches locks and CVs come from. Called once,
+ * early in boot.
+ */
+void synch_bootstrap(void);
+
 /*
  * Dijkstra-style semaphore.
  *
@@ -58,9 +64,14 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * sem_timed_P is P, but gives up and returns ETIMEDOUT if the count
+ * hasn't become nonzero within NSECS nanoseconds; otherwise it
+ * returns 0. With NSECS of 0 it only tries once.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int sem_timed_P(struct semaphore *, uint64_t nsecs);
 
 
 /*
@@ -133,8 +144,11 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - Like cv_wait, but also wake up after NSECS
+ *                   nanoseconds. Returns ETIMEDOUT if it woke up
+ *                   because the time ran out, and 0 otherwise.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all four operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
@@ -143,6 +157,7 @@ void cv_destroy(struct cv *);
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, uint64_t nsecs);
 
 
 #endif /* _SYNCH_H_ */
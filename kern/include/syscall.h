@@ -58,6 +58,10 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t user_req, userptr_t user_rem);
 void sys__exit(int code);
+int sys_getrusage(int who, userptr_t usage);
+int sys_setaffinity(unsigned mask);
+int sys_getaffinity(userptr_t mask);
 
 #endif /* _SYSCALL_H_ */
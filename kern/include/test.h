@@ -40,6 +40,12 @@
  * Test code.
  */
 
+struct timespec;
+
+/* benchmark timing (test/benchtime.c) */
+uint64_t bench_nsecs(const struct timespec *before,
+		     const struct timespec *after);
+
 /* These are only used during synchronization testing (OPT_SYNCHPROBS). */
 int elves(int, char **);
 int airballoon(int, char **);
@@ -48,7 +54,12 @@ int airballoon(int, char **);
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int bitmapbench(int, char **);
 int threadlisttest(int, char **);
+int hashtabletest(int, char **);
+int hashtablebench(int, char **);
+int radixtreetest(int, char **);
+int radixtreebench(int, char **);
 
 /* thread join test */
 int threadjointest(int argc, char ** args);
@@ -100,7 +111,13 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int kmallocbench(int, char **);
 int nettest(int, char **);
+int tlbshootdowntest(int, char **);
+int affinitytest(int, char **);
+int callouttest(int, char **);
+int mmaptest(int, char **);
+int copybench(int, char **);
 
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
@@ -74,6 +74,9 @@ struct t_id_list {
 	int tail;
 };
 
+/* Names shorter than this are kept in the thread structure itself */
+#define THREAD_NAMEBUF 24
+
 /* Thread structure. */
 struct thread {
 
@@ -83,6 +86,7 @@ struct thread {
 	 * debugger is messed up.
 	 */
 	char *t_name;			/* Name of this thread */
+	char t_namebuf[THREAD_NAMEBUF];	/* Storage for t_name if short */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
@@ -95,6 +99,18 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	struct wchan *t_wchan;		/* Wait channel it's on, if any */
+
+	/*
+	 * Scheduler fields. Protected by the run queue lock of t_cpu
+	 * (or owned by t_cpu while the thread is running there).
+	 */
+	unsigned t_priority;		/* Run queue; 0 is highest */
+	unsigned t_ticksleft;		/* Hardclocks left in quantum */
+	unsigned t_enqueued;		/* c_hardclocks when queued */
+	unsigned t_affinity;		/* Mask of cpus it may run on */
+	unsigned t_migrations;		/* Times moved to another cpu */
+	unsigned t_xcpuwakeups;		/* Woken onto a cpu not the waker's */
 	
 	/*
 	 * Interrupt state fields.
@@ -198,6 +214,28 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Sleep for TICKS hardclocks. (See also thread_sleep_ns in clock.h.)
+ */
+void thread_sleep_ticks(unsigned ticks);
+
+/*
+ * CPU affinity of the current thread. Bit N of the mask allows the
+ * thread to run on the cpu whose c_number is N. New threads inherit
+ * the mask of the thread that forks them. thread_setaffinity fails
+ * with EINVAL if the mask names no cpu that exists.
+ */
+#define THREAD_AFFINITY_ALL	0xffffffffU
+int thread_setaffinity(unsigned mask);
+unsigned thread_getaffinity(void);
+
+/*
+ * Charge the current thread for one hardclock, and preempt it if its
+ * quantum is used up or a higher-priority thread is waiting. Called
+ * from the timer interrupt.
+ */
+void thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct addrspace;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -55,8 +57,19 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Idle-time housekeeping (called by cpu_idle); true if it did work */
+bool vm_idle(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
+void vm_tlbshootdown_all(void);
+
+/* Invalidate all TLB entries on the current cpu */
+void vm_tlbflush(void);
+
+/* Invalidate pages of an address space in all TLBs, and wait for it */
+void vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *vaddrs,
+			   unsigned n);
 
 
 #endif /* _VM_H_ */
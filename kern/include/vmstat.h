@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _VMSTAT_H_
+#define _VMSTAT_H_
+
+/*
+ * VM event counters.
+ *
+ * Each address space counts what happened to it (in as_stats), and
+ * each cpu counts everything that happened on it (in c_vmstats); the
+ * global figures are the sum over the cpus. Counters only go up.
+ *
+ * The per-cpu counters are only touched by their own cpu with
+ * interrupts off and are exact. The per-address-space counters are
+ * also bumped by the pageout daemon, without a lock, so they can
+ * occasionally lose an update; they're statistics, not accounting.
+ *
+ * Functions:
+ *     vmstat_add     - add N to counter WHICH of this cpu and, if
+ *                      VS is not NULL, of VS too.
+ *     vmstat_inc     - vmstat_add of 1.
+ *     vmstat_global  - sum the per-cpu counters into VS.
+ *     vmstat_print   - print VS, labelled with WHO.
+ *     vmstat_exited  - remember the counters of a process that is
+ *                      exiting, for vmstat_printall.
+ *     vmstat_printall - print the global counters and those of the
+ *                      last process to exit.
+ */
+
+enum vmstat_counter {
+	VMS_FAULTS,		/* calls to vm_fault */
+	VMS_READFAULTS,		/* ...for reads */
+	VMS_WRITEFAULTS,	/* ...for writes to unmapped pages */
+	VMS_ROFAULTS,		/* ...for writes to read-only mappings */
+	VMS_FASTFAULTS,		/* handled from the page table alone */
+	VMS_TLBMISSES,		/* TLB entries loaded */
+	VMS_TLBEVICTIONS,	/* ...that replaced a valid entry */
+	VMS_ZEROFILLS,		/* pages zero-filled on first touch */
+	VMS_COWCOPIES,		/* copy-on-write pages copied */
+	VMS_COWCLAIMS,		/* copy-on-write pages taken over */
+	VMS_CACHEFAULTS,	/* pages mapped from the page cache */
+	VMS_FILEINS,		/* pages read from the executable */
+	VMS_SWAPINS,		/* pages read back from swap */
+	VMS_PAGEOUTS,		/* pages written to swap */
+	VMS_NCOUNTERS		/* (number of counters) */
+};
+
+struct vmstats {
+	unsigned vs_count[VMS_NCOUNTERS];
+};
+
+void vmstat_add(struct vmstats *vs, enum vmstat_counter which, unsigned n);
+#define vmstat_inc(vs, which) vmstat_add(vs, which, 1)
+void vmstat_global(struct vmstats *vs);
+void vmstat_print(const char *who, const struct vmstats *vs);
+void vmstat_exited(const char *name, const struct vmstats *vs);
+void vmstat_printall(void);
+
+
+#endif /* _VMSTAT_H_ */
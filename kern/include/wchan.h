@@ -45,6 +45,12 @@ struct wchan; /* Opaque */
  */
 struct wchan *wchan_create(const char *name);
 
+/*
+ * Change a wait channel's name, for objects that keep their wchan
+ * across reuse. The same rules about NAME apply. Must be empty.
+ */
+void wchan_setname(struct wchan *wc, const char *name);
+
 /*
  * Destroy a wait channel. Must be empty and unlocked.
  */
@@ -66,6 +72,14 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but also wake up after TICKS hardclocks if
+ * nobody else has by then. Returns true if woken by wchan_wake*,
+ * false if the time ran out.
+ */
+bool wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			 unsigned ticks);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
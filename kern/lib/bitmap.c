@@ -27,6 +27,7 @@
  * SUCH DAMAGE.
  */
 
+
 /*
  * Fixed-size array of bits. (Intended for storage management.)
  */
@@ -42,16 +43,116 @@
  * because if one uses any data type more than a single byte wide,
  * bitmap data saved on disk becomes endian-dependent, which is a
  * severe nuisance.
+ *
+ * We do search 32 bits at a time, though: a "chunk" is four bytes
+ * put together into a uint32_t by hand, little-endian, so bit N of
+ * the bitmap is bit N%32 of chunk N/32 on any machine.
  */
 #define BITS_PER_WORD   (CHAR_BIT)
 #define WORD_TYPE       unsigned char
 #define WORD_ALLBITS    (0xff)
 
+#define BITS_PER_CHUNK  32
+#define WORDS_PER_CHUNK (BITS_PER_CHUNK / BITS_PER_WORD)
+#define CHUNK_ALLBITS   (0xffffffff)
+#define NOCHUNK         ((unsigned)-1)
+
+/*
+ * To skip over full parts of the bitmap without looking at them,
+ * there's a two-level summary: bit C of nonfull is set if chunk C
+ * has a clear bit, and bit W of nonfull2 is set if word W of nonfull
+ * isn't zero. Allocation starts looking at the chunk the previous
+ * one came from (next-fit), so a bitmap that fills up from the front
+ * doesn't get rescanned from the beginning every time.
+ */
 struct bitmap {
         unsigned nbits;
         WORD_TYPE *v;
+        unsigned nchunks;       /* chunks in v, rounded up */
+        uint32_t *nonfull;      /* bit per chunk: has a clear bit */
+        uint32_t *nonfull2;     /* bit per word of nonfull: nonzero */
+        unsigned nsum;          /* words in nonfull */
+        unsigned nsum2;         /* words in nonfull2 */
+        unsigned hint;          /* chunk to start searching at */
 };
 
+static
+inline
+uint32_t
+bitmap_chunk(const struct bitmap *b, unsigned c)
+{
+        const WORD_TYPE *p = b->v + c*WORDS_PER_CHUNK;
+
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+                ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * Bring the summary bits for chunk C up to date.
+ */
+static
+void
+bitmap_update(struct bitmap *b, unsigned c)
+{
+        unsigned wi = c / 32;
+        uint32_t mask = (uint32_t)1 << (c % 32);
+
+        if (bitmap_chunk(b, c) == CHUNK_ALLBITS) {
+                b->nonfull[wi] &= ~mask;
+        }
+        else {
+                b->nonfull[wi] |= mask;
+        }
+
+        mask = (uint32_t)1 << (wi % 32);
+        if (b->nonfull[wi] == 0) {
+                b->nonfull2[wi / 32] &= ~mask;
+        }
+        else {
+                b->nonfull2[wi / 32] |= mask;
+        }
+}
+
+/*
+ * Return the first chunk at or after START with a clear bit in it,
+ * or NOCHUNK.
+ */
+static
+unsigned
+bitmap_findchunk(const struct bitmap *b, unsigned start)
+{
+        unsigned wi, wi2;
+        uint32_t w;
+
+        if (start >= b->nchunks) {
+                return NOCHUNK;
+        }
+
+        /* The rest of start's own summary word. */
+        wi = start / 32;
+        w = b->nonfull[wi] & (CHUNK_ALLBITS << (start % 32));
+        if (w != 0) {
+                return wi*32 + ctz32(w);
+        }
+
+        /* Otherwise, the next nonzero summary word. */
+        wi++;
+        if (wi >= b->nsum) {
+                return NOCHUNK;
+        }
+        wi2 = wi / 32;
+        w = b->nonfull2[wi2] & (CHUNK_ALLBITS << (wi % 32));
+        while (w == 0) {
+                wi2++;
+                if (wi2 >= b->nsum2) {
+                        return NOCHUNK;
+                }
+                w = b->nonfull2[wi2];
+        }
+        wi = wi2*32 + ctz32(w);
+        KASSERT(b->nonfull[wi] != 0);
+        return wi*32 + ctz32(b->nonfull[wi]);
+}
 
 struct bitmap *
 bitmap_create(unsigned nbits)
@@ -59,33 +160,46 @@ bitmap_create(unsigned nbits)
         struct bitmap *b;
         unsigned words;
 
-        words = DIVROUNDUP(nbits, BITS_PER_WORD);
         b = kmalloc(sizeof(struct bitmap));
         if (b == NULL) {
                 return NULL;
         }
+        b->nchunks = DIVROUNDUP(nbits, BITS_PER_CHUNK);
+        b->nsum = DIVROUNDUP(b->nchunks, 32);
+        b->nsum2 = DIVROUNDUP(b->nsum, 32);
+
+        /* Round the data up to whole chunks, for bitmap_chunk. */
+        words = b->nchunks * WORDS_PER_CHUNK;
         b->v = kmalloc(words*sizeof(WORD_TYPE));
         if (b->v == NULL) {
                 kfree(b);
                 return NULL;
         }
+        b->nonfull = kmalloc((b->nsum + b->nsum2) * sizeof(uint32_t));
+        if (b->nonfull == NULL) {
+                kfree(b->v);
+                kfree(b);
+                return NULL;
+        }
+        b->nonfull2 = b->nonfull + b->nsum;
 
         bzero(b->v, words*sizeof(WORD_TYPE));
         b->nbits = nbits;
 
         /* Mark any leftover bits at the end in use */
         if (words > nbits / BITS_PER_WORD) {
-                unsigned j, ix = words-1;
+                unsigned j, ix = nbits / BITS_PER_WORD;
                 unsigned overbits = nbits - ix*BITS_PER_WORD;
 
-                KASSERT(nbits / BITS_PER_WORD == words-1);
-                KASSERT(overbits > 0 && overbits < BITS_PER_WORD);
-
                 for (j=overbits; j<BITS_PER_WORD; j++) {
                         b->v[ix] |= ((WORD_TYPE)1 << j);
                 }
+                for (ix++; ix<words; ix++) {
+                        b->v[ix] = WORD_ALLBITS;
+                }
         }
 
+        bitmap_rescan(b);
         return b;
 }
 
@@ -95,31 +209,169 @@ bitmap_getdata(struct bitmap *b)
         return b->v;
 }
 
+void
+bitmap_rescan(struct bitmap *b)
+{
+        unsigned c;
+
+        bzero(b->nonfull, (b->nsum + b->nsum2) * sizeof(uint32_t));
+        for (c=0; c<b->nchunks; c++) {
+                bitmap_update(b, c);
+        }
+        b->hint = 0;
+}
+
 int
 bitmap_alloc(struct bitmap *b, unsigned *index)
 {
-        unsigned ix;
-        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-        unsigned offset;
+        unsigned c, offset;
 
-        for (ix=0; ix<maxix; ix++) {
-                if (b->v[ix]!=WORD_ALLBITS) {
-                        for (offset = 0; offset < BITS_PER_WORD; offset++) {
-                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
-
-                                if ((b->v[ix] & mask)==0) {
-                                        b->v[ix] |= mask;
-                                        *index = (ix*BITS_PER_WORD)+offset;
-                                        KASSERT(*index < b->nbits);
-                                        return 0;
-                                }
+        c = bitmap_findchunk(b, b->hint);
+        if (c == NOCHUNK) {
+                /* Wrap around. */
+                c = bitmap_findchunk(b, 0);
+                if (c == NOCHUNK) {
+                        return ENOSPC;
+                }
+        }
+
+        offset = ctz32(~bitmap_chunk(b, c));
+        *index = c*BITS_PER_CHUNK + offset;
+        KASSERT(*index < b->nbits);
+
+        b->v[*index / BITS_PER_WORD] |=
+                (WORD_TYPE)1 << (*index % BITS_PER_WORD);
+        bitmap_update(b, c);
+        b->hint = c;
+        return 0;
+}
+
+/*
+ * Set (or clear, if SET is false) the N bits starting at INDEX, which
+ * must all be the other way to begin with, and fix the summary.
+ */
+static
+void
+bitmap_setrange(struct bitmap *b, unsigned index, unsigned n, bool set)
+{
+        unsigned i, end, c;
+        WORD_TYPE mask;
+
+        KASSERT(n > 0);
+        KASSERT(index + n <= b->nbits && index + n > index);
+
+        end = index + n;
+        i = index;
+        while (i < end) {
+                if (i % BITS_PER_WORD == 0 && end - i >= BITS_PER_WORD) {
+                        KASSERT(b->v[i / BITS_PER_WORD] ==
+                                (set ? 0 : WORD_ALLBITS));
+                        b->v[i / BITS_PER_WORD] = set ? WORD_ALLBITS : 0;
+                        i += BITS_PER_WORD;
+                        continue;
+                }
+                mask = (WORD_TYPE)1 << (i % BITS_PER_WORD);
+                KASSERT(((b->v[i / BITS_PER_WORD] & mask) != 0) != set);
+                if (set) {
+                        b->v[i / BITS_PER_WORD] |= mask;
+                }
+                else {
+                        b->v[i / BITS_PER_WORD] &= ~mask;
+                }
+                i++;
+        }
+
+        for (c = index / BITS_PER_CHUNK; c <= (end - 1) / BITS_PER_CHUNK; c++) {
+                bitmap_update(b, c);
+        }
+}
+
+/*
+ * Look for N clear bits in a row in the chunks from START on. Each
+ * run of clear bits in a chunk is found with ctz32; a run that
+ * reaches the top of a chunk carries over into the next one. Full
+ * chunks are skipped using the summary.
+ */
+static
+int
+bitmap_findrange(const struct bitmap *b, unsigned start, unsigned n,
+                 unsigned *index)
+{
+        unsigned c, s, e, run, runstart, len, pos;
+        uint32_t w, clear, used;
+
+        run = 0;
+        runstart = 0;
+        c = bitmap_findchunk(b, start);
+        while (c != NOCHUNK) {
+                w = bitmap_chunk(b, c);
+                pos = 0;
+                while (pos < BITS_PER_CHUNK) {
+                        /* the next run of clear bits, [s, e) */
+                        clear = ~w & (CHUNK_ALLBITS << pos);
+                        if (clear == 0) {
+                                break;
+                        }
+                        s = ctz32(clear);
+                        used = w & (CHUNK_ALLBITS << s);
+                        e = used != 0 ? ctz32(used) : BITS_PER_CHUNK;
+
+                        if (s == 0 && run > 0) {
+                                len = run + e;
+                        }
+                        else {
+                                runstart = c*BITS_PER_CHUNK + s;
+                                len = e - s;
+                        }
+                        if (len >= n) {
+                                *index = runstart;
+                                return 0;
                         }
-                        KASSERT(0);
+                        run = e == BITS_PER_CHUNK ? len : 0;
+                        pos = e;
+                }
+                if ((w >> (BITS_PER_CHUNK - 1)) != 0) {
+                        /* top bit used; nothing carries over */
+                        run = 0;
+                }
+                if (run > 0) {
+                        /* the next chunk has to continue the run */
+                        c++;
+                        if (c >= b->nchunks) {
+                                break;
+                        }
+                }
+                else {
+                        c = bitmap_findchunk(b, c + 1);
                 }
         }
         return ENOSPC;
 }
 
+int
+bitmap_alloc_range(struct bitmap *b, unsigned n, unsigned *index)
+{
+        int result;
+
+        KASSERT(n > 0);
+        if (n == 1) {
+                return bitmap_alloc(b, index);
+        }
+
+        result = bitmap_findrange(b, b->hint, n, index);
+        if (result) {
+                result = bitmap_findrange(b, 0, n, index);
+                if (result) {
+                        return result;
+                }
+        }
+        KASSERT(*index + n <= b->nbits);
+
+        bitmap_setrange(b, *index, n, true);
+        b->hint = (*index + n - 1) / BITS_PER_CHUNK;
+        return 0;
+}
+
 static
 inline
 void
@@ -142,6 +394,7 @@ bitmap_mark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)==0);
         b->v[ix] |= mask;
+        bitmap_update(b, index / BITS_PER_CHUNK);
 }
 
 void
@@ -155,6 +408,13 @@ bitmap_unmark(struct bitmap *b, unsigned index)
 
         KASSERT((b->v[ix] & mask)!=0);
         b->v[ix] &= ~mask;
+        bitmap_update(b, index / BITS_PER_CHUNK);
+}
+
+void
+bitmap_unmark_range(struct bitmap *b, unsigned index, unsigned n)
+{
+        bitmap_setrange(b, index, n, false);
 }
 
 
@@ -171,6 +431,7 @@ bitmap_isset(struct bitmap *b, unsigned index)
 void
 bitmap_destroy(struct bitmap *b)
 {
+        kfree(b->nonfull);
         kfree(b->v);
         kfree(b);
 }
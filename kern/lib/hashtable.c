@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define HASHTABLEINLINE
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <hashtable.h>
+
+/*
+ * Bucket counts. The table doubles when there are more than two
+ * entries per bucket and halves when there are fewer than one per
+ * eight buckets, so adding and removing around a boundary doesn't
+ * resize every time.
+ */
+#define HASH_MINBUCKETS		8
+#define HASH_GROW(ht)		((ht)->ht_num > 2 * (ht)->ht_nbuckets)
+#define HASH_SHRINK(ht)		((ht)->ht_num < (ht)->ht_nbuckets / 8 && \
+				 (ht)->ht_nbuckets > HASH_MINBUCKETS)
+
+void
+hashnode_init(struct hashnode *hn, void *self)
+{
+	hn->hn_next = NULL;
+	hn->hn_hash = 0;
+	hn->hn_self = self;
+}
+
+void
+hashtable_init(struct hashtable *ht)
+{
+	ht->ht_buckets = NULL;
+	ht->ht_nbuckets = 0;
+	ht->ht_num = 0;
+}
+
+void
+hashtable_cleanup(struct hashtable *ht)
+{
+	/* As with arrays, insist on empty, to catch leaks. */
+	KASSERT(ht->ht_num == 0);
+	kfree(ht->ht_buckets);
+	ht->ht_buckets = NULL;
+	ht->ht_nbuckets = 0;
+}
+
+/*
+ * Move everything into NBUCKETS new buckets. If they can't be
+ * allocated, leave the table alone and return ENOMEM.
+ */
+static
+int
+hashtable_resize(struct hashtable *ht, unsigned nbuckets)
+{
+	struct hashnode **newbuckets, *hn, *next;
+	unsigned i, b;
+
+	KASSERT(nbuckets > 0 && (nbuckets & (nbuckets - 1)) == 0);
+
+	newbuckets = kmalloc(nbuckets * sizeof(*newbuckets));
+	if (newbuckets == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<nbuckets; i++) {
+		newbuckets[i] = NULL;
+	}
+
+	for (i=0; i<ht->ht_nbuckets; i++) {
+		for (hn = ht->ht_buckets[i]; hn != NULL; hn = next) {
+			next = hn->hn_next;
+			b = hn->hn_hash & (nbuckets - 1);
+			hn->hn_next = newbuckets[b];
+			newbuckets[b] = hn;
+		}
+	}
+
+	kfree(ht->ht_buckets);
+	ht->ht_buckets = newbuckets;
+	ht->ht_nbuckets = nbuckets;
+	return 0;
+}
+
+int
+hashtable_add(struct hashtable *ht, struct hashnode *hn, uint32_t hash)
+{
+	unsigned b;
+	int result;
+
+	if (ht->ht_nbuckets == 0) {
+		result = hashtable_resize(ht, HASH_MINBUCKETS);
+		if (result) {
+			return result;
+		}
+	}
+
+	hn->hn_hash = hash;
+	b = hash & (ht->ht_nbuckets - 1);
+	hn->hn_next = ht->ht_buckets[b];
+	ht->ht_buckets[b] = hn;
+	ht->ht_num++;
+
+	if (HASH_GROW(ht)) {
+		/* If this fails the chains just get longer. */
+		(void)hashtable_resize(ht, ht->ht_nbuckets * 2);
+	}
+	return 0;
+}
+
+void
+hashtable_remove(struct hashtable *ht, struct hashnode *hn)
+{
+	struct hashnode **pp;
+
+	KASSERT(ht->ht_num > 0);
+
+	pp = &ht->ht_buckets[hn->hn_hash & (ht->ht_nbuckets - 1)];
+	while (*pp != hn) {
+		/* If we fall off the end, HN wasn't in the table. */
+		KASSERT(*pp != NULL);
+		pp = &(*pp)->hn_next;
+	}
+	*pp = hn->hn_next;
+	hn->hn_next = NULL;
+	ht->ht_num--;
+
+	if (HASH_SHRINK(ht)) {
+		(void)hashtable_resize(ht, ht->ht_nbuckets / 2);
+	}
+}
+
+struct hashnode *
+hashtable_next(const struct hashtable *ht, struct hashnode *prev)
+{
+	unsigned b;
+
+	if (prev != NULL) {
+		if (prev->hn_next != NULL) {
+			return prev->hn_next;
+		}
+		b = (prev->hn_hash & (ht->ht_nbuckets - 1)) + 1;
+	}
+	else {
+		b = 0;
+	}
+	for (; b < ht->ht_nbuckets; b++) {
+		if (ht->ht_buckets[b] != NULL) {
+			return ht->ht_buckets[b];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * FNV-1a.
+ */
+uint32_t
+hash_string(const char *s)
+{
+	uint32_t h = 2166136261U;
+
+	while (*s != 0) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619;
+	}
+	return h;
+}
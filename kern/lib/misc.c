@@ -60,3 +60,69 @@ strerror(int errcode)
 	panic("Invalid error code %d\n", errcode);
 	return NULL;
 }
+
+/*
+ * Count trailing zeros of a nonzero word, by binary search.
+ */
+unsigned
+ctz32(uint32_t x)
+{
+	unsigned n;
+
+	KASSERT(x != 0);
+
+	n = 0;
+	if ((x & 0xffff) == 0) {
+		n += 16;
+		x >>= 16;
+	}
+	if ((x & 0xff) == 0) {
+		n += 8;
+		x >>= 8;
+	}
+	if ((x & 0xf) == 0) {
+		n += 4;
+		x >>= 4;
+	}
+	if ((x & 0x3) == 0) {
+		n += 2;
+		x >>= 2;
+	}
+	if ((x & 0x1) == 0) {
+		n += 1;
+	}
+	return n;
+}
+
+/*
+ * Count leading zeros of a nonzero word, likewise.
+ */
+unsigned
+clz32(uint32_t x)
+{
+	unsigned n;
+
+	KASSERT(x != 0);
+
+	n = 0;
+	if ((x & 0xffff0000) == 0) {
+		n += 16;
+		x <<= 16;
+	}
+	if ((x & 0xff000000) == 0) {
+		n += 8;
+		x <<= 8;
+	}
+	if ((x & 0xf0000000) == 0) {
+		n += 4;
+		x <<= 4;
+	}
+	if ((x & 0xc0000000) == 0) {
+		n += 2;
+		x <<= 2;
+	}
+	if ((x & 0x80000000) == 0) {
+		n += 1;
+	}
+	return n;
+}
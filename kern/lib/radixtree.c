@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define RADIXTREEINLINE
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <radixtree.h>
+
+/*
+ * A node. At the bottom level the slots hold the values; above that
+ * they hold child nodes. rn_count is the number of non-NULL slots, so
+ * we know when a node can go.
+ */
+struct radixnode {
+	void *rn_slots[RADIX_FANOUT];
+	unsigned rn_count;
+};
+
+/*
+ * Largest key a tree of height HEIGHT can hold.
+ */
+static
+uint32_t
+radix_maxkey(unsigned height)
+{
+	if (height * RADIX_BITS >= 32) {
+		return 0xffffffff;
+	}
+	return ((uint32_t)1 << (height * RADIX_BITS)) - 1;
+}
+
+/*
+ * Slot index for KEY at LEVEL (0 is the bottom).
+ */
+static
+inline
+unsigned
+radix_index(uint32_t key, unsigned level)
+{
+	return (key >> (level * RADIX_BITS)) & RADIX_MASK;
+}
+
+static
+struct radixnode *
+radixnode_create(void)
+{
+	struct radixnode *rn;
+	unsigned i;
+
+	rn = kmalloc(sizeof(*rn));
+	if (rn == NULL) {
+		return NULL;
+	}
+	for (i=0; i<RADIX_FANOUT; i++) {
+		rn->rn_slots[i] = NULL;
+	}
+	rn->rn_count = 0;
+	return rn;
+}
+
+void
+radixtree_init(struct radixtree *rt)
+{
+	rt->rt_root = NULL;
+	rt->rt_height = 0;
+	rt->rt_num = 0;
+}
+
+void
+radixtree_cleanup(struct radixtree *rt)
+{
+	/* Empty trees have no nodes, so there's nothing to free. */
+	KASSERT(rt->rt_num == 0);
+	KASSERT(rt->rt_root == NULL);
+}
+
+void *
+radixtree_get(const struct radixtree *rt, uint32_t key)
+{
+	struct radixnode *rn;
+	unsigned level;
+
+	if (rt->rt_height == 0 || key > radix_maxkey(rt->rt_height)) {
+		return NULL;
+	}
+	rn = rt->rt_root;
+	for (level = rt->rt_height - 1; level > 0; level--) {
+		rn = rn->rn_slots[radix_index(key, level)];
+		if (rn == NULL) {
+			return NULL;
+		}
+	}
+	return rn->rn_slots[radix_index(key, 0)];
+}
+
+/*
+ * Free the empty nodes on the path recorded in PATH (PATH[level] is
+ * the node at that level, or NULL below where the path stopped) from
+ * the bottom up, and then take levels off the top while the root only
+ * has slot 0 in use.
+ */
+static
+void
+radix_prune(struct radixtree *rt, struct radixnode **path, uint32_t key)
+{
+	struct radixnode *rn, *parent;
+	unsigned level;
+
+	for (level = 0; level < rt->rt_height; level++) {
+		rn = path[level];
+		if (rn == NULL) {
+			continue;
+		}
+		if (rn->rn_count > 0) {
+			break;
+		}
+		kfree(rn);
+		if (level + 1 == rt->rt_height) {
+			rt->rt_root = NULL;
+			rt->rt_height = 0;
+			return;
+		}
+		parent = path[level + 1];
+		parent->rn_slots[radix_index(key, level + 1)] = NULL;
+		parent->rn_count--;
+	}
+
+	while (rt->rt_height > 1 && rt->rt_root->rn_count == 1 &&
+	       rt->rt_root->rn_slots[0] != NULL) {
+		rn = rt->rt_root;
+		rt->rt_root = rn->rn_slots[0];
+		rt->rt_height--;
+		kfree(rn);
+	}
+	if (rt->rt_height == 1 && rt->rt_root->rn_count == 0) {
+		kfree(rt->rt_root);
+		rt->rt_root = NULL;
+		rt->rt_height = 0;
+	}
+}
+
+int
+radixtree_add(struct radixtree *rt, uint32_t key, void *val)
+{
+	struct radixnode *path[RADIX_MAXHEIGHT];
+	struct radixnode *rn, *child;
+	unsigned level, i;
+
+	KASSERT(val != NULL);
+
+	/* Make the tree tall enough for KEY. */
+	if (rt->rt_height == 0) {
+		rt->rt_root = radixnode_create();
+		if (rt->rt_root == NULL) {
+			return ENOMEM;
+		}
+		rt->rt_height = 1;
+	}
+	while (key > radix_maxkey(rt->rt_height)) {
+		rn = radixnode_create();
+		if (rn == NULL) {
+			/* Put it back the way it was. */
+			for (level=0; level<RADIX_MAXHEIGHT; level++) {
+				path[level] = NULL;
+			}
+			radix_prune(rt, path, 0);
+			return ENOMEM;
+		}
+		rn->rn_slots[0] = rt->rt_root;
+		rn->rn_count = 1;
+		rt->rt_root = rn;
+		rt->rt_height++;
+	}
+
+	/* Go down, making the nodes that aren't there yet. */
+	for (level=0; level<RADIX_MAXHEIGHT; level++) {
+		path[level] = NULL;
+	}
+	rn = rt->rt_root;
+	for (level = rt->rt_height - 1; level > 0; level--) {
+		path[level] = rn;
+		i = radix_index(key, level);
+		child = rn->rn_slots[i];
+		if (child == NULL) {
+			child = radixnode_create();
+			if (child == NULL) {
+				radix_prune(rt, path, key);
+				return ENOMEM;
+			}
+			rn->rn_slots[i] = child;
+			rn->rn_count++;
+		}
+		rn = child;
+	}
+	path[0] = rn;
+
+	i = radix_index(key, 0);
+	KASSERT(rn->rn_slots[i] == NULL);
+	rn->rn_slots[i] = val;
+	rn->rn_count++;
+	rt->rt_num++;
+	return 0;
+}
+
+void *
+radixtree_remove(struct radixtree *rt, uint32_t key)
+{
+	struct radixnode *path[RADIX_MAXHEIGHT];
+	struct radixnode *rn;
+	unsigned level, i;
+	void *val;
+
+	if (rt->rt_height == 0 || key > radix_maxkey(rt->rt_height)) {
+		return NULL;
+	}
+
+	for (level=0; level<RADIX_MAXHEIGHT; level++) {
+		path[level] = NULL;
+	}
+	rn = rt->rt_root;
+	for (level = rt->rt_height - 1; level > 0; level--) {
+		path[level] = rn;
+		rn = rn->rn_slots[radix_index(key, level)];
+		if (rn == NULL) {
+			return NULL;
+		}
+	}
+	path[0] = rn;
+
+	i = radix_index(key, 0);
+	val = rn->rn_slots[i];
+	if (val == NULL) {
+		return NULL;
+	}
+	rn->rn_slots[i] = NULL;
+	rn->rn_count--;
+	rt->rt_num--;
+
+	radix_prune(rt, path, key);
+	return val;
+}
+
+/*
+ * Find the smallest key >= *KEY under RN, which is at LEVEL, and
+ * return its value. *KEY is updated as we go, so it's the key found
+ * if we find one and junk if not.
+ */
+static
+void *
+radix_nextin(const struct radixnode *rn, unsigned level, uint32_t *key)
+{
+	unsigned shift = level * RADIX_BITS;
+	uint32_t below = ((uint32_t)1 << shift) - 1;
+	unsigned i;
+	void *val;
+
+	for (i = radix_index(*key, level); i < RADIX_FANOUT; i++) {
+		if (rn->rn_slots[i] != NULL) {
+			if (level == 0) {
+				return rn->rn_slots[i];
+			}
+			val = radix_nextin(rn->rn_slots[i], level - 1, key);
+			if (val != NULL) {
+				return val;
+			}
+		}
+		/* Go on to the lowest key in the next slot. */
+		*key &= ~(below | ((uint32_t)RADIX_MASK << shift));
+		*key |= (uint32_t)(i + 1) << shift;
+	}
+	return NULL;
+}
+
+void *
+radixtree_next(const struct radixtree *rt, uint32_t *key)
+{
+	uint32_t k;
+	void *val;
+
+	if (rt->rt_height == 0 || *key > radix_maxkey(rt->rt_height)) {
+		return NULL;
+	}
+	k = *key;
+	val = radix_nextin(rt->rt_root, rt->rt_height - 1, &k);
+	if (val != NULL) {
+		*key = k;
+	}
+	return val;
+}
@@ -43,16 +43,23 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 {
 	struct iovec *iov;
 	size_t size;
-	int result;
 
 	if (uio->uio_rw != UIO_READ && uio->uio_rw != UIO_WRITE) {
 		panic("uiomove: Invalid uio_rw %d\n", (int) uio->uio_rw);
 	}
-	if (uio->uio_segflg==UIO_SYSSPACE) {
+
+	switch (uio->uio_segflg) {
+	    case UIO_SYSSPACE:
 		KASSERT(uio->uio_space == NULL);
-	}
-	else {
+		break;
+	    case UIO_USERSPACE:
+	    case UIO_USERISPACE:
 		KASSERT(uio->uio_space == proc_getas());
+		/* Set up fault recovery once for all the iovecs. */
+		return copyuio(ptr, n, uio);
+	    default:
+		panic("uiomove: Invalid uio_segflg %d\n",
+		      (int)uio->uio_segflg);
 	}
 
 	while (n > 0 && uio->uio_resid > 0) {
@@ -80,33 +87,13 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 			continue;
 		}
 
-		switch (uio->uio_segflg) {
-		    case UIO_SYSSPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    memmove(iov->iov_kbase, ptr, size);
-			    }
-			    else {
-				    memmove(ptr, iov->iov_kbase, size);
-			    }
-			    iov->iov_kbase = ((char *)iov->iov_kbase+size);
-			    break;
-		    case UIO_USERSPACE:
-		    case UIO_USERISPACE:
-			    if (uio->uio_rw == UIO_READ) {
-				    result = copyout(ptr, iov->iov_ubase,size);
-			    }
-			    else {
-				    result = copyin(iov->iov_ubase, ptr, size);
-			    }
-			    if (result) {
-				    return result;
-			    }
-			    iov->iov_ubase += size;
-			    break;
-		    default:
-			    panic("uiomove: Invalid uio_segflg %d\n",
-				  (int)uio->uio_segflg);
+		if (uio->uio_rw == UIO_READ) {
+			memmove(iov->iov_kbase, ptr, size);
+		}
+		else {
+			memmove(ptr, iov->iov_kbase, size);
 		}
+		iov->iov_kbase = ((char *)iov->iov_kbase+size);
 
 		iov->iov_len -= size;
 		uio->uio_resid -= size;
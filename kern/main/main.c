@@ -109,6 +109,7 @@ boot(void)
 
 	/* Early initialization. */
 	ram_bootstrap();
+	synch_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
@@ -35,16 +35,27 @@
 #include <lib.h>
 #include <uio.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <proc.h>
 #include <vfs.h>
 #include <buf.h>
+#include <kmemcache.h>
+#include <shrinker.h>
+#include <vmstat.h>
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+
+#if !OPT_DUMBVM
+#include <coremap.h>
+#include <pagecache.h>
+#include <addrspace.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -371,6 +382,7 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_cache_printstats();
 
 	return 0;
 }
@@ -404,6 +416,27 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_profile_dump();
+	}
+	else if (nargs <= 3 && !strcmp(args[1], "on")) {
+		kheap_profile_start(nargs == 3 ? atoi(args[2]) : 0);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheap_profile_stop();
+	}
+	else {
+		kprintf("Usage: khprof [on [rate] | off]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
 static
 int
 cmd_bufstats(int nargs, char **args)
@@ -419,6 +452,100 @@ cmd_bufstats(int nargs, char **args)
 	return 0;
 }
 
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: vmstat\n");
+		return EINVAL;
+	}
+
+	coremap_printstats();
+	pagecache_printstats();
+	shrinker_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting the user stack size limit.
+ */
+static
+int
+cmd_stacklimit(int nargs, char **args)
+{
+	int pages;
+
+	if (nargs == 2) {
+		pages = atoi(args[1]);
+		if (pages < VM_STACKMINPAGES ||
+		    (size_t)pages > USERSTACK / PAGE_SIZE / 2) {
+			kprintf("stack: limit must be from %u to %u pages\n",
+				VM_STACKMINPAGES,
+				USERSTACK / PAGE_SIZE / 2);
+			return EINVAL;
+		}
+		as_stacklimit = pages;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: stack [pages]\n");
+		return EINVAL;
+	}
+
+	kprintf("User stack limit: %u pages (%uK)\n",
+		as_stacklimit, as_stacklimit * PAGE_SIZE / 1024);
+	return 0;
+}
+#endif
+
+static
+int
+cmd_tlbstats(int nargs, char **args)
+{
+	struct cpu *c;
+	unsigned i, misses, evictions;
+
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: tlb\n");
+		return EINVAL;
+	}
+
+	misses = evictions = 0;
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		kprintf("cpu%u: %u TLB misses, %u evictions\n", c->c_number,
+			c->c_vmstats.vs_count[VMS_TLBMISSES],
+			c->c_vmstats.vs_count[VMS_TLBEVICTIONS]);
+		misses += c->c_vmstats.vs_count[VMS_TLBMISSES];
+		evictions += c->c_vmstats.vs_count[VMS_TLBEVICTIONS];
+	}
+	kprintf("total: %u TLB misses, %u evictions\n", misses, evictions);
+
+	return 0;
+}
+
+/*
+ * Command for printing the VM event counters: the totals, and those
+ * of the last process to exit.
+ */
+static
+int
+cmd_vmcounts(int nargs, char **args)
+{
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: vmc\n");
+		return EINVAL;
+	}
+
+	vmstat_printall();
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -458,6 +585,9 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+#if !OPT_DUMBVM
+	"[stack]   Set user stack limit      ",
+#endif
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -478,15 +608,26 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[btb] Bitmap benchmark              ",
 	"[tlt] Threadlist test               ",
+	"[ht]  Hash table test               ",
+	"[htb] Hash table benchmark          ",
+	"[rt]  Radix tree test               ",
+	"[rtb] Radix tree benchmark          ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[kmb] kmalloc scaling benchmark     ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
 	"[tt4] Thread join test		     ",
+	"[tlbt] TLB shootdown test           ",
+	"[aff] CPU affinity test             ",
+	"[tmt] Timer test                    ",
+	"[mmt] mmap test                     ",
+	"[cpb] Copy bandwidth benchmark      ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -525,7 +666,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] kmalloc sampling profiler  ",
 	"[buf] Print buffer cache stats      ",
+	"[tlb] Print TLB refill stats        ",
+	"[vmc] Print VM event counters       ",
+#if !OPT_DUMBVM
+	"[vmstat] Print VM stats             ",
+#endif
 #if OPT_SYNCHPROBS
     "[sp1] Elves                         ",
     "[sp2] Air Balloon                   ",
@@ -570,6 +717,9 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+#if !OPT_DUMBVM
+	{ "stack",	cmd_stacklimit },
+#endif
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -579,17 +729,29 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
 	{ "buf",        cmd_bufstats },
+	{ "tlb",        cmd_tlbstats },
+	{ "vmc",        cmd_vmcounts },
+#if !OPT_DUMBVM
+	{ "vmstat",     cmd_vmstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "btb",	bitmapbench },
 	{ "tlt",	threadlisttest },
+	{ "ht",		hashtabletest },
+	{ "htb",	hashtablebench },
+	{ "rt",		radixtreetest },
+	{ "rtb",	radixtreebench },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "kmb",	kmallocbench },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -597,6 +759,11 @@ static struct {
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
 	{ "tt4",	threadjointest },
+	{ "tlbt",	tlbshootdowntest },
+	{ "aff",	affinitytest },
+	{ "tmt",	callouttest },
+	{ "mmt",	mmaptest },
+	{ "cpb",	copybench },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
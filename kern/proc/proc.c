@@ -238,6 +238,13 @@ proc__exit(int status)
         proc_remthread(curthread);
         proc_addthread(kproc, curthread);
 
+#if !OPT_DUMBVM
+        /* Keep its VM counters for the vmc menu command. */
+        if (proc->p_addrspace != NULL) {
+                vmstat_exited(proc->p_name, &proc->p_addrspace->as_stats);
+        }
+#endif
+
         /* Now we can destroy the process. */
         proc_destroy(proc);
 
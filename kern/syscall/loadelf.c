@@ -42,8 +42,11 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * Without dumbvm, segments are not loaded here at all: each one is
+ * defined as a region backed by the executable, and vm_fault reads
+ * its pages in as they are touched. In that case only the headers
+ * are read and checked, and as_prepare_load and as_complete_load are
+ * not called.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -59,6 +62,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include <kern/stat.h>
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -74,6 +78,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if OPT_DUMBVM
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -144,6 +149,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -159,9 +165,20 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	struct iovec iov;
 	struct uio ku;
 	struct addrspace *as;
+#if !OPT_DUMBVM
+	struct stat st;
+#endif
 
 	as = proc_getas();
 
+#if !OPT_DUMBVM
+	/* Segments are read later, so check now that they're all there. */
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+#endif
+
 	/*
 	 * Read the executable header from offset 0 in the file.
 	 */
@@ -243,16 +260,41 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_DUMBVM
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
 					  ph.p_flags & PF_W,
 					  ph.p_flags & PF_X);
+#else
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > "
+				"segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+		if ((off_t)ph.p_offset + ph.p_filesz > st.st_size) {
+			kprintf("ELF: segment past end of file - "
+				"file truncated?\n");
+			return ENOEXEC;
+		}
+
+		DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+		      (unsigned long) ph.p_filesz,
+		      (unsigned long) ph.p_vaddr);
+
+		result = as_define_fileregion(as,
+					      ph.p_vaddr, ph.p_memsz,
+					      v, ph.p_offset, ph.p_filesz,
+					      ph.p_flags & PF_R,
+					      ph.p_flags & PF_W,
+					      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
 	}
 
+#if OPT_DUMBVM
 	result = as_prepare_load(as);
 	if (result) {
 		return result;
@@ -300,6 +342,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	if (result) {
 		return result;
 	}
+#endif
 
 	*entrypoint = eh.e_entry;
 
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vmstat.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include "opt-dumbvm.h"
+
+/*
+ * getrusage: report resource usage.
+ *
+ * Only the VM and scheduler counters are kept, so that's all that is
+ * filled in; everything else reads as zero. There are no child processes, so
+ * RUSAGE_CHILDREN reports nothing at all.
+ */
+int
+sys_getrusage(int who, userptr_t user_usage)
+{
+	struct rusage ru;
+#if !OPT_DUMBVM
+	struct addrspace *as;
+	const unsigned *c;
+#endif
+
+	if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN) {
+		return EINVAL;
+	}
+
+	bzero(&ru, sizeof(ru));
+
+#if !OPT_DUMBVM
+	as = proc_getas();
+	if (who == RUSAGE_SELF && as != NULL) {
+		c = as->as_stats.vs_count;
+
+		ru.ru_majflt = c[VMS_FILEINS] + c[VMS_SWAPINS];
+		ru.ru_minflt = c[VMS_FAULTS] - ru.ru_majflt;
+		ru.ru_readflt = c[VMS_READFAULTS];
+		ru.ru_writeflt = c[VMS_WRITEFAULTS] + c[VMS_ROFAULTS];
+		ru.ru_tlbmiss = c[VMS_TLBMISSES];
+		ru.ru_tlbevict = c[VMS_TLBEVICTIONS];
+		ru.ru_zerofill = c[VMS_ZEROFILLS];
+		ru.ru_cowbreak = c[VMS_COWCOPIES] + c[VMS_COWCLAIMS];
+		ru.ru_pagein = ru.ru_majflt;
+		ru.ru_pageout = c[VMS_PAGEOUTS];
+	}
+#endif
+
+	if (who == RUSAGE_SELF) {
+		ru.ru_migrations = curthread->t_migrations;
+		ru.ru_xcpuwakeups = curthread->t_xcpuwakeups;
+	}
+
+	return copyout(&ru, user_usage, sizeof(ru));
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,41 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * nanosleep: sleep for the time in *REQ. Nothing can interrupt the
+ * sleep, so the time remaining stored in *REM (if given) is always
+ * zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	uint64_t nsecs;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	/* Don't overflow; this is still a few centuries */
+	if (ts.tv_sec > 0xffffffff) {
+		ts.tv_sec = 0xffffffff;
+	}
+	nsecs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	thread_sleep_ns(nsecs);
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
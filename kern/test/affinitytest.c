@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * CPU affinity test.
+ *
+ * Passes a token around a ring of threads, two per cpu, so that
+ * nearly every wakeup is posted from another cpu. First each thread
+ * is pinned to one cpu, by inheriting the mask the test sets on
+ * itself before forking it, and checks that it's always woken there;
+ * then the ring runs again unpinned, to show how much the wakeup
+ * placement moves threads around when it's free to.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define AFF_ROUNDS	500
+#define AFF_MAXTHREADS	64
+
+static struct semaphore *aff_token[AFF_MAXTHREADS];
+static struct semaphore *aff_done;
+static unsigned aff_nthreads;
+static bool aff_pinned;
+
+/* Results, filled in by each thread before it exits. */
+static unsigned aff_strays[AFF_MAXTHREADS];
+static unsigned aff_migrations[AFF_MAXTHREADS];
+static unsigned aff_xcpuwakeups[AFF_MAXTHREADS];
+
+static
+void
+aff_thread(void *junk, unsigned long num)
+{
+	unsigned mycpu, i;
+
+	(void)junk;
+
+	mycpu = num % cpu_count();
+	if (aff_pinned) {
+		KASSERT(thread_getaffinity() == 1U << mycpu);
+	}
+
+	aff_strays[num] = 0;
+	for (i=0; i<AFF_ROUNDS; i++) {
+		P(aff_token[num]);
+		if (aff_pinned && curcpu->c_number != mycpu) {
+			aff_strays[num]++;
+		}
+		V(aff_token[(num + 1) % aff_nthreads]);
+	}
+
+	aff_migrations[num] = curthread->t_migrations;
+	aff_xcpuwakeups[num] = curthread->t_xcpuwakeups;
+	V(aff_done);
+}
+
+/*
+ * Run the ring once and print the totals. Returns the number of
+ * wakeups that landed on a cpu outside the thread's mask.
+ */
+static
+unsigned
+aff_run(bool pinned)
+{
+	unsigned i, strays, migrations, xcpuwakeups, saved;
+	int result;
+
+	aff_pinned = pinned;
+	saved = thread_getaffinity();
+	for (i=0; i<aff_nthreads; i++) {
+		if (pinned) {
+			result = thread_setaffinity(1U << (i % cpu_count()));
+			if (result) {
+				panic("affinitytest: thread_setaffinity: "
+				      "%s\n", strerror(result));
+			}
+		}
+		result = thread_fork("affinitytest", NULL, aff_thread,
+				     NULL, i);
+		if (result) {
+			panic("affinitytest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_setaffinity(saved);
+	KASSERT(result == 0);
+	V(aff_token[0]);
+	for (i=0; i<aff_nthreads; i++) {
+		P(aff_done);
+	}
+	/* The last pass leaves the token with thread 0; take it back */
+	P(aff_token[0]);
+
+	strays = migrations = xcpuwakeups = 0;
+	for (i=0; i<aff_nthreads; i++) {
+		strays += aff_strays[i];
+		migrations += aff_migrations[i];
+		xcpuwakeups += aff_xcpuwakeups[i];
+	}
+	kprintf("  %-8s %u wakeups: %u migrations, %u cross-cpu, "
+		"%u on the wrong cpu\n", pinned ? "pinned:" : "free:",
+		aff_nthreads * AFF_ROUNDS, migrations, xcpuwakeups, strays);
+	return strays;
+}
+
+int
+affinitytest(int nargs, char **args)
+{
+	unsigned ncpus, i, strays;
+	unsigned saved;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting affinity test...\n");
+
+	ncpus = cpu_count();
+	saved = thread_getaffinity();
+	if (thread_setaffinity(0) != EINVAL) {
+		panic("affinitytest: empty mask accepted\n");
+	}
+	if (ncpus < 32 && thread_setaffinity(1U << ncpus) != EINVAL) {
+		panic("affinitytest: mask of nonexistent cpu accepted\n");
+	}
+	KASSERT(thread_getaffinity() == saved);
+
+	aff_nthreads = 2 * ncpus;
+	if (aff_nthreads > AFF_MAXTHREADS) {
+		aff_nthreads = AFF_MAXTHREADS;
+	}
+	for (i=0; i<aff_nthreads; i++) {
+		aff_token[i] = sem_create("affinitytest", 0);
+		if (aff_token[i] == NULL) {
+			panic("affinitytest: sem_create failed\n");
+		}
+	}
+	aff_done = sem_create("affinitytest done", 0);
+	if (aff_done == NULL) {
+		panic("affinitytest: sem_create failed\n");
+	}
+
+	kprintf("%u threads on %u cpus, %u rounds:\n", aff_nthreads, ncpus,
+		AFF_ROUNDS);
+	strays = aff_run(true);
+	aff_run(false);
+
+	for (i=0; i<aff_nthreads; i++) {
+		sem_destroy(aff_token[i]);
+	}
+	sem_destroy(aff_done);
+
+	if (strays > 0) {
+		kprintf("affinitytest: FAILED\n");
+		return 1;
+	}
+	kprintf("Affinity test done\n");
+	return 0;
+}
@@ -28,11 +28,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <bitmap.h>
 #include <test.h>
 
 #define TESTSIZE 533
+#define RANGESIZE 7
+
+#define BENCHBITS 65536
+#define BENCHROUNDS 16
 
 int
 bitmaptest(int nargs, char **args)
@@ -101,6 +107,117 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Ranges: free some runs and get them back. */
+	for (i=0; i+RANGESIZE<=TESTSIZE; i+=3*RANGESIZE) {
+		bitmap_unmark_range(b, i, RANGESIZE);
+		data[i] = 1;
+	}
+	KASSERT(bitmap_alloc_range(b, RANGESIZE+1, &x) == ENOSPC);
+	while (bitmap_alloc_range(b, RANGESIZE, &x)==0) {
+		KASSERT(x + RANGESIZE <= TESTSIZE);
+		KASSERT(data[x]==1);
+		data[x] = 0;
+		for (i=0; i<RANGESIZE; i++) {
+			KASSERT(bitmap_isset(b, x+i));
+		}
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(bitmap_isset(b, i));
+		KASSERT(data[i]==0);
+	}
+
+	bitmap_destroy(b);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
+
+/*
+ * Print the rate of N operations between BEFORE and AFTER.
+ */
+static
+void
+bitmapbench_report(const char *what, unsigned n,
+		   const struct timespec *before,
+		   const struct timespec *after)
+{
+	uint64_t nsecs;
+
+	nsecs = bench_nsecs(before, after);
+	kprintf("  %-24s %10lu ops/sec\n", what,
+		(unsigned long)((uint64_t)n * 1000000000 / nsecs));
+}
+
+/*
+ * Allocation throughput: fill an empty bitmap; then, with it full,
+ * repeatedly free a scattered handful of bits and allocate them back,
+ * which is the case that used to rescan from the front every time;
+ * then the same with runs.
+ */
+int
+bitmapbench(int nargs, char **args)
+{
+	struct bitmap *b;
+	struct timespec before, after;
+	unsigned nbits, i, j, x, n;
+
+	if (nargs > 2) {
+		kprintf("Usage: btb [bits]\n");
+		return EINVAL;
+	}
+	nbits = nargs == 2 ? (unsigned)atoi(args[1]) : BENCHBITS;
+	if (nbits < 1024) {
+		nbits = 1024;
+	}
+
+	b = bitmap_create(nbits);
+	if (b == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("bitmap benchmark (%u bits):\n", nbits);
+
+	gettime(&before);
+	for (i=0; i<nbits; i++) {
+		if (bitmap_alloc(b, &x)) {
+			panic("bitmapbench: bitmap filled up early\n");
+		}
+	}
+	gettime(&after);
+	bitmapbench_report("fill", nbits, &before, &after);
+
+	n = 0;
+	gettime(&before);
+	for (j=0; j<BENCHROUNDS; j++) {
+		for (i=0; i<nbits/64; i++) {
+			bitmap_unmark(b, random() % nbits);
+			if (bitmap_alloc(b, &x)) {
+				panic("bitmapbench: no free bit\n");
+			}
+			n++;
+		}
+	}
+	gettime(&after);
+	bitmapbench_report("free+alloc, full", n, &before, &after);
+
+	for (i=0; i<nbits; i+=64) {
+		bitmap_unmark_range(b, i, 32);
+	}
+	n = 0;
+	gettime(&before);
+	for (j=0; j<BENCHROUNDS; j++) {
+		for (i=0; i<nbits/64; i++) {
+			if (bitmap_alloc_range(b, 8, &x)) {
+				panic("bitmapbench: no free range\n");
+			}
+			bitmap_unmark_range(b, x, 8);
+			n++;
+		}
+	}
+	gettime(&after);
+	bitmapbench_report("alloc_range(8)+free", n, &before, &after);
+
+	bitmap_destroy(b);
+	kprintf("bitmap benchmark done\n");
+	return 0;
+}
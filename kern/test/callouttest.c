@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timer test.
+ *
+ * Checks that callouts run when they should and not after being
+ * cancelled, that thread_sleep_ns, cv_timedwait and sem_timed_P wait
+ * as long as asked (and not much longer), that the timed waits
+ * return early when woken, and that lots of threads can sleep at
+ * once.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <callout.h>
+#include <test.h>
+
+#define MSEC		1000000ULL	/* nanoseconds */
+#define TICK		(1000000000ULL / HZ)
+
+/* Allowed lateness: the rounding up plus a little scheduling delay */
+#define SLOP		(2 * TICK + 5 * MSEC)
+
+#define CT_THREADS	16
+#define CT_SLEEPS	20
+
+static struct semaphore *ct_sem;
+static struct lock *ct_lock;
+static struct cv *ct_cv;
+static volatile unsigned ct_fired;
+
+static
+uint64_t
+ct_elapsed(const struct timespec *before)
+{
+	struct timespec after;
+
+	gettime(&after);
+	return bench_nsecs(before, &after);
+}
+
+/*
+ * Fail unless ELAPSED is at least WANTED and no more than SLOP over.
+ */
+static
+void
+ct_check(const char *what, uint64_t wanted, uint64_t elapsed)
+{
+	kprintf("  %-14s %4lu ms: took %lu us\n", what,
+		(unsigned long)(wanted / MSEC),
+		(unsigned long)(elapsed / 1000));
+	if (elapsed < wanted) {
+		panic("callouttest: %s returned early\n", what);
+	}
+	if (elapsed > wanted + SLOP) {
+		panic("callouttest: %s overslept\n", what);
+	}
+}
+
+static
+void
+ct_callout(void *data)
+{
+	(void)data;
+	ct_fired++;
+	V(ct_sem);
+}
+
+static
+void
+ct_callouts(void)
+{
+	struct callout c1, c2;
+	struct timespec before;
+
+	kprintf("Callouts...\n");
+	ct_fired = 0;
+	callout_init(&c1, ct_callout, NULL);
+	callout_init(&c2, ct_callout, NULL);
+
+	gettime(&before);
+	callout_schedule(&c1, 5);
+	callout_schedule(&c2, 5);
+	KASSERT(callout_pending(&c2));
+	if (!callout_cancel(&c2)) {
+		panic("callouttest: cancelling a pending callout failed\n");
+	}
+	KASSERT(!callout_pending(&c2));
+	P(ct_sem);
+	ct_check("callout", 4 * TICK, ct_elapsed(&before));
+
+	/* Give c2 time to go off if it's going to */
+	thread_sleep_ns(10 * TICK);
+	if (ct_fired != 1) {
+		panic("callouttest: cancelled callout ran\n");
+	}
+	if (callout_cancel(&c1)) {
+		panic("callouttest: callout still pending after running\n");
+	}
+
+	/* Rescheduling a pending callout moves it */
+	gettime(&before);
+	callout_schedule(&c1, 100);
+	callout_schedule(&c1, 3);
+	P(ct_sem);
+	ct_check("rescheduled", 2 * TICK, ct_elapsed(&before));
+	thread_sleep_ns(10 * TICK);
+	KASSERT(ct_fired == 2);
+}
+
+static
+void
+ct_sleeps(void)
+{
+	static const unsigned msecs[] = { 1, 10, 50, 100, 250 };
+	struct timespec before;
+	unsigned i;
+
+	kprintf("thread_sleep_ns...\n");
+	for (i=0; i<sizeof(msecs)/sizeof(msecs[0]); i++) {
+		gettime(&before);
+		thread_sleep_ns(msecs[i] * MSEC);
+		ct_check("sleep", msecs[i] * MSEC, ct_elapsed(&before));
+	}
+}
+
+/* Wake the test thread up DATA2 milliseconds from now. */
+static
+void
+ct_waker(void *data1, unsigned long msecs)
+{
+	(void)data1;
+
+	thread_sleep_ns(msecs * MSEC);
+	lock_acquire(ct_lock);
+	cv_signal(ct_cv, ct_lock);
+	lock_release(ct_lock);
+	V(ct_sem);
+}
+
+static
+void
+ct_fork_waker(unsigned long msecs)
+{
+	int result;
+
+	result = thread_fork("callouttest", NULL, ct_waker, NULL, msecs);
+	if (result) {
+		panic("callouttest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+static
+void
+ct_timedwaits(void)
+{
+	struct semaphore *sem;
+	struct timespec before;
+	uint64_t elapsed;
+	int result;
+
+	kprintf("cv_timedwait...\n");
+	lock_acquire(ct_lock);
+	gettime(&before);
+	result = cv_timedwait(ct_cv, ct_lock, 50 * MSEC);
+	if (result != ETIMEDOUT) {
+		panic("callouttest: cv_timedwait didn't time out\n");
+	}
+	ct_check("timeout", 50 * MSEC, ct_elapsed(&before));
+
+	ct_fork_waker(20);
+	gettime(&before);
+	result = cv_timedwait(ct_cv, ct_lock, 1000 * MSEC);
+	elapsed = ct_elapsed(&before);
+	lock_release(ct_lock);
+	if (result != 0) {
+		panic("callouttest: cv_timedwait timed out when signalled\n");
+	}
+	ct_check("signalled", 20 * MSEC, elapsed);
+	P(ct_sem);
+
+	kprintf("sem_timed_P...\n");
+	sem = sem_create("callouttest", 0);
+	if (sem == NULL) {
+		panic("callouttest: sem_create failed\n");
+	}
+	if (sem_timed_P(sem, 0) != ETIMEDOUT) {
+		panic("callouttest: sem_timed_P(0) succeeded on 0\n");
+	}
+	gettime(&before);
+	if (sem_timed_P(sem, 30 * MSEC) != ETIMEDOUT) {
+		panic("callouttest: sem_timed_P didn't time out\n");
+	}
+	ct_check("timeout", 30 * MSEC, ct_elapsed(&before));
+	V(sem);
+	if (sem_timed_P(sem, 0) != 0) {
+		panic("callouttest: sem_timed_P(0) failed on 1\n");
+	}
+
+	/* ct_waker's V of ct_sem is what we're waiting for here */
+	ct_fork_waker(20);
+	gettime(&before);
+	if (sem_timed_P(ct_sem, 1000 * MSEC) != 0) {
+		panic("callouttest: sem_timed_P timed out when V'd\n");
+	}
+	ct_check("V'd", 20 * MSEC, ct_elapsed(&before));
+	sem_destroy(sem);
+}
+
+static
+void
+ct_sleeper(void *data1, unsigned long num)
+{
+	unsigned i;
+
+	(void)data1;
+
+	for (i=0; i<CT_SLEEPS; i++) {
+		thread_sleep_ns(((num * 7 + i * 13) % 30) * MSEC);
+	}
+	V(ct_sem);
+}
+
+static
+void
+ct_many(void)
+{
+	struct timespec before;
+	unsigned i;
+	int result;
+
+	kprintf("%u threads x %u sleeps...\n", CT_THREADS, CT_SLEEPS);
+	gettime(&before);
+	for (i=0; i<CT_THREADS; i++) {
+		result = thread_fork("callouttest", NULL, ct_sleeper,
+				     NULL, i);
+		if (result) {
+			panic("callouttest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<CT_THREADS; i++) {
+		P(ct_sem);
+	}
+	kprintf("  done in %lu ms\n",
+		(unsigned long)(ct_elapsed(&before) / MSEC));
+}
+
+int
+callouttest(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timer test...\n");
+
+	ct_sem = sem_create("callouttest", 0);
+	ct_lock = lock_create("callouttest");
+	ct_cv = cv_create("callouttest");
+	if (ct_sem == NULL || ct_lock == NULL || ct_cv == NULL) {
+		panic("callouttest: out of memory\n");
+	}
+
+	ct_callouts();
+	ct_sleeps();
+	ct_timedwaits();
+	ct_many();
+
+	cv_destroy(ct_cv);
+	lock_destroy(ct_lock);
+	sem_destroy(ct_sem);
+
+	kprintf("Timer test done\n");
+	return 0;
+}
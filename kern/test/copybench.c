@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Copy bandwidth benchmark.
+ *
+ * Measures copyin, copyout, copyinstr, and uiomove to and from user
+ * space, at a few sizes, with the user buffer word-aligned and not,
+ * against memcpy within the kernel for reference. It runs in a
+ * scratch process with one read-write region, and checks that the
+ * copies come out right (and that bad addresses fail) before timing
+ * anything.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <test.h>
+
+#define CPB_BASE	0x10000000		/* user region */
+#define CPB_SIZE	(64*1024)		/* its size */
+#define CPB_TOTAL	(4*1024*1024)		/* bytes moved per test */
+#define CPB_NIOV	16			/* iovecs for uiomove */
+#define CPB_STRLEN	200			/* string for copyinstr */
+
+struct cpb_args {
+	struct semaphore *done;
+	int result;
+};
+
+/*
+ * Print the bandwidth for moving BYTES between BEFORE and AFTER.
+ */
+static
+void
+cpb_report(const char *what, size_t size, unsigned align, uint64_t bytes,
+	   const struct timespec *before, const struct timespec *after)
+{
+	uint64_t nsecs;
+
+	nsecs = bench_nsecs(before, after);
+	kprintf("  %-10s %6u bytes +%u: %8lu KB/s\n", what, (unsigned)size,
+		align, (unsigned long)(bytes * 1000000000 / nsecs / 1024));
+}
+
+/*
+ * Make sure copies of every alignment and a few awkward lengths come
+ * back the way they went out, and that the error cases fail.
+ */
+static
+int
+cpb_check(char *kbuf, char *kbuf2)
+{
+	static const size_t lens[] = { 1, 3, 7, 8, 33, 1000, 4096 + 5 };
+	struct iovec iov[CPB_NIOV];
+	struct uio u;
+	userptr_t ubase = (userptr_t)CPB_BASE;
+	unsigned uoff, koff, k2, i, j;
+	size_t len, got;
+	int result;
+
+	for (i=0; i<CPB_SIZE; i++) {
+		kbuf[i] = (char)(i * 7 + 1);
+	}
+
+	for (uoff=0; uoff<sizeof(long); uoff++) {
+		for (koff=0; koff<sizeof(long); koff++) {
+			for (j=0; j<sizeof(lens)/sizeof(lens[0]); j++) {
+				len = lens[j];
+				result = copyout(kbuf + koff, ubase + uoff, len);
+				if (result) {
+					kprintf("copybench: copyout: %s\n",
+						strerror(result));
+					return result;
+				}
+				/* ...and back in at yet another alignment */
+				k2 = (uoff + koff) % sizeof(long);
+				bzero(kbuf2, len + 2*sizeof(long));
+				result = copyin(ubase + uoff, kbuf2 + k2, len);
+				if (result) {
+					kprintf("copybench: copyin: %s\n",
+						strerror(result));
+					return result;
+				}
+				for (i=0; i<len; i++) {
+					if (kbuf2[k2 + i] != kbuf[koff + i]) {
+						kprintf("copybench: %u bytes "
+							"+%u/+%u: mismatch "
+							"at %u\n", (unsigned)len,
+							uoff, koff, i);
+						return EINVAL;
+					}
+				}
+				if (kbuf2[k2 + len] != 0) {
+					kprintf("copybench: copyin overran\n");
+					return EINVAL;
+				}
+			}
+		}
+	}
+
+	/* Strings: every alignment, too long, and just fitting. */
+	for (i=0; i<CPB_STRLEN; i++) {
+		kbuf[i] = 'a' + i % 26;
+	}
+	kbuf[CPB_STRLEN] = 0;
+	for (uoff=0; uoff<sizeof(long); uoff++) {
+		result = copyoutstr(kbuf, ubase + uoff, CPB_STRLEN + 1, &got);
+		if (result || got != CPB_STRLEN + 1) {
+			kprintf("copybench: copyoutstr failed\n");
+			return result ? result : EINVAL;
+		}
+		result = copyinstr(ubase + uoff, kbuf2, CPB_STRLEN + 1, &got);
+		if (result || got != CPB_STRLEN + 1 ||
+		    strcmp(kbuf, kbuf2) != 0) {
+			kprintf("copybench: copyinstr +%u failed\n", uoff);
+			return result ? result : EINVAL;
+		}
+		result = copyinstr(ubase + uoff, kbuf2, CPB_STRLEN, &got);
+		if (result != ENAMETOOLONG) {
+			kprintf("copybench: long copyinstr didn't fail\n");
+			return EINVAL;
+		}
+	}
+
+	/* Faults. */
+	if (copyin(ubase + CPB_SIZE - 4, kbuf2, 8) != EFAULT ||
+	    copyout(kbuf, ubase + CPB_SIZE + PAGE_SIZE, 1) != EFAULT ||
+	    copyin((const_userptr_t)(USERSPACETOP - 4), kbuf2, 8) != EFAULT) {
+		kprintf("copybench: bad address didn't fault\n");
+		return EINVAL;
+	}
+
+	/* uiomove over several iovecs, one of them empty. */
+	for (i=0; i<CPB_NIOV; i++) {
+		iov[i].iov_ubase = ubase + i * 1000;
+		iov[i].iov_len = i == 3 ? 0 : 1000;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = CPB_NIOV;
+	u.uio_offset = 0;
+	u.uio_resid = (CPB_NIOV - 1) * 1000;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = UIO_WRITE;
+	u.uio_space = proc_getas();
+	bzero(kbuf, CPB_SIZE);
+	result = copyout(kbuf2, ubase, CPB_NIOV * 1000);
+	if (result == 0) {
+		result = uiomove(kbuf, (CPB_NIOV - 1) * 1000, &u);
+	}
+	if (result || u.uio_resid != 0) {
+		kprintf("copybench: uiomove failed\n");
+		return result ? result : EINVAL;
+	}
+	for (i=0; i<(CPB_NIOV - 1) * 1000; i++) {
+		/* iovec 3 was empty, so everything after it is shifted */
+		j = i < 3000 ? i : i + 1000;
+		if (kbuf[i] != kbuf2[j]) {
+			kprintf("copybench: uiomove mismatch at %u\n", i);
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Time each kind of copy.
+ */
+static
+void
+cpb_bench(char *kbuf, char *kbuf2)
+{
+	static const size_t sizes[] = { 64, 512, 4096, CPB_SIZE / 2 };
+	struct iovec iov[CPB_NIOV];
+	struct uio u;
+	struct timespec before, after;
+	userptr_t ubase = (userptr_t)CPB_BASE;
+	unsigned i, j, n, align;
+	size_t size, got;
+
+	for (j=0; j<sizeof(sizes)/sizeof(sizes[0]); j++) {
+		size = sizes[j];
+		n = CPB_TOTAL / size;
+		for (align=0; align<2; align++) {
+			gettime(&before);
+			for (i=0; i<n; i++) {
+				memcpy(kbuf2 + align, kbuf, size);
+			}
+			gettime(&after);
+			cpb_report("memcpy", size, align, (uint64_t)n * size,
+				   &before, &after);
+
+			gettime(&before);
+			for (i=0; i<n; i++) {
+				copyout(kbuf, ubase + align, size);
+			}
+			gettime(&after);
+			cpb_report("copyout", size, align, (uint64_t)n * size,
+				   &before, &after);
+
+			gettime(&before);
+			for (i=0; i<n; i++) {
+				copyin(ubase + align, kbuf, size);
+			}
+			gettime(&after);
+			cpb_report("copyin", size, align, (uint64_t)n * size,
+				   &before, &after);
+		}
+	}
+
+	for (i=0; i<CPB_STRLEN; i++) {
+		kbuf[i] = 'a' + i % 26;
+	}
+	kbuf[CPB_STRLEN] = 0;
+	copyoutstr(kbuf, ubase, CPB_STRLEN + 1, &got);
+	n = CPB_TOTAL / (CPB_STRLEN + 1);
+	gettime(&before);
+	for (i=0; i<n; i++) {
+		copyinstr(ubase, kbuf2, CPB_STRLEN + 1, &got);
+	}
+	gettime(&after);
+	cpb_report("copyinstr", CPB_STRLEN + 1, 0,
+		   (uint64_t)n * (CPB_STRLEN + 1), &before, &after);
+
+	size = CPB_SIZE / CPB_NIOV;
+	n = CPB_TOTAL / CPB_SIZE;
+	gettime(&before);
+	for (i=0; i<n; i++) {
+		for (j=0; j<CPB_NIOV; j++) {
+			iov[j].iov_ubase = ubase + j * size;
+			iov[j].iov_len = size;
+		}
+		u.uio_iov = iov;
+		u.uio_iovcnt = CPB_NIOV;
+		u.uio_offset = 0;
+		u.uio_resid = CPB_SIZE;
+		u.uio_segflg = UIO_USERSPACE;
+		u.uio_rw = UIO_READ;
+		u.uio_space = proc_getas();
+		uiomove(kbuf, CPB_SIZE, &u);
+	}
+	gettime(&after);
+	cpb_report("uiomove", CPB_SIZE, 0, (uint64_t)n * CPB_SIZE,
+		   &before, &after);
+}
+
+/*
+ * Runs in a scratch process so it has an address space of its own.
+ */
+static
+void
+cpb_thread(void *p, unsigned long junk)
+{
+	struct cpb_args *args = p;
+	struct addrspace *as;
+	char *kbuf, *kbuf2;
+	int result;
+
+	(void)junk;
+
+	kbuf = kmalloc(CPB_SIZE);
+	kbuf2 = kmalloc(CPB_SIZE + 2*sizeof(long));
+	as = as_create();
+	if (kbuf == NULL || kbuf2 == NULL || as == NULL) {
+		result = ENOMEM;
+		goto out;
+	}
+
+	result = as_define_region(as, CPB_BASE, CPB_SIZE, 1, 1, 0);
+	if (result == 0) {
+		result = as_prepare_load(as);
+	}
+	if (result == 0) {
+		result = as_complete_load(as);
+	}
+	if (result) {
+		goto out;
+	}
+
+	proc_setas(as);
+	as_activate();
+
+	result = cpb_check(kbuf, kbuf2);
+	if (result == 0) {
+		cpb_bench(kbuf, kbuf2);
+	}
+
+	as_deactivate();
+	as = proc_setas(NULL);
+
+ out:
+	if (as != NULL) {
+		as_destroy(as);
+	}
+	kfree(kbuf);
+	kfree(kbuf2);
+	args->result = result;
+
+	/* Leave the process so it can be destroyed. */
+	proc_remthread(curthread);
+	proc_addthread(kproc, curthread);
+	V(args->done);
+}
+
+int
+copybench(int nargs, char **args)
+{
+	struct cpb_args targs;
+	struct proc *proc;
+	int result;
+
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: cpb\n");
+		return EINVAL;
+	}
+
+	targs.done = sem_create("copybench", 0);
+	if (targs.done == NULL) {
+		panic("copybench: sem_create failed\n");
+	}
+	proc = proc_create_runprogram("copybench");
+	if (proc == NULL) {
+		sem_destroy(targs.done);
+		return ENOMEM;
+	}
+
+	kprintf("Copy bandwidth benchmark (%u KB per test):\n",
+		CPB_TOTAL / 1024);
+	result = thread_fork("copybench", proc, cpb_thread, &targs, 0);
+	if (result) {
+		panic("copybench: thread_fork failed: %s\n", strerror(result));
+	}
+	P(targs.done);
+	sem_destroy(targs.done);
+	proc_destroy(proc);
+
+	if (targs.result) {
+		kprintf("copybench: FAILED: %s\n", strerror(targs.result));
+		return targs.result;
+	}
+	kprintf("Copy bandwidth benchmark done\n");
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <array.h>
+#include <hashtable.h>
+#include <test.h>
+
+#define TESTSIZE 1000
+#define BENCHSIZES 4
+#define BENCHLOOKUPS 100000
+
+struct htobj {
+	unsigned ho_key;
+	bool ho_intable;
+	struct hashnode ho_hashnode;
+};
+
+#define htobj_key(o) ((o)->ho_key)
+#define htobj_keyeq(a, b) ((a) == (b))
+
+DECLHASH(htobjtable, struct htobj, unsigned, static __UNUSED inline);
+DEFHASH(htobjtable, struct htobj, unsigned, ho_hashnode, htobj_key,
+	hash_u32, htobj_keyeq, static __UNUSED inline);
+
+DECLARRAY(htobj, static __UNUSED inline);
+DEFARRAY(htobj, static __UNUSED inline);
+
+/*
+ * Check that exactly the objects marked ho_intable are in T, both by
+ * lookup and by iterating.
+ */
+static
+void
+hashcheck(struct htobjtable *t, struct htobj *objs, unsigned n)
+{
+	struct htobj *o;
+	unsigned i, count;
+
+	count = 0;
+	for (i=0; i<n; i++) {
+		o = htobjtable_find(t, objs[i].ho_key);
+		if (objs[i].ho_intable) {
+			KASSERT(o == &objs[i]);
+			count++;
+		}
+		else {
+			KASSERT(o == NULL);
+		}
+	}
+	KASSERT(htobjtable_num(t) == count);
+
+	for (o = htobjtable_next(t, NULL); o != NULL;
+	     o = htobjtable_next(t, o)) {
+		KASSERT(o->ho_intable);
+		count--;
+	}
+	KASSERT(count == 0);
+}
+
+int
+hashtabletest(int nargs, char **args)
+{
+	struct htobjtable t;
+	struct htobj *objs, *o;
+	unsigned i, j;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting hash table test...\n");
+
+	objs = kmalloc(TESTSIZE * sizeof(*objs));
+	if (objs == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<TESTSIZE; i++) {
+		/* spread out, and some that collide in the low bits */
+		objs[i].ho_key = i < TESTSIZE/2 ? i * 4096 : random();
+		objs[i].ho_intable = false;
+		hashnode_init(&objs[i].ho_hashnode, &objs[i]);
+	}
+	/* random() may repeat; make the keys unique. */
+	for (i=TESTSIZE/2; i<TESTSIZE; i++) {
+		for (j=0; j<i; j++) {
+			if (objs[j].ho_key == objs[i].ho_key) {
+				objs[i].ho_key = i * 4096 + 1;
+				break;
+			}
+		}
+	}
+
+	htobjtable_init(&t);
+	hashcheck(&t, objs, TESTSIZE);
+
+	/* Fill it, growing as we go. */
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(htobjtable_add(&t, &objs[i]) == 0);
+		objs[i].ho_intable = true;
+	}
+	hashcheck(&t, objs, TESTSIZE);
+
+	/* Take out a random half. */
+	for (i=0; i<TESTSIZE; i++) {
+		if (random() % 2) {
+			htobjtable_remove(&t, &objs[i]);
+			objs[i].ho_intable = false;
+		}
+	}
+	hashcheck(&t, objs, TESTSIZE);
+
+	/* Empty it by iterating, shrinking as we go. */
+	while ((o = htobjtable_next(&t, NULL)) != NULL) {
+		htobjtable_remove(&t, o);
+		o->ho_intable = false;
+	}
+	hashcheck(&t, objs, TESTSIZE);
+	KASSERT(hash_string("abc") != hash_string("abd"));
+
+	htobjtable_cleanup(&t);
+	kfree(objs);
+
+	kprintf("Hash table test complete\n");
+	return 0;
+}
+
+/*
+ * Lookup speed against a linear scan of an array, which is what the
+ * tables replace, at a few sizes.
+ */
+int
+hashtablebench(int nargs, char **args)
+{
+	static const unsigned sizes[BENCHSIZES] = { 8, 64, 512, 4096 };
+	struct htobjtable t;
+	struct htobjarray a;
+	struct htobj *objs, *o;
+	struct timespec before, after;
+	uint64_t hashns, arrayns;
+	unsigned s, n, i, j, key, lookups;
+
+	(void)nargs;
+	(void)args;
+
+	objs = kmalloc(sizes[BENCHSIZES-1] * sizeof(*objs));
+	if (objs == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("hash table benchmark (ns per lookup):\n");
+	for (s=0; s<BENCHSIZES; s++) {
+		n = sizes[s];
+		htobjtable_init(&t);
+		htobjarray_init(&a);
+		for (i=0; i<n; i++) {
+			objs[i].ho_key = i * 7 + 3;
+			hashnode_init(&objs[i].ho_hashnode, &objs[i]);
+			if (htobjtable_add(&t, &objs[i]) ||
+			    htobjarray_add(&a, &objs[i], NULL)) {
+				panic("hashtablebench: out of memory\n");
+			}
+		}
+
+		/* Fewer lookups for the big scans; it's slow. */
+		lookups = BENCHLOOKUPS / (n / 8);
+
+		gettime(&before);
+		for (i=0; i<lookups; i++) {
+			key = (i % n) * 7 + 3;
+			o = htobjtable_find(&t, key);
+			KASSERT(o != NULL);
+		}
+		gettime(&after);
+		hashns = bench_nsecs(&before, &after);
+
+		gettime(&before);
+		for (i=0; i<lookups; i++) {
+			key = (i % n) * 7 + 3;
+			for (j=0; j<n; j++) {
+				o = htobjarray_get(&a, j);
+				if (o->ho_key == key) {
+					break;
+				}
+			}
+			KASSERT(j < n);
+		}
+		gettime(&after);
+		arrayns = bench_nsecs(&before, &after);
+
+		kprintf("  %5u entries: hash %6lu, array scan %8lu\n", n,
+			(unsigned long)(hashns / lookups),
+			(unsigned long)(arrayns / lookups));
+
+		for (i=0; i<n; i++) {
+			htobjtable_remove(&t, &objs[i]);
+		}
+		htobjtable_cleanup(&t);
+		htobjarray_setsize(&a, 0);
+		htobjarray_cleanup(&a);
+	}
+
+	kfree(objs);
+	kprintf("hash table benchmark done\n");
+	return 0;
+}
@@ -33,6 +33,8 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
@@ -378,3 +380,99 @@ kmalloctest4(int nargs, char **args)
 	kprintf("Multipage kmalloc test done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// kmb
+
+/*
+ * kmalloc scaling benchmark. Runs 1, 2, ... N threads (N defaults to
+ * the number of cpus) each doing KMB_ROUNDS rounds of allocating a
+ * batch of small blocks and freeing them again, and prints the
+ * aggregate allocation rate for each thread count. With the per-cpu
+ * magazines the rate should grow roughly with the number of cpus;
+ * with everything going through the one heap lock it stays flat.
+ */
+
+#define KMB_ROUNDS 2000
+#define KMB_BATCH  8
+#define NUM_KMB_SIZES 5
+
+static
+void
+kmallocbenchthread(void *sm, unsigned long num)
+{
+	static const unsigned sizes[NUM_KMB_SIZES] = { 16, 40, 100, 200, 500 };
+
+	struct semaphore *sem = sm;
+	void *ptrs[KMB_BATCH];
+	unsigned i, j;
+
+	for (i=0; i<KMB_ROUNDS; i++) {
+		for (j=0; j<KMB_BATCH; j++) {
+			ptrs[j] = kmalloc(sizes[(i + j) % NUM_KMB_SIZES]);
+			if (ptrs[j] == NULL) {
+				panic("kmallocbench: thread %lu: "
+				      "kmalloc returned NULL\n", num);
+			}
+		}
+		for (j=0; j<KMB_BATCH; j++) {
+			kfree(ptrs[j]);
+		}
+	}
+
+	V(sem);
+}
+
+int
+kmallocbench(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after;
+	uint64_t nsecs, nallocs;
+	unsigned maxthreads, nthreads;
+	unsigned i;
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: kmb [maxthreads]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs == 2 ? (unsigned)atoi(args[1]) : cpu_count();
+	if (maxthreads == 0) {
+		maxthreads = 1;
+	}
+
+	sem = sem_create("kmallocbench", 0);
+	if (sem == NULL) {
+		panic("kmallocbench: sem_create failed\n");
+	}
+
+	kprintf("kmalloc benchmark (%u cpus, %u allocs per thread):\n",
+		cpu_count(), KMB_ROUNDS * KMB_BATCH);
+
+	for (nthreads=1; nthreads<=maxthreads; nthreads++) {
+		gettime(&before);
+		for (i=0; i<nthreads; i++) {
+			result = thread_fork("kmallocbench", NULL,
+					     kmallocbenchthread, sem, i);
+			if (result) {
+				panic("kmallocbench: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(sem);
+		}
+		gettime(&after);
+
+		nsecs = bench_nsecs(&before, &after);
+		nallocs = (uint64_t)nthreads * KMB_ROUNDS * KMB_BATCH;
+		kprintf("  %2u threads: %8lu allocs/sec\n", nthreads,
+			(unsigned long)(nallocs * 1000000000 / nsecs));
+	}
+
+	sem_destroy(sem);
+	kheap_drain();
+	kprintf("kmalloc benchmark done\n");
+	return 0;
+}
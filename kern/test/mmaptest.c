@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmap test.
+ *
+ * Maps a file twice, once read-only and once writeable, in a scratch
+ * process, and checks that both mappings read back the same data as
+ * VOP_READ. Then it writes every page of the writeable mapping back
+ * with its own contents, which dirties the pages, and changes the
+ * first byte, and unmaps both, which writes them back. It checks the
+ * changed byte reached the file with VOP_READ and puts the original
+ * back with VOP_WRITE. Finally it makes sure the mappings are really
+ * gone.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <uio.h>
+#include <proc.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <test.h>
+
+#include "opt-dumbvm.h"
+
+#if !OPT_DUMBVM
+
+struct mmt_args {
+	const char *path;
+	struct semaphore *done;
+	int result;
+};
+
+/*
+ * Check that SIZE bytes mapped at BASE match the file V.
+ */
+static
+int
+mmt_compare(struct vnode *v, vaddr_t base, off_t size,
+	    char *mapbuf, char *filebuf)
+{
+	struct iovec iov;
+	struct uio ku;
+	off_t off;
+	size_t len, i;
+	int result;
+
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		len = size - off < PAGE_SIZE ? size - off : PAGE_SIZE;
+
+		result = copyin((const_userptr_t)(base + (vaddr_t)off), mapbuf, len);
+		if (result) {
+			kprintf("mmaptest: copyin at 0x%x: %s\n",
+				(unsigned)(base + (vaddr_t)off), strerror(result));
+			return result;
+		}
+
+		uio_kinit(&iov, &ku, filebuf, len, off, UIO_READ);
+		result = VOP_READ(v, &ku);
+		if (result) {
+			kprintf("mmaptest: read at %llu: %s\n",
+				(unsigned long long)off, strerror(result));
+			return result;
+		}
+
+		for (i=0; i<len; i++) {
+			if (mapbuf[i] != filebuf[i]) {
+				kprintf("mmaptest: mismatch at offset %llu\n",
+					(unsigned long long)off + i);
+				return EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Read or write the byte at offset OFF of the file V.
+ */
+static
+int
+mmt_filebyte(struct vnode *v, off_t off, char *ch, enum uio_rw rw)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, ch, 1, off, rw);
+	result = rw == UIO_READ ? VOP_READ(v, &ku) : VOP_WRITE(v, &ku);
+	if (result) {
+		kprintf("mmaptest: %s at %llu: %s\n",
+			rw == UIO_READ ? "read" : "write",
+			(unsigned long long)off, strerror(result));
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("mmaptest: short %s at %llu\n",
+			rw == UIO_READ ? "read" : "write",
+			(unsigned long long)off);
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Rewrite every page mapped at BASE with its own contents.
+ */
+static
+int
+mmt_rewrite(vaddr_t base, off_t size, char *buf)
+{
+	off_t off;
+	size_t len;
+	int result;
+
+	for (off = 0; off < size; off += PAGE_SIZE) {
+		len = size - off < PAGE_SIZE ? size - off : PAGE_SIZE;
+		result = copyin((const_userptr_t)(base + (vaddr_t)off), buf, len);
+		if (result) {
+			return result;
+		}
+		result = copyout(buf, (userptr_t)(base + (vaddr_t)off), len);
+		if (result) {
+			kprintf("mmaptest: copyout at 0x%x: %s\n",
+				(unsigned)(base + (vaddr_t)off), strerror(result));
+			return result;
+		}
+	}
+	return 0;
+}
+
+static
+int
+mmt_run(const char *path, struct addrspace *as, char *buf1, char *buf2)
+{
+	char name[128];
+	struct vnode *v;
+	struct stat st;
+	vaddr_t ro, rw;
+	char orig, changed, ch;
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	strcpy(name, path);
+	result = vfs_open(name, O_RDWR, 0664, &v);
+	if (result) {
+		kprintf("mmaptest: %s: %s\n", path, strerror(result));
+		return result;
+	}
+	result = VOP_STAT(v, &st);
+	if (result) {
+		goto out;
+	}
+	if (st.st_size == 0) {
+		kprintf("mmaptest: %s is empty\n", path);
+		result = EINVAL;
+		goto out;
+	}
+
+	result = as_mmap(as, v, 0, st.st_size, false, &ro);
+	if (result) {
+		kprintf("mmaptest: as_mmap: %s\n", strerror(result));
+		goto out;
+	}
+	result = as_mmap(as, v, 0, st.st_size, true, &rw);
+	if (result) {
+		kprintf("mmaptest: as_mmap: %s\n", strerror(result));
+		goto out;
+	}
+	kprintf("mmaptest: %llu bytes mapped at 0x%x and 0x%x\n",
+		(unsigned long long)st.st_size, ro, rw);
+
+	result = mmt_compare(v, ro, st.st_size, buf1, buf2);
+	if (result) {
+		goto out;
+	}
+	result = mmt_compare(v, rw, st.st_size, buf1, buf2);
+	if (result) {
+		goto out;
+	}
+	result = mmt_rewrite(rw, st.st_size, buf1);
+	if (result) {
+		goto out;
+	}
+
+	/* Change a byte too, so we can tell writeback really happened. */
+	result = copyin((const_userptr_t)rw, &orig, 1);
+	if (result) {
+		goto out;
+	}
+	changed = ~orig;
+	result = copyout(&changed, (userptr_t)rw, 1);
+	if (result) {
+		goto out;
+	}
+
+	result = as_munmap(as, ro, st.st_size);
+	if (result == 0) {
+		result = as_munmap(as, rw, st.st_size);
+	}
+	if (result) {
+		kprintf("mmaptest: as_munmap: %s\n", strerror(result));
+		goto out;
+	}
+
+	/* The pages should have been written back, with the new byte. */
+	kprintf("mmaptest: unmapped\n");
+	result = mmt_filebyte(v, 0, &ch, UIO_READ);
+	if (result) {
+		goto out;
+	}
+	if (ch != changed) {
+		kprintf("mmaptest: change through mapping not written back\n");
+		result = EINVAL;
+		goto out;
+	}
+	result = mmt_filebyte(v, 0, &orig, UIO_WRITE);
+	if (result) {
+		goto out;
+	}
+
+	if (as_munmap(as, ro, st.st_size) != EINVAL) {
+		kprintf("mmaptest: second munmap didn't fail\n");
+		result = EINVAL;
+		goto out;
+	}
+	if (copyin((const_userptr_t)ro, buf1, 1) != EFAULT) {
+		kprintf("mmaptest: page still mapped after munmap\n");
+		result = EINVAL;
+		goto out;
+	}
+
+ out:
+	/* Any mappings left are cleaned up by as_destroy. */
+	vfs_close(v);
+	return result;
+}
+
+/*
+ * Runs in a scratch process so it has an address space of its own.
+ */
+static
+void
+mmt_thread(void *p, unsigned long junk)
+{
+	struct mmt_args *args = p;
+	struct addrspace *as;
+	char *buf1, *buf2;
+
+	(void)junk;
+
+	buf1 = kmalloc(PAGE_SIZE);
+	buf2 = kmalloc(PAGE_SIZE);
+	as = as_create();
+	if (buf1 == NULL || buf2 == NULL || as == NULL) {
+		args->result = ENOMEM;
+		if (as != NULL) {
+			as_destroy(as);
+		}
+	}
+	else {
+		proc_setas(as);
+		as_activate();
+
+		args->result = mmt_run(args->path, as, buf1, buf2);
+
+		as_deactivate();
+		as = proc_setas(NULL);
+		as_destroy(as);
+	}
+	kfree(buf1);
+	kfree(buf2);
+
+	/* Leave the process so it can be destroyed. */
+	proc_remthread(curthread);
+	proc_addthread(kproc, curthread);
+	V(args->done);
+}
+
+#endif /* !OPT_DUMBVM */
+
+int
+mmaptest(int nargs, char **args)
+{
+#if OPT_DUMBVM
+	(void)nargs;
+	(void)args;
+	kprintf("mmaptest: dumbvm doesn't do mmap\n");
+	return 0;
+#else
+	struct mmt_args targs;
+	struct proc *proc;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: mmt file\n");
+		return EINVAL;
+	}
+
+	targs.path = args[1];
+	targs.done = sem_create("mmaptest", 0);
+	if (targs.done == NULL) {
+		panic("mmaptest: sem_create failed\n");
+	}
+	proc = proc_create_runprogram("mmaptest");
+	if (proc == NULL) {
+		sem_destroy(targs.done);
+		return ENOMEM;
+	}
+
+	kprintf("Starting mmap test...\n");
+	result = thread_fork("mmaptest", proc, mmt_thread, &targs, 0);
+	if (result) {
+		panic("mmaptest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(targs.done);
+	sem_destroy(targs.done);
+	proc_destroy(proc);
+
+	if (targs.result) {
+		kprintf("mmaptest: FAILED: %s\n", strerror(targs.result));
+		return targs.result;
+	}
+	kprintf("mmap test done\n");
+	return 0;
+#endif
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <radixtree.h>
+#include <test.h>
+
+#define TESTSIZE 2000
+#define BENCHSIZE 10000
+#define BENCHLOOKUPS 200000
+
+/* Values are never dereferenced; any non-NULL pointer will do. */
+#define VAL(i) ((void *)(0xb007 + 4*(i)))
+
+/*
+ * Check that exactly the keys with PRESENT set are in RT, by lookup
+ * and by walking it in order.
+ */
+static
+void
+radixcheck(struct radixtree *rt, const uint32_t *keys, const bool *present,
+	   unsigned n)
+{
+	uint32_t key, prev;
+	unsigned i, count;
+	bool first;
+	void *val;
+
+	count = 0;
+	for (i=0; i<n; i++) {
+		val = radixtree_get(rt, keys[i]);
+		if (present[i]) {
+			KASSERT(val == VAL(i));
+			count++;
+		}
+		else {
+			KASSERT(val == NULL);
+		}
+	}
+	KASSERT(radixtree_num(rt) == count);
+
+	key = 0;
+	prev = 0;
+	first = true;
+	while ((val = radixtree_next(rt, &key)) != NULL) {
+		KASSERT(first || key > prev);
+		first = false;
+		i = ((uintptr_t)val - 0xb007) / 4;
+		KASSERT(i < n && present[i] && keys[i] == key);
+		count--;
+		prev = key;
+		key++;
+		if (key == 0) {
+			break;
+		}
+	}
+	KASSERT(count == 0);
+}
+
+int
+radixtreetest(int nargs, char **args)
+{
+	struct radixtree rt;
+	uint32_t *keys;
+	bool *present;
+	unsigned i, j;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting radix tree test...\n");
+
+	keys = kmalloc(TESTSIZE * sizeof(*keys));
+	present = kmalloc(TESTSIZE * sizeof(*present));
+	if (keys == NULL || present == NULL) {
+		kfree(keys);
+		kfree(present);
+		return ENOMEM;
+	}
+
+	/* Small dense keys, then keys all over, including the ends. */
+	for (i=0; i<TESTSIZE; i++) {
+		keys[i] = i < TESTSIZE/2 ? i : random();
+		present[i] = false;
+	}
+	keys[TESTSIZE-1] = 0xffffffff;
+	for (i=TESTSIZE/2; i<TESTSIZE; i++) {
+		for (j=0; j<i; j++) {
+			if (keys[j] == keys[i]) {
+				keys[i] = TESTSIZE + i;
+				break;
+			}
+		}
+	}
+
+	radixtree_init(&rt);
+	radixcheck(&rt, keys, present, TESTSIZE);
+
+	for (i=0; i<TESTSIZE; i++) {
+		KASSERT(radixtree_add(&rt, keys[i], VAL(i)) == 0);
+		present[i] = true;
+		if (i == TESTSIZE/2 - 1) {
+			/* all dense so far; the tree should be short */
+			KASSERT(rt.rt_height == 2);
+			radixcheck(&rt, keys, present, TESTSIZE);
+		}
+	}
+	radixcheck(&rt, keys, present, TESTSIZE);
+
+	for (i=0; i<TESTSIZE; i++) {
+		if (random() % 2) {
+			KASSERT(radixtree_remove(&rt, keys[i]) == VAL(i));
+			KASSERT(radixtree_remove(&rt, keys[i]) == NULL);
+			present[i] = false;
+		}
+	}
+	radixcheck(&rt, keys, present, TESTSIZE);
+
+	/* Take out the big keys; it should shrink back down. */
+	for (i=TESTSIZE/2; i<TESTSIZE; i++) {
+		if (present[i]) {
+			KASSERT(radixtree_remove(&rt, keys[i]) == VAL(i));
+			present[i] = false;
+		}
+	}
+	radixcheck(&rt, keys, present, TESTSIZE);
+	KASSERT(rt.rt_height <= 2);
+
+	for (i=0; i<TESTSIZE/2; i++) {
+		if (present[i]) {
+			KASSERT(radixtree_remove(&rt, keys[i]) == VAL(i));
+			present[i] = false;
+		}
+	}
+	radixcheck(&rt, keys, present, TESTSIZE);
+	radixtree_cleanup(&rt);
+
+	kfree(keys);
+	kfree(present);
+
+	kprintf("Radix tree test complete\n");
+	return 0;
+}
+
+/*
+ * Print nanoseconds per operation for N operations between BEFORE
+ * and AFTER.
+ */
+static
+void
+radixbench_report(const char *what, unsigned n, const struct timespec *before,
+		  const struct timespec *after)
+{
+	uint64_t nsecs;
+
+	nsecs = bench_nsecs(before, after);
+	kprintf("  %-20s %6lu ns/op\n", what, (unsigned long)(nsecs / n));
+}
+
+/*
+ * Add, look up, and remove BENCHSIZE keys, dense (like pids) and
+ * sparse (like user page numbers).
+ */
+int
+radixtreebench(int nargs, char **args)
+{
+	struct radixtree rt;
+	struct timespec before, after;
+	uint32_t key, stride;
+	unsigned i, pass;
+	void *val;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("radix tree benchmark (%u keys):\n", BENCHSIZE);
+	for (pass=0; pass<2; pass++) {
+		stride = pass == 0 ? 1 : 0x10001;
+		kprintf(" %s keys:\n", pass == 0 ? "dense" : "sparse");
+		radixtree_init(&rt);
+
+		gettime(&before);
+		for (i=0; i<BENCHSIZE; i++) {
+			if (radixtree_add(&rt, i * stride, VAL(i))) {
+				panic("radixtreebench: out of memory\n");
+			}
+		}
+		gettime(&after);
+		radixbench_report("add", BENCHSIZE, &before, &after);
+
+		gettime(&before);
+		for (i=0; i<BENCHLOOKUPS; i++) {
+			val = radixtree_get(&rt, (i % BENCHSIZE) * stride);
+			KASSERT(val != NULL);
+		}
+		gettime(&after);
+		radixbench_report("get", BENCHLOOKUPS, &before, &after);
+
+		gettime(&before);
+		key = 0;
+		for (i=0; radixtree_next(&rt, &key) != NULL; i++) {
+			key++;
+		}
+		gettime(&after);
+		KASSERT(i == BENCHSIZE);
+		radixbench_report("next", BENCHSIZE, &before, &after);
+
+		gettime(&before);
+		for (i=0; i<BENCHSIZE; i++) {
+			radixtree_remove(&rt, i * stride);
+		}
+		gettime(&after);
+		radixbench_report("remove", BENCHSIZE, &before, &after);
+
+		radixtree_cleanup(&rt);
+	}
+
+	kprintf("radix tree benchmark done\n");
+	return 0;
+}
@@ -80,12 +80,17 @@ static void entrypoint_for_my_fork(void * ignore, unsigned long i)
 int threadjointest(int argc, char ** args)
 {
 	int tid;
+	struct timespec before, after;
+	uint64_t usecs;
 	kprintf("Starting thread join test..\n");
 
 	initialize_synch_data_structures();
 
    /* run test nloop times */
    for(int j = 0; j < NLOOPS; j ++) {
+
+	/* time the whole round of forks and joins */
+	gettime(&before);
 	
 	for(int i = 1; i <= NTHREADS; i++) {
 
@@ -124,6 +129,13 @@ int threadjointest(int argc, char ** args)
 
 	}
 
+	/* report create-and-join latency for this round */
+	gettime(&after);
+	usecs = bench_nsecs(&before, &after) / 1000;
+	kprintf("%d threads created and joined in %lu us (%lu us each)\n",
+		NTHREADS, (unsigned long)usecs,
+		(unsigned long)(usecs / NTHREADS));
+
 	/* check if we joined all our forked threads */
 	for(int k = 1; k <= NTHREADS; k++) {
 		if(!forked_threads[k]) {
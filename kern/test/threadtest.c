@@ -32,6 +32,7 @@
  */
 #include <types.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -93,13 +94,20 @@ quietthread(void *junk, unsigned long num)
 	V(tsem);
 }
 
+/*
+ * Also reports how long it took from the first fork to the last
+ * thread finishing, so changes to thread creation can be compared.
+ */
 static
 void
 runthreads(int doloud)
 {
 	char name[16];
+	struct timespec before, after;
+	uint64_t usecs;
 	int i, result;
 
+	gettime(&before);
 	for (i=0; i<NTHREADS; i++) {
 		snprintf(name, sizeof(name), "threadtest%d", i);
 		result = thread_fork(name, NULL,
@@ -114,6 +122,12 @@ runthreads(int doloud)
 	for (i=0; i<NTHREADS; i++) {
 		P(tsem);
 	}
+	gettime(&after);
+
+	usecs = bench_nsecs(&before, &after) / 1000;
+	kprintf("\n%d threads created and joined in %lu us (%lu us each)",
+		NTHREADS, (unsigned long)usecs,
+		(unsigned long)(usecs / NTHREADS));
 }
 
 
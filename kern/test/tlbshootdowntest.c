@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * TLB shootdown stress test.
+ *
+ * Measures the round-trip latency of batched shootdowns as the number
+ * of target cpus grows, for single-page and full batches, then has a
+ * thread per cpu shoot at all the others at once to make sure
+ * crossing shootdowns don't deadlock.
+ *
+ * The entries shot down are all-zero; they don't name any mapping
+ * anyone cares about, so the test doesn't disturb the running system
+ * beyond the interrupts themselves.
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spl.h>
+#include <current.h>
+#include <thread.h>
+#include <synch.h>
+#include <vm.h>
+#include <test.h>
+
+#include "opt-dumbvm.h"
+
+#define TSD_ROUNDS	1000
+#define TSD_MAXCPUS	32
+
+/*
+ * Do one round: queue BATCH entries on up to NTARGETS cpus other
+ * than this one, and wait for all of them. Returns the number of cpus
+ * actually shot at.
+ */
+static
+unsigned
+tsd_round(unsigned ntargets, unsigned batch)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	unsigned tickets[TSD_MAXCPUS];
+	struct cpu *targets[TSD_MAXCPUS];
+	struct cpu *c;
+	unsigned i, n;
+	int spl;
+
+	KASSERT(batch <= TLBSHOOTDOWN_MAX);
+	bzero(ts, sizeof(ts));
+
+	/* Don't get moved while picking "other" cpus. */
+	spl = splhigh();
+	n = 0;
+	for (i=0; i<cpu_count() && n < ntargets; i++) {
+		c = cpu_get(i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		if (ipi_tlbshootdown_batch(c, NULL, ts, batch,
+					   &tickets[n])) {
+			targets[n++] = c;
+		}
+	}
+	splx(spl);
+
+	for (i=0; i<n; i++) {
+		ipi_tlbshootdown_wait(targets[i], tickets[i]);
+	}
+	return n;
+}
+
+/*
+ * Time TSD_ROUNDS rounds and print the average.
+ */
+static
+void
+tsd_measure(unsigned ntargets, unsigned batch)
+{
+	struct timespec before, after;
+	uint64_t nsecs;
+	unsigned i;
+
+	gettime(&before);
+	for (i=0; i<TSD_ROUNDS; i++) {
+		tsd_round(ntargets, batch);
+	}
+	gettime(&after);
+
+	nsecs = bench_nsecs(&before, &after);
+	kprintf("  %2u cpus, %2u entries: %6lu ns per shootdown\n",
+		ntargets, batch, (unsigned long)(nsecs / TSD_ROUNDS));
+}
+
+static
+void
+tsd_thread(void *sem, unsigned long num)
+{
+	unsigned i;
+
+	(void)num;
+
+	for (i=0; i<TSD_ROUNDS; i++) {
+		tsd_round(TSD_MAXCPUS, 1 + i % TLBSHOOTDOWN_MAX);
+	}
+	V(sem);
+}
+
+int
+tlbshootdowntest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	struct timespec before, after, diff;
+	unsigned ncpus, i;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+#if OPT_DUMBVM
+	kprintf("tlbshootdowntest: dumbvm doesn't do TLB shootdowns\n");
+	return 0;
+#endif
+
+	ncpus = cpu_count();
+	if (ncpus < 2) {
+		kprintf("tlbshootdowntest: need more than one cpu\n");
+		return 0;
+	}
+	if (ncpus > TSD_MAXCPUS) {
+		ncpus = TSD_MAXCPUS;
+	}
+
+	kprintf("Starting TLB shootdown test...\n");
+	kprintf("Latency (%u rounds each):\n", TSD_ROUNDS);
+	for (i=1; i<ncpus; i++) {
+		tsd_measure(i, 1);
+		tsd_measure(i, TLBSHOOTDOWN_MAX);
+	}
+
+	kprintf("Crossing shootdowns from %u threads...\n", ncpus);
+	sem = sem_create("tlbshootdowntest", 0);
+	if (sem == NULL) {
+		panic("tlbshootdowntest: sem_create failed\n");
+	}
+	gettime(&before);
+	for (i=0; i<ncpus; i++) {
+		result = thread_fork("tlbshootdowntest", NULL, tsd_thread,
+				     sem, i);
+		if (result) {
+			panic("tlbshootdowntest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<ncpus; i++) {
+		P(sem);
+	}
+	gettime(&after);
+	sem_destroy(sem);
+
+	timespec_sub(&after, &before, &diff);
+	kprintf("  %u threads x %u rounds in %llu.%09lu seconds\n",
+		ncpus, TSD_ROUNDS, (unsigned long long)diff.tv_sec,
+		(unsigned long)diff.tv_nsec);
+
+	kprintf("TLB shootdown test done\n");
+	return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Callouts.
+ *
+ * Each cpu has a hierarchical timing wheel: WHEEL_LEVELS arrays of
+ * WHEEL_SIZE slots. A callout due less than WHEEL_SIZE ticks from
+ * now sits in level 0, in the slot for its exact tick. One due
+ * within WHEEL_SIZE^2 ticks sits in level 1, in the slot for bits
+ * WHEEL_BITS and up of its tick, and so on. Each hardclock runs the
+ * level 0 slot for the current tick; whenever level 0 wraps around,
+ * the next level 1 slot is emptied back into level 0 (and likewise
+ * up the levels), so callouts trickle down as their time gets near.
+ * Scheduling, cancelling and each tick are constant-time, apart from
+ * the occasional cascade.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <clock.h>
+#include <callout.h>
+
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1U << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	5
+
+#if WHEEL_BITS * WHEEL_LEVELS != 30
+#error "CALLOUT_MAXTICKS doesn't match the wheel"
+#endif
+
+#define NSECS_PER_TICK	(1000000000 / HZ)
+
+struct callout_wheel {
+	struct spinlock w_lock;
+	unsigned w_next;			/* Next tick to run */
+	struct callout *volatile w_running;	/* Callout being run */
+	struct callout *w_slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+struct callout_wheel *
+callout_wheel_create(void)
+{
+	struct callout_wheel *w;
+	unsigned i, j;
+
+	w = kmalloc(sizeof(*w));
+	if (w == NULL) {
+		return NULL;
+	}
+	spinlock_init(&w->w_lock);
+	w->w_next = 0;
+	w->w_running = NULL;
+	for (i=0; i<WHEEL_LEVELS; i++) {
+		for (j=0; j<WHEEL_SIZE; j++) {
+			w->w_slots[i][j] = NULL;
+		}
+	}
+	return w;
+}
+
+////////////////////////////////////////////////////////////
+// list ops
+
+static
+void
+callout_link(struct callout **head, struct callout *c)
+{
+	c->co_next = *head;
+	if (c->co_next != NULL) {
+		c->co_next->co_prevp = &c->co_next;
+	}
+	*head = c;
+	c->co_prevp = head;
+}
+
+static
+void
+callout_unlink(struct callout *c)
+{
+	KASSERT(c->co_prevp != NULL);
+
+	*c->co_prevp = c->co_next;
+	if (c->co_next != NULL) {
+		c->co_next->co_prevp = c->co_prevp;
+	}
+	c->co_next = NULL;
+	c->co_prevp = NULL;
+}
+
+/*
+ * Put C in the right slot of W for its co_expire, which must not be
+ * before w_next. Caller holds the wheel lock.
+ */
+static
+void
+wheel_insert(struct callout_wheel *w, struct callout *c)
+{
+	unsigned delta, level, slot;
+
+	delta = c->co_expire - w->w_next;
+	KASSERT(delta <= CALLOUT_MAXTICKS);
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < 1U << (WHEEL_BITS * (level + 1))) {
+			break;
+		}
+	}
+	slot = (c->co_expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	callout_link(&w->w_slots[level][slot], c);
+}
+
+/*
+ * Empty slot SLOT of level LEVEL, reinserting everything in it one
+ * or more levels further down.
+ */
+static
+void
+wheel_cascade(struct callout_wheel *w, unsigned level, unsigned slot)
+{
+	struct callout *c;
+
+	while ((c = w->w_slots[level][slot]) != NULL) {
+		callout_unlink(c);
+		wheel_insert(w, c);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interface
+
+void
+callout_init(struct callout *c, void (*func)(void *), void *arg)
+{
+	c->co_next = NULL;
+	c->co_prevp = NULL;
+	c->co_expire = 0;
+	c->co_func = func;
+	c->co_arg = arg;
+	c->co_cpu = NULL;
+}
+
+bool
+callout_pending(struct callout *c)
+{
+	return c->co_prevp != NULL;
+}
+
+uint64_t
+callout_ticks(uint64_t nsecs)
+{
+	return (nsecs + NSECS_PER_TICK - 1) / NSECS_PER_TICK;
+}
+
+unsigned
+callout_ticks_until(const struct timespec *deadline)
+{
+	struct timespec now, left;
+	uint64_t ticks;
+
+	gettime(&now);
+	if (now.tv_sec > deadline->tv_sec ||
+	    (now.tv_sec == deadline->tv_sec &&
+	     now.tv_nsec >= deadline->tv_nsec)) {
+		return 0;
+	}
+	timespec_sub(deadline, &now, &left);
+	ticks = callout_ticks((uint64_t)left.tv_sec * 1000000000
+			      + left.tv_nsec);
+	return ticks > CALLOUT_MAXTICKS ? CALLOUT_MAXTICKS : ticks;
+}
+
+/*
+ * Lock the wheel C was last put on and return it, or return NULL if
+ * it has never been scheduled. C may move between wheels while we
+ * wait for the lock, so check it's still there once we have it.
+ */
+static
+struct callout_wheel *
+callout_lock(struct callout *c)
+{
+	struct cpu *cpu;
+	struct callout_wheel *w;
+
+	while (1) {
+		cpu = c->co_cpu;
+		if (cpu == NULL) {
+			return NULL;
+		}
+		w = cpu->c_callouts;
+		spinlock_acquire(&w->w_lock);
+		if (c->co_cpu == cpu) {
+			return w;
+		}
+		spinlock_release(&w->w_lock);
+	}
+}
+
+void
+callout_schedule(struct callout *c, unsigned ticks)
+{
+	struct callout_wheel *w;
+	unsigned owed;
+	int spl;
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	/* Take it off whatever wheel it's on now, if any */
+	w = callout_lock(c);
+	if (w != NULL) {
+		if (callout_pending(c)) {
+			callout_unlink(c);
+		}
+		spinlock_release(&w->w_lock);
+	}
+
+	/* Stay on this cpu until it's on our wheel */
+	spl = splhigh();
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->w_lock);
+	KASSERT(!callout_pending(c));
+	c->co_cpu = curcpu->c_self;
+	/*
+	 * After idling, the wheel is behind by the ticks the next
+	 * hardclock still owes it (see clock.c); count from the real
+	 * time, or the callout would go off that many ticks early.
+	 */
+	owed = curcpu->c_ticksowed;
+	if (ticks > CALLOUT_MAXTICKS - owed) {
+		ticks = CALLOUT_MAXTICKS - owed;
+	}
+	c->co_expire = w->w_next + owed + ticks - 1;
+	wheel_insert(w, c);
+	spinlock_release(&w->w_lock);
+	splx(spl);
+}
+
+bool
+callout_cancel(struct callout *c)
+{
+	struct callout_wheel *w;
+	struct cpu *cpu;
+
+	w = callout_lock(c);
+	if (w == NULL) {
+		return false;
+	}
+	if (callout_pending(c)) {
+		callout_unlink(c);
+		spinlock_release(&w->w_lock);
+		return true;
+	}
+	cpu = c->co_cpu;
+	spinlock_release(&w->w_lock);
+
+	/*
+	 * If it's running right now, wait for it to finish, unless
+	 * we're being called from it (its cpu is us, and we're in
+	 * the timer interrupt).
+	 */
+	if (cpu == curcpu->c_self && curthread->t_in_interrupt) {
+		return false;
+	}
+	while (w->w_running == c) {
+		/* spin */
+	}
+	return false;
+}
+
+/*
+ * Work out how many ticks from now the current cpu's wheel next needs
+ * a hardclock: either for a level 0 slot with something in it, or
+ * for a cascade out of a nonempty slot further up. (The callouts in
+ * the latter may not be due for a while after they cascade, but
+ * finding out exactly when would mean looking at all of them.)
+ */
+unsigned
+callout_next(void)
+{
+	struct callout_wheel *w;
+	unsigned now, level, shift, i, ticks, best;
+
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->w_lock);
+
+	now = w->w_next;
+	best = 0;
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		shift = WHEEL_BITS * level;
+		/*
+		 * The slot I places along is used (run, or cascaded)
+		 * at the tick with (now >> SHIFT) + I in bits SHIFT and
+		 * up and zeros below. For I = 0 that's only still to
+		 * come if it's now; otherwise the slot's next turn is
+		 * a whole lap away, at I = WHEEL_SIZE.
+		 */
+		i = (now & ((1U << shift) - 1)) == 0 ? 0 : 1;
+		for (; i <= WHEEL_SIZE; i++) {
+			if (w->w_slots[level][((now >> shift) + i) &
+					      WHEEL_MASK] != NULL) {
+				break;
+			}
+		}
+		if (i > WHEEL_SIZE) {
+			continue;
+		}
+		/* The hardclock for tick now is 1 tick from now */
+		ticks = (((now >> shift) + i) << shift) - now + 1;
+		if (best == 0 || ticks < best) {
+			best = ticks;
+		}
+	}
+
+	spinlock_release(&w->w_lock);
+	return best;
+}
+
+/*
+ * Advance the current cpu's wheel TICKS ticks and run everything due.
+ * More than one tick at once happens when the cpu has been idling
+ * without the periodic hardclock; see clock.c.
+ *
+ * The due callouts are moved to a private list first, so new ones
+ * scheduled by the functions we call can't end up in it. The lock is
+ * dropped around each function call; callout_cancel can still take
+ * callouts off the private list meanwhile, which is why it's walked
+ * from the head under the lock each time.
+ */
+void
+callout_hardclock(unsigned ticks)
+{
+	struct callout_wheel *w;
+	struct callout *due, *c;
+	unsigned now, level, slot;
+
+	w = curcpu->c_callouts;
+	spinlock_acquire(&w->w_lock);
+
+	due = NULL;
+	for (; ticks > 0; ticks--) {
+		now = w->w_next;
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if (((now >> (WHEEL_BITS * (level - 1))) &
+			     WHEEL_MASK) != 0) {
+				break;
+			}
+			slot = (now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			wheel_cascade(w, level, slot);
+		}
+
+		slot = now & WHEEL_MASK;
+		while ((c = w->w_slots[0][slot]) != NULL) {
+			KASSERT(c->co_expire == now);
+			callout_unlink(c);
+			callout_link(&due, c);
+		}
+		w->w_next = now + 1;
+	}
+
+	while ((c = due) != NULL) {
+		callout_unlink(c);
+		w->w_running = c;
+		spinlock_release(&w->w_lock);
+
+		c->co_func(c->co_arg);
+
+		spinlock_acquire(&w->w_lock);
+		w->w_running = NULL;
+	}
+
+	spinlock_release(&w->w_lock);
+}
@@ -34,13 +34,23 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
+#include <callout.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at specific points in the future, with a resolution of
+ * one hardclock, are in callout.c; timed sleeps are built on those.
+ *
+ * An idle cpu has no use for hardclock except to run its callouts, so
+ * it stops the periodic interrupt and asks for a single one when its
+ * wheel next needs a tick (or none at all if there's nothing on it).
+ * The ticks it skipped are counted when it leaves the idle loop, or
+ * when that interrupt arrives, and the next hardclock makes them all
+ * up at once. Callouts are only scheduled by threads and by callout
+ * functions, which run from hardclock, so nothing can give an idle
+ * cpu an earlier deadline behind its back.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,8 +60,8 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	4	/* Age run queues every 4 hardclocks. */
+#define MIGRATE_HARDCLOCKS	64	/* Push-migrate every 64 hardclocks. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -92,18 +102,74 @@ timerclock(void)
 void
 hardclock(void)
 {
+	unsigned ticks, then;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	ticks = 1;
+	if (curcpu->c_tickless) {
+		/* The one-shot interrupt; it has been this long */
+		curcpu->c_tickless = false;
+		ticks = curcpu->c_ticklessticks;
+	}
+	ticks += curcpu->c_ticksowed;
+	curcpu->c_ticksowed = 0;
+
+	then = curcpu->c_hardclocks;
+	curcpu->c_hardclocks += ticks;
+	callout_hardclock(ticks);
+	if (then / MIGRATE_HARDCLOCKS !=
+	    curcpu->c_hardclocks / MIGRATE_HARDCLOCKS) {
 		thread_consider_migration();
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	if (then / SCHEDULE_HARDCLOCKS !=
+	    curcpu->c_hardclocks / SCHEDULE_HARDCLOCKS) {
 		schedule();
 	}
-	thread_yield();
+	thread_tick();
+}
+
+/*
+ * Called by thread_switch before cpu_idle: stop ticking until the
+ * next callout. Ticks still owed from an earlier idle spell haven't
+ * been taken off the wheel yet, so they come off the wait.
+ */
+void
+hardclock_idle(void)
+{
+	unsigned ticks;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	if (curcpu->c_tickless) {
+		/* Woken by something else; keep waiting */
+		return;
+	}
+	ticks = callout_next();
+	if (ticks != 0) {
+		ticks = ticks > curcpu->c_ticksowed ?
+			ticks - curcpu->c_ticksowed : 1;
+	}
+	curcpu->c_tickless = true;
+	curcpu->c_ticklessticks = mainbus_timer_oneshot(ticks);
+}
+
+/*
+ * Called by thread_switch on finding a thread to run: start ticking
+ * again.
+ */
+void
+hardclock_unidle(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+
+	if (!curcpu->c_tickless) {
+		return;
+	}
+	curcpu->c_tickless = false;
+	curcpu->c_ticksowed += mainbus_timer_periodic();
 }
 
 /*
@@ -119,3 +185,26 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Suspend execution for at least NSECS nanoseconds, rounded up to
+ * whole hardclocks. We're partway through the current tick, so the
+ * sleep can come up short; work from a deadline and keep sleeping
+ * until it's passed. This also does sleeps longer than the callout
+ * wheel can hold in pieces.
+ */
+void
+thread_sleep_ns(uint64_t nsecs)
+{
+	struct timespec deadline, timeout;
+	unsigned ticks;
+
+	gettime(&deadline);
+	timeout.tv_sec = nsecs / 1000000000;
+	timeout.tv_nsec = nsecs % 1000000000;
+	timespec_add(&deadline, &timeout, &deadline);
+
+	while ((ticks = callout_ticks_until(&deadline)) > 0) {
+		thread_sleep_ticks(ticks);
+	}
+}
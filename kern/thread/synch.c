@@ -33,13 +33,45 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <kmemcache.h>
+#include <clock.h>
+#include <callout.h>
 #include <synch.h>
 
+/*
+ * Object caches for locks and CVs. These keep the wait channel and
+ * spinlock of a freed lock or CV constructed, ready for the next one.
+ */
+static struct kmem_cache *lock_cache;
+static struct kmem_cache *cv_cache;
+
+static int lock_ctor(void *obj);
+static void lock_dtor(void *obj);
+static int cv_ctor(void *obj);
+static void cv_dtor(void *obj);
+
+/*
+ * Set up the caches. Called early in boot, before anything creates
+ * a lock or CV.
+ */
+void
+synch_bootstrap(void)
+{
+	lock_cache = kmem_cache_create("lock", sizeof(struct lock),
+				       lock_ctor, lock_dtor);
+	cv_cache = kmem_cache_create("cv", sizeof(struct cv),
+				     cv_ctor, cv_dtor);
+	if (lock_cache == NULL || cv_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -134,46 +166,94 @@ V(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+int
+sem_timed_P(struct semaphore *sem, uint64_t nsecs)
+{
+	struct timespec deadline, timeout;
+	unsigned ticks;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/*
+	 * Work from a deadline, because if someone else gets in
+	 * ahead of us after we're woken we have to go back to sleep
+	 * for whatever time is left.
+	 */
+	gettime(&deadline);
+	timeout.tv_sec = nsecs / 1000000000;
+	timeout.tv_nsec = nsecs % 1000000000;
+	timespec_add(&deadline, &timeout, &deadline);
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		ticks = callout_ticks_until(&deadline);
+		if (ticks == 0) {
+			spinlock_release(&sem->sem_lock);
+			return ETIMEDOUT;
+		}
+		wchan_sleep_timeout(sem->sem_wchan, &sem->sem_lock, ticks);
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return 0;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Lock.
 
+static
+int
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->lk_name = NULL;
+	lock->lk_wchan = wchan_create("lock");
+	if (lock->lk_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&lock->lk_lock);
+	lock->lk_holder = NULL;
+	lock->locked = false;
+	return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+	struct lock *lock = obj;
+
+	wchan_destroy(lock->lk_wchan);
+	spinlock_cleanup(&lock->lk_lock);
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
 
-        lock = kmalloc(sizeof(*lock));
+	/* comes with its wait channel and spinlock already made */
+        lock = kmem_cache_alloc(lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
+	KASSERT(lock->lk_holder == NULL);
 
         lock->lk_name = kstrdup(name);
         if (lock->lk_name == NULL) {
-                kfree(lock);
+                kmem_cache_free(lock_cache, lock);
                 return NULL;
         }
 
-        // add stuff here as needed
-
 	/* init our deadlock detector */
 	HANGMAN_LOCKABLEINIT(&lock->deadlk_handler, lock->lk_name);
 
-	// create our wait channel
-        lock->lk_wchan = wchan_create(lock->lk_name);
-        
-	// check for failures
-	if (lock->lk_wchan == NULL) {
-        	kfree(lock->lk_name);
-        	kfree(lock);
-        	return NULL;
-        }
-	
-	// init spinlock and claim no holder
-        spinlock_init(&lock->lk_lock);
-        lock->lk_holder = NULL;	
-        lock->locked = false;
-        
+	wchan_setname(lock->lk_wchan, lock->lk_name);
+
 	return lock;
 }
 
@@ -182,20 +262,18 @@ lock_destroy(struct lock *lock)
 {
 	// make sure our lock exists
         KASSERT(lock != NULL);
-	
-	// destroy wait channel
-	wchan_destroy(lock->lk_wchan);
-	
+
 	// claim no lock holder
 	lock->lk_holder = NULL;
 	lock->locked = false;
-	
-	// clean up our spin lock
-	spinlock_cleanup(&lock->lk_lock);
-	
-	// free our malloc'd memory
+
+	// the wait channel outlives the name; give it back its own
+	wchan_setname(lock->lk_wchan, "lock");
+
+	// free our malloc'd memory and return the rest to the cache
         kfree(lock->lk_name);
-        kfree(lock);
+        lock->lk_name = NULL;
+        kmem_cache_free(lock_cache, lock);
 }
 
 void
@@ -290,34 +368,48 @@ lock_do_i_hold(struct lock *lock)
 // CV
 
 
+static
+int
+cv_ctor(void *obj)
+{
+	struct cv *cv = obj;
+
+	cv->cv_name = NULL;
+	cv->cv_wchan = wchan_create("cv");
+	if (cv->cv_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&cv->cv_splk);
+	return 0;
+}
+
+static
+void
+cv_dtor(void *obj)
+{
+	struct cv *cv = obj;
+
+	wchan_destroy(cv->cv_wchan);
+	spinlock_cleanup(&cv->cv_splk);
+}
+
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(*cv));
+        cv = kmem_cache_alloc(cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                kmem_cache_free(cv_cache, cv);
                 return NULL;
         }
 
-        // add stuff here as needed
-	
-	cv->cv_wchan = wchan_create(cv->cv_name);
-
-	if(cv->cv_wchan == NULL)
-	{
-		kfree(cv->cv_name);
-		kfree(cv);
-		return NULL;
-	}
-
-	spinlock_init(&cv->cv_splk);
+	wchan_setname(cv->cv_wchan, cv->cv_name);
 
         return cv;
 }
@@ -327,12 +419,11 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-	wchan_destroy(cv->cv_wchan);
-	spinlock_cleanup(&cv->cv_splk);
+	wchan_setname(cv->cv_wchan, "cv");
 
         kfree(cv->cv_name);
-        kfree(cv);
+        cv->cv_name = NULL;
+        kmem_cache_free(cv_cache, cv);
 }
 
 void
@@ -359,6 +450,40 @@ cv_wait(struct cv *cv, struct lock *lock)
 	}
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, uint64_t nsecs)
+{
+	struct timespec deadline, timeout;
+	unsigned ticks;
+	bool woken;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	/*
+	 * The first hardclock may be nearly due already, so a timeout
+	 * can come a tick early; if it does, sleep again on the same
+	 * wchan for the rest of the time.
+	 */
+	gettime(&deadline);
+	timeout.tv_sec = nsecs / 1000000000;
+	timeout.tv_nsec = nsecs % 1000000000;
+	timespec_add(&deadline, &timeout, &deadline);
+
+	spinlock_acquire(&cv->cv_splk);
+	lock_release(lock);
+	woken = false;
+	while (!woken && (ticks = callout_ticks_until(&deadline)) > 0) {
+		woken = wchan_sleep_timeout(cv->cv_wchan, &cv->cv_splk,
+					    ticks);
+	}
+	spinlock_release(&cv->cv_splk);
+	lock_acquire(lock);
+
+	return woken ? 0 : ETIMEDOUT;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
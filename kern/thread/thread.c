@@ -40,6 +40,7 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -47,20 +48,57 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <kmemcache.h>
+#include <shrinker.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <callout.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Each cpu keeps up to THREAD_POOL_DEPTH exited threads on
+ * c_threadpool, with their stacks, instead of freeing them, so
+ * thread_fork usually doesn't have to allocate anything. When memory
+ * runs short, thread_pool_shrink frees them.
+ */
+#define THREAD_POOL_DEPTH 8
+
+/*
+ * Scheduler tuning. A thread at priority P gets a quantum of
+ * SCHED_QUANTUM(P) hardclocks; using all of it moves the thread down
+ * a level. A thread that has sat on a run queue for
+ * SCHED_AGE_HARDCLOCKS moves up a level. See schedule().
+ */
+#define SCHED_QUANTUM(p)	(1U << (p))
+#define SCHED_AGE_HARDCLOCKS	50
+
+/*
+ * A woken thread goes back to the cpu it last ran on, where its cache
+ * footprint may still be, unless that cpu's load is at least
+ * SCHED_WAKE_SLACK more than the least loaded cpu it could use.
+ */
+#define SCHED_WAKE_SLACK	2
+
+/* Affinity mask bit for cpu C. */
+#define CPUBIT(c)	(1U << (c)->c_number)
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
 	struct threadlist wc_threads;	/* list of waiting threads */
 };
 
+/*
+ * Cache of thread structures. A cached thread keeps its join lock
+ * and CV, so creating a thread doesn't have to make new ones.
+ */
+static struct kmem_cache *thread_cache;
+
 /* Master array of CPUs. */
 DECLARRAY(cpu, static __UNUSED inline);
 DEFARRAY(cpu, static __UNUSED inline);
@@ -77,16 +115,21 @@ static struct t_id_list t_ids;
 /*
  * Stick a magic number on the bottom end of the stack. This will
  * (sometimes) catch kernel stack overflows. Use thread_checkstack()
- * to test this.
+ * to test this. With assertions off nothing would ever look at it,
+ * so don't bother.
  */
 static
 void
 thread_checkstack_init(struct thread *thread)
 {
+#if OPT_NOASSERTS
+	(void)thread;
+#else
 	((uint32_t *)thread->t_stack)[0] = THREAD_STACK_MAGIC;
 	((uint32_t *)thread->t_stack)[1] = THREAD_STACK_MAGIC;
 	((uint32_t *)thread->t_stack)[2] = THREAD_STACK_MAGIC;
 	((uint32_t *)thread->t_stack)[3] = THREAD_STACK_MAGIC;
+#endif
 }
 
 /*
@@ -112,26 +155,57 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Constructor and destructor for the thread cache.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_ctor(void *obj)
 {
-	struct thread *thread;
+	struct thread *thread = obj;
+
+	thread->child_cv = cv_create("child thread cv");
+	if (thread->child_cv == NULL) {
+		return ENOMEM;
+	}
+	thread->child_lk = lock_create("child thread lk");
+	if (thread->child_lk == NULL) {
+		cv_destroy(thread->child_cv);
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	lock_destroy(thread->child_lk);
+	cv_destroy(thread->child_cv);
+}
 
+/*
+ * Set up a thread structure fresh from the cache (or from a cpu's
+ * pool) for a new thread called NAME. Everything but the stack is
+ * initialized here. If the name can't be allocated, nothing has
+ * been touched.
+ */
+static
+int
+thread_init(struct thread *thread, const char *name)
+{
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
 	}
-
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			return ENOMEM;
+		}
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -139,10 +213,16 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_wchan = NULL;
+	thread->t_priority = 0;
+	thread->t_ticksleft = SCHED_QUANTUM(0);
+	thread->t_enqueued = 0;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_migrations = 0;
+	thread->t_xcpuwakeups = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -157,17 +237,38 @@ thread_create(const char *name)
 	/* initialize deadlock detector */
 	HANGMAN_ACTORINIT(&thread->t_deadlock_detector, thread->t_name);
 	
-	/* init cvs and locks for thread join */
+	/* cvs and locks for thread join; child_cv/child_lk come from
+	 * the cache constructor */
 	thread->parent_cv = NULL;
 	thread->parent_lk = NULL;	
-	thread->child_cv = cv_create("child thread cv");
-	thread->child_lk = lock_create("child thread lk");
 
         thread->thread_id = 0;
 	thread->child_id = 0;
         thread->child = NULL;
 //	thread->child_is_alive = true;
 
+	return 0;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmem_cache_alloc(thread_cache);
+	if (thread == NULL) {
+		return NULL;
+	}
+	if (thread_init(thread, name)) {
+		kmem_cache_free(thread_cache, thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
 	return thread;
 }
 
@@ -217,6 +318,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -230,19 +332,41 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_tickless = false;
+	c->c_ticklessticks = 0;
+	c->c_ticksowed = 0;
+	threadlist_init(&c->c_threadpool);
+	spinlock_init(&c->c_threadpool_lock);
+
+	c->c_tlbhand = 0;
+	bzero(&c->c_vmstats, sizeof(c->c_vmstats));
+
+	c->c_callouts = callout_wheel_create();
+	if (c->c_callouts == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueues[i]);
+	}
+	c->c_runcount = 0;
+	c->c_leaving = NULL;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_done = 0;
+	c->c_tlbas = NULL;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	if (c->c_number >= 32) {
+		panic("cpu_create: too many cpus for affinity masks\n");
+	}
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -302,6 +426,25 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Return the number of cpus.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Return the cpu whose c_number is NUM.
+ */
+struct cpu *
+cpu_get(unsigned num)
+{
+	KASSERT(num < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -314,6 +457,9 @@ static
 void
 thread_destroy(struct thread *thread)
 {
+	struct cpu *c;
+	bool pooled;
+
 	KASSERT(thread != curthread);
 	KASSERT(thread->t_state != S_RUN);
 
@@ -327,17 +473,114 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
-	kfree(thread);
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
+	}
+
+	/* Keep it for reuse if this cpu's pool has room */
+	if (thread->t_stack != NULL) {
+		/* If we migrate meanwhile, the pool is just another cpu's */
+		c = curcpu->c_self;
+		spinlock_acquire(&c->c_threadpool_lock);
+		pooled = c->c_threadpool.tl_count < THREAD_POOL_DEPTH;
+		if (pooled) {
+			threadlist_addhead(&c->c_threadpool, thread);
+		}
+		spinlock_release(&c->c_threadpool_lock);
+		if (pooled) {
+			return;
+		}
+		kfree(thread->t_stack);
+	}
+	kmem_cache_free(thread_cache, thread);
+}
+
+/*
+ * Create a thread with a stack, for thread_fork and my_fork. Most
+ * of the time there's one waiting in this cpu's pool (the most
+ * recently exited, whose stack is likeliest to be in the cache). Its
+ * stack guard was checked when it switched out for the last time and
+ * nothing has run on the stack since, so it doesn't need painting
+ * again.
+ */
+static
+struct thread *
+thread_create_withstack(const char *name)
+{
+	struct thread *thread;
+	struct cpu *c;
+
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_threadpool_lock);
+	thread = threadlist_remhead(&c->c_threadpool);
+	spinlock_release(&c->c_threadpool_lock);
+
+	if (thread != NULL) {
+		if (thread_init(thread, name)) {
+			kfree(thread->t_stack);
+			kmem_cache_free(thread_cache, thread);
+			return NULL;
+		}
+		thread_checkstack(thread);
+		return thread;
+	}
+
+	thread = thread_create(name);
+	if (thread == NULL) {
+		return NULL;
+	}
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_checkstack_init(thread);
+	return thread;
+}
+
+/*
+ * Shrinker: free pooled threads and their stacks, from every cpu,
+ * until NPAGES pages' worth of stacks are gone or the pools are
+ * empty. They're collected under the pool locks and freed after.
+ * (The thread structures go back to thread_cache, which the kheap
+ * shrinker reaps later.)
+ */
+static
+unsigned
+thread_pool_shrink(unsigned npages)
+{
+	struct threadlist doomed;
+	struct thread *thread;
+	struct cpu *c;
+	unsigned i, numcpus, freed;
+
+	threadlist_init(&doomed);
+	freed = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus && freed < npages; i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_threadpool_lock);
+		while (freed < npages &&
+		       (thread = threadlist_remhead(&c->c_threadpool))
+		       != NULL) {
+			threadlist_addtail(&doomed, thread);
+			freed += STACK_SIZE / PAGE_SIZE;
+		}
+		spinlock_release(&c->c_threadpool_lock);
+	}
+
+	while ((thread = threadlist_remhead(&doomed)) != NULL) {
+		kfree(thread->t_stack);
+		kmem_cache_free(thread_cache, thread);
+	}
+	threadlist_cleanup(&doomed);
+	return freed;
 }
 
 /*
@@ -367,6 +610,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -381,9 +627,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		rq = &curcpu->c_runqueues[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +676,16 @@ thread_bootstrap(void)
 {
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+	if (shrinker_register("threadpool", SHRINK_PRIO_CACHE,
+			      thread_pool_shrink)) {
+		panic("thread_bootstrap: Can't register shrinker\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -495,16 +755,254 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue operations. The caller must hold C's run queue lock.
+ *
+ * runqueue_add puts T at the tail of the queue for its priority.
+ * runqueue_remhead takes the first thread from the highest-priority
+ * nonempty queue, which is the one to run next; runqueue_remtail
+ * takes the last thread from the lowest-priority nonempty queue,
+ * which is the one we'd miss least if it were moved elsewhere.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+	KASSERT(t->t_priority < SCHED_NPRIO);
+
+	t->t_enqueued = c->c_hardclocks;
+	threadlist_addtail(&c->c_runqueues[t->t_priority], t);
+	c->c_runcount++;
+}
+
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<SCHED_NPRIO; i++) {
+		t = threadlist_remhead(&c->c_runqueues[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=SCHED_NPRIO; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueues[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Work stealing. Called by an idle cpu, with interrupts off and
+ * without its own run queue lock held, before it goes into
+ * cpu_idle(). Picks the peer with the most queued threads, using the
+ * unlocked c_runcount hints so an idle cpu never has to lock every
+ * queue in the system, and takes the thread nearest the tail of that
+ * peer's lowest-priority queue whose affinity allows it to run here.
+ * Returns true if it put a thread on our run queue.
+ *
+ * Peers that are themselves idle are passed over: anything on their
+ * queues was just woken there and they're about to run it.
+ *
+ * The two run queue locks are never held at once, so two cpus
+ * stealing from each other can't deadlock. In between, the stolen
+ * thread is on no queue at all; since it isn't sleeping nobody can
+ * try to wake it, so nobody else can see it.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, load, maxload;
+
+	victim = NULL;
+	maxload = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			continue;
+		}
+		load = c->c_runcount;
+		if (load > maxload) {
+			victim = c;
+			maxload = load;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = NULL;
+	for (i=SCHED_NPRIO; i-- > 0 && t == NULL; ) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueues[i]) {
+			/*
+			 * Skip the victim's curthread: it can be on
+			 * the queue if it went to sleep, the victim
+			 * idled, and it was woken but hasn't been
+			 * switched back to yet. See the comments in
+			 * thread_consider_migration.
+			 */
+			if (t != victim->c_curthread &&
+			    (t->t_affinity & CPUBIT(curcpu)) != 0) {
+				threadlist_remove(&victim->c_runqueues[i], t);
+				victim->c_runcount--;
+				break;
+			}
+		}
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+
+	t->t_cpu = curcpu->c_self;
+	t->t_migrations++;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	runqueue_add(curcpu, t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return true;
+}
+
+/*
+ * Load of cpu C for placement purposes, from the unlocked hints: the
+ * number of queued threads plus the running one, or 0 if idle.
+ */
+static
+unsigned
+cpu_load(struct cpu *c)
+{
+	return c->c_isidle ? 0 : c->c_runcount + 1;
+}
+
+/*
+ * Return the least loaded cpu that thread T may run on.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus, load, bestload;
+
+	best = NULL;
+	bestload = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((t->t_affinity & CPUBIT(c)) == 0) {
+			continue;
+		}
+		load = cpu_load(c);
+		if (best == NULL || load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Choose the cpu to put thread T on when it wakes up: the cpu it last
+ * ran on if that's allowed and not overloaded, otherwise the least
+ * loaded cpu it may use.
+ */
+static
+struct cpu *
+thread_wakeupcpu(struct thread *t)
+{
+	struct cpu *last, *best;
+	unsigned lastload;
+
+	last = t->t_cpu;
+	if ((t->t_affinity & CPUBIT(last)) == 0) {
+		return thread_pickcpu(t);
+	}
+	lastload = cpu_load(last);
+	if (lastload < SCHED_WAKE_SLACK) {
+		return last;
+	}
+	best = thread_pickcpu(t);
+	if (cpu_load(best) + SCHED_WAKE_SLACK > lastload) {
+		return last;
+	}
+	return best;
+}
+
+/*
+ * Put thread T, which isn't on any run queue, on cpu C's run queue,
+ * and make sure C notices. The caller must hold C's run queue lock.
+ */
+static
+void
+thread_enqueue(struct cpu *c, struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	t->t_state = S_READY;
+	runqueue_add(c, t);
+
+	if (c->c_isidle && c != curcpu->c_self) {
+		/*
+		 * Other processor is idle; send interrupt to make
+		 * sure it unidles.
+		 */
+		ipi_send(c, IPI_UNIDLE);
+	}
+}
+
 /*
  * Make a thread runnable.
  *
  * targetcpu might be curcpu; it might not be, too.
+ *
+ * A thread coming out of a wait channel is presumed to have been
+ * waiting for I/O (or for some other thread) rather than computing,
+ * so it goes back in at the top priority with a fresh quantum. This
+ * is what keeps the shell and other interactive work ahead of CPU
+ * hogs, which sink to the bottom as they use up their quanta.
+ *
+ * Such a thread is also placed according to thread_wakeupcpu. It may
+ * only be moved once it is completely off its old cpu: holding the
+ * old cpu's run queue lock guarantees it has been switched out,
+ * unless the old cpu went idle on its stack (it is still that cpu's
+ * curthread), in which case it has to go back there.
  */
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
-	struct cpu *targetcpu;
+	struct cpu *targetcpu, *dest;
 
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
@@ -517,23 +1015,63 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
-	/* Target thread is now ready to run; put it on the run queue. */
-	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	if (target->t_state == S_SLEEP) {
+		KASSERT(!already_have_lock);
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+		target->t_priority = 0;
+		target->t_ticksleft = SCHED_QUANTUM(0);
+
+		dest = thread_wakeupcpu(target);
+		if (dest != targetcpu && targetcpu->c_curthread != target) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			target->t_cpu = dest;
+			target->t_migrations++;
+			targetcpu = dest;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
+		if (targetcpu != curcpu->c_self) {
+			target->t_xcpuwakeups++;
+		}
 	}
 
+	/* Target thread is now ready to run; put it on the run queue. */
+	thread_enqueue(targetcpu, target);
+
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
 }
 
+/*
+ * Called at the end of every context switch, in the thread switched
+ * to, with the run queue lock still held. Releases the lock, and
+ * then finds a new cpu for the thread we switched away from if its
+ * affinity didn't allow it to stay here (see thread_switch). That
+ * has to wait until now, when its context has been saved.
+ */
+static
+void
+thread_switch_done(void)
+{
+	struct thread *t;
+	struct cpu *c;
+
+	t = curcpu->c_leaving;
+	curcpu->c_leaving = NULL;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (t == NULL) {
+		return;
+	}
+
+	c = thread_pickcpu(t);
+	t->t_cpu = c;
+	t->t_migrations++;
+	spinlock_acquire(&c->c_runqueue_lock);
+	thread_enqueue(c, t);
+	spinlock_release(&c->c_runqueue_lock);
+}
+
 /*
  * Create a new thread based on an existing one.
  *
@@ -541,8 +1079,9 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller, and so is the cpu affinity
+ * mask. It will start on the same CPU as the caller, unless that's
+ * outside the mask or the scheduler intervenes first.
  */
 int
 thread_fork(const char *name,
@@ -553,25 +1092,22 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	newthread = thread_create_withstack(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
-
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	if ((newthread->t_affinity & CPUBIT(newthread->t_cpu)) == 0) {
+		/* Never run, so it can start anywhere */
+		newthread->t_cpu = thread_pickcpu(newthread);
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -610,25 +1146,22 @@ my_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	newthread = thread_create_withstack(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
-
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
+	if ((newthread->t_affinity & CPUBIT(newthread->t_cpu)) == 0) {
+		/* Never run, so it can start anywhere */
+		newthread->t_cpu = thread_pickcpu(newthread);
+	}
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -771,8 +1304,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. (This
+	 * includes a thread whose affinity excludes this cpu: with
+	 * nothing else to run here it can't get off the cpu yet.)
+	 */
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -783,6 +1320,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		if ((cur->t_affinity & CPUBIT(curcpu)) == 0) {
+			/*
+			 * Not allowed here any more. We know there's
+			 * another thread to switch to (see above), and
+			 * once we have, thread_switch_done moves us.
+			 */
+			KASSERT(curcpu->c_leaving == NULL);
+			curcpu->c_leaving = cur;
+			break;
+		}
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
@@ -795,6 +1342,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		 * caller of wchan_sleep locked it until the thread is
 		 * on the list.
 		 */
+		cur->t_wchan = wc;
 		threadlist_addtail(&wc->wc_threads, cur);
 		spinlock_release(lk);
 		break;
@@ -825,14 +1373,29 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/*
+			 * Before idling, try to steal a thread from a
+			 * busier cpu; we also come back around and
+			 * try again after every interrupt that wakes
+			 * us up. While idle the periodic hardclock is
+			 * turned off (see clock.c), so that's only the
+			 * hardclocks our callouts need, plus wakeups
+			 * and device interrupts; otherwise a busy cpu
+			 * with threads waiting pokes us (see
+			 * schedule()).
+			 */
+			if (!thread_steal()) {
+				hardclock_idle();
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	hardclock_unidle();
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -899,7 +1462,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = S_RUN;
 
 	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	thread_switch_done();
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -932,7 +1495,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_state = S_RUN;
 
 	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	thread_switch_done();
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -987,8 +1550,10 @@ thread_exit(void)
         	lock_release(cur->parent_lk);
         }
 
-	cv_destroy(cur->child_cv);
-	lock_destroy(cur->child_lk);
+	/*
+	 * child_cv and child_lk stay with the thread structure; the
+	 * thread cache destroys them if it ever frees the memory.
+	 */
      
     	/* free thread id and add it back to list of available tids */
     	free_tid(curthread_id);
@@ -1023,22 +1588,153 @@ thread_yield(void)
 	thread_switch(S_READY, NULL, NULL);
 }
 
+/*
+ * Set the current thread's cpu affinity mask. If the current cpu is
+ * no longer allowed, yield so as to move right away; if there's
+ * nothing else here to run we keep the cpu anyway, and move at the
+ * next context switch that has somewhere else to go.
+ */
+int
+thread_setaffinity(unsigned mask)
+{
+	unsigned numcpus, online;
+
+	numcpus = cpuarray_num(&allcpus);
+	online = numcpus >= 32 ? THREAD_AFFINITY_ALL : (1U << numcpus) - 1;
+	if ((mask & online) == 0) {
+		return EINVAL;
+	}
+
+	curthread->t_affinity = mask;
+	if ((mask & CPUBIT(curcpu)) == 0) {
+		thread_yield();
+	}
+	return 0;
+}
+
+unsigned
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multilevel feedback queue. Each cpu has SCHED_NPRIO run
+ * queues, and thread_switch always takes the first thread from the
+ * highest-priority nonempty one. Threads start at the top; a thread
+ * that uses its whole quantum drops a level (thread_tick) and one
+ * that goes to sleep comes back at the top (thread_make_runnable).
+ * Lower levels get longer quanta, so CPU-bound threads switch less.
+ *
+ * thread_tick is called from hardclock() on every tick. It charges
+ * the current thread, and preempts it either when its quantum runs
+ * out or when a higher-priority thread is waiting, so a woken
+ * interactive thread waits at most one tick behind a CPU hog.
  */
+void
+thread_tick(void)
+{
+	struct thread *cur;
+	bool preempt;
+	unsigned i;
+
+	cur = curthread;
 
+	/*
+	 * If we're idle, curthread is whatever went to sleep last and
+	 * isn't actually running. Don't charge it.
+	 */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	KASSERT(cur->t_ticksleft > 0);
+	cur->t_ticksleft--;
+	if (cur->t_ticksleft == 0) {
+		if (cur->t_priority < SCHED_NPRIO - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticksleft = SCHED_QUANTUM(cur->t_priority);
+		thread_yield();
+		return;
+	}
+
+	preempt = false;
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=0; i<cur->t_priority; i++) {
+		if (!threadlist_isempty(&curcpu->c_runqueues[i])) {
+			preempt = true;
+			break;
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		/* Goes back in at its own level with the quantum it has left */
+		thread_yield();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). It ages the current
+ * CPU's run queues: any thread that has been waiting on a queue for
+ * SCHED_AGE_HARDCLOCKS or more moves up one level. Each queue is in
+ * order of arrival, so only the heads need looking at. Without this
+ * a steady supply of interactive threads could starve the bottom
+ * level forever.
+ *
+ * Idle cpus don't tick (see clock.c), so they don't come looking for
+ * work to steal by themselves; if we have threads waiting, this also
+ * wakes one of them up to do it.
+ */
 void
 schedule(void)
 {
+	struct threadlist *from, *to;
+	struct thread *t;
+	struct cpu *c;
+	unsigned now, i, numcpus;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	now = curcpu->c_hardclocks;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Go from the top down so a thread moves at most one level
+	 * per call. Its t_enqueued is restamped, so it then has to
+	 * wait its turn again at the new level.
 	 */
+	for (i=1; i<SCHED_NPRIO; i++) {
+		from = &curcpu->c_runqueues[i];
+		to = &curcpu->c_runqueues[i-1];
+		while ((t = threadlist_remhead(from)) != NULL) {
+			if (now - t->t_enqueued < SCHED_AGE_HARDCLOCKS) {
+				threadlist_addhead(from, t);
+				break;
+			}
+			t->t_priority = i - 1;
+			t->t_ticksleft = SCHED_QUANTUM(i - 1);
+			t->t_enqueued = now;
+			threadlist_addtail(to, t);
+		}
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (curcpu->c_runcount == 0) {
+		return;
+	}
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			break;
+		}
+	}
 }
 
 /*
@@ -1057,6 +1753,12 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * Idle cpus pull work for themselves (see thread_steal), so this push
+ * is only a fallback: it evens out cpus that are all busy but
+ * unequally loaded, which stealing never sees. It counts threads
+ * using the unlocked c_runcount hints rather than locking every run
+ * queue.
  */
 void
 thread_consider_migration(void)
@@ -1071,12 +1773,10 @@ thread_consider_migration(void)
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		total_count += c->c_runcount;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runcount;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -1088,7 +1788,12 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu);
+		if (t == NULL) {
+			/* Someone else got there first */
+			to_send = i;
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -1099,7 +1804,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_runcount < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -1129,8 +1834,16 @@ thread_consider_migration(void)
 				continue;
 			}
 
+			/* Likewise skip threads not allowed on C. */
+			if ((t->t_affinity & CPUBIT(c)) == 0) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
+
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_migrations++;
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -1154,7 +1867,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1192,6 +1905,16 @@ wchan_create(const char *name)
 	return wc;
 }
 
+/*
+ * Rename a wait channel.
+ */
+void
+wchan_setname(struct wchan *wc, const char *name)
+{
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	wc->wc_name = name;
+}
+
 /*
  * Destroy a wait channel. Must be empty and unlocked.
  * (The corresponding cleanup functions require this.)
@@ -1226,6 +1949,99 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * Timed sleep support. The callout takes the sleeping thread off the
+ * wait channel if nobody else has yet; both happen under the wchan's
+ * spinlock, so exactly one of the two gets to wake it. Whoever takes
+ * a thread off a wchan clears its t_wchan, so the callout can tell
+ * without searching the channel.
+ */
+struct wchan_timeout {
+	struct callout wt_callout;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	struct thread *wt_thread;
+	bool wt_timedout;
+};
+
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *t = wt->wt_thread;
+
+	spinlock_acquire(wt->wt_lock);
+	if (t->t_wchan == wt->wt_wchan) {
+		threadlist_remove(&wt->wt_wchan->wc_threads, t);
+		t->t_wchan = NULL;
+		wt->wt_timedout = true;
+		thread_make_runnable(t, false);
+	}
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up after TICKS hardclocks. Returns true
+ * if woken by wchan_wake*, false if the time ran out.
+ */
+bool
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, unsigned ticks)
+{
+	struct wchan_timeout wt;
+
+	/* may not sleep in an interrupt handler */
+	KASSERT(!curthread->t_in_interrupt);
+
+	/* must hold the spinlock */
+	KASSERT(spinlock_do_i_hold(lk));
+
+	/* must not hold other spinlocks */
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	callout_init(&wt.wt_callout, wchan_timeout, &wt);
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_thread = curthread;
+	wt.wt_timedout = false;
+
+	/*
+	 * Schedule before going to sleep; the callout can't do
+	 * anything until we're on the wchan and LK is released.
+	 * Cancel before relocking LK, because the callout may be
+	 * running and waiting for LK.
+	 */
+	callout_schedule(&wt.wt_callout, ticks);
+	thread_switch(S_SLEEP, wc, lk);
+	callout_cancel(&wt.wt_callout);
+
+	spinlock_acquire(lk);
+	return !wt.wt_timedout;
+}
+
+/*
+ * Sleep for TICKS hardclocks. Nothing but the timeout will wake us,
+ * so rather than sharing a wait channel with every other sleeper,
+ * use one of our own on the stack.
+ */
+void
+thread_sleep_ticks(unsigned ticks)
+{
+	struct wchan wc;
+	struct spinlock lk;
+
+	wc.wc_name = "sleep";
+	threadlist_init(&wc.wc_threads);
+	spinlock_init(&lk);
+
+	spinlock_acquire(&lk);
+	wchan_sleep_timeout(&wc, &lk, ticks);
+	spinlock_release(&lk);
+
+	spinlock_cleanup(&lk);
+	threadlist_cleanup(&wc.wc_threads);
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1243,6 +2059,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_wchan = NULL;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1273,6 +2090,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 
@@ -1341,39 +2159,105 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Queue a TLB shootdown on TARGET. Must hold TARGET's ipi lock.
+ *
+ * Requests that arrive while an earlier one is still pending ride
+ * along on the interrupt already sent, and if the queue fills up it
+ * is collapsed into a request to flush the whole TLB.
  */
+static
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_tlbshootdown_queue(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	unsigned n;
 
-	spinlock_acquire(&target->c_ipi_lock);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+	if (n == TLBSHOOTDOWN_ALL) {
+		/* Already flushing everything. */
+	}
+	else if (n == TLBSHOOTDOWN_MAX) {
+		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	if ((target->c_ipi_pending & ((uint32_t)1 << IPI_TLBSHOOTDOWN)) == 0) {
+		target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+		mainbus_send_ipi(target);
+	}
+}
 
+/*
+ * Send a TLB shootdown IPI to the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	ipi_tlbshootdown_queue(target, mapping);
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Queue a batch of shootdowns on TARGET, if it might have mappings of
+ * AS, and hand back a ticket to wait on.
+ */
+bool
+ipi_tlbshootdown_batch(struct cpu *target, const struct addrspace *as,
+		       const struct tlbshootdown *mappings, unsigned n,
+		       unsigned *ticket)
+{
+	unsigned i;
+
+	spinlock_acquire(&target->c_ipi_lock);
+	if (as != NULL && target->c_tlbas != as) {
+		spinlock_release(&target->c_ipi_lock);
+		return false;
+	}
+	for (i=0; i<n; i++) {
+		ipi_tlbshootdown_queue(target, &mappings[i]);
+	}
+	/* Everything queued now is done in the next batch. */
+	*ticket = target->c_shootdown_done + 1;
+	spinlock_release(&target->c_ipi_lock);
+	return true;
+}
+
+/*
+ * Wait until TARGET has finished the batch named by TICKET.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	KASSERT(target != curcpu->c_self);
+	KASSERT(curcpu->c_spinlocks == 0);
+	KASSERT(curthread->t_curspl == 0);
+
+	/* (int) cast for wraparound */
+	while ((int)(target->c_shootdown_done - ticket) < 0) {
+		/* spin */
+	}
+	membar_load_load();
+}
+
+/*
+ * Record the address space whose mappings the current cpu's TLB now
+ * holds.
+ */
+void
+ipi_tlbshootdown_setas(const struct addrspace *as)
+{
+	struct cpu *c = curcpu->c_self;
+
+	spinlock_acquire(&c->c_ipi_lock);
+	c->c_tlbas = as;
+	spinlock_release(&c->c_ipi_lock);
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1415,10 +2299,17 @@ interprocessor_interrupt(void)
 		 * need to release the ipi lock while calling
 		 * vm_tlbshootdown.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
+			vm_tlbshootdown_all();
+		}
+		else {
+			for (i=0; i<curcpu->c_numshootdown; i++) {
+				vm_tlbshootdown(&curcpu->c_shootdown[i]);
+			}
 		}
 		curcpu->c_numshootdown = 0;
+		membar_store_store();
+		curcpu->c_shootdown_done++;
 	}
 
 	curcpu->c_ipi_pending = 0;
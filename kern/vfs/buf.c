@@ -36,8 +36,11 @@
 #include <current.h>
 #include <synch.h>
 #include <mainbus.h>
+#include <vm.h>
 #include <vfs.h>
 #include <fs.h>
+#include <kmemcache.h>
+#include <shrinker.h>
 #include <buf.h>
 
 /* Uncomment this to enable printouts of the syncer state. */
@@ -91,6 +94,7 @@ struct buf {
 	unsigned b_dirty:1;	/* data needs to be written to disk */
 	unsigned b_fsmanaged:1;	/* managed by file system */
 	struct thread *b_holder; /* who did buffer_mark_busy() */
+	unsigned b_waiters;	/* threads waiting in buffer_mark_busy() */
 	struct timespec b_timestamp; /* when it became dirty */
 
 	/* key */
@@ -199,6 +203,12 @@ static struct lock *buffer_lock;
  */
 static struct cv *buffer_busy_cv;
 static struct cv *buffer_reserve_cv;
+static struct cv *syncer_cv;
+
+/*
+ * Object cache for struct buf. A cached buffer keeps its data block.
+ */
+static struct kmem_cache *buffer_cache;
 
 /*
  * Magic numbers (also search the code for "voodoo:")
@@ -237,11 +247,14 @@ static struct cv *buffer_reserve_cv;
 /* Buffer age at which the syncer considers itself in trouble. (seconds) */
 #define SYNCER_HELP_AGE		8
 
-#if 0
+/* How long the syncer sleeps between runs if nobody prods it. (nsecs) */
+#define SYNCER_PERIOD		250000000
+
 /* Threshold proportion (of bufs dirty) for starting the syncer */
 #define SYNCER_DIRTY_NUM	1
 #define SYNCER_DIRTY_DENOM	2
 
+#if 0
 /* Target proportion (of total bufs) for syncer to clean in one run */
 #define SYNCER_TARGET_NUM	1
 #define SYNCER_TARGET_DENOM	4
@@ -714,6 +727,32 @@ buffer_insert_dirty(struct buf *b)
 ////////////////////////////////////////////////////////////
 // ops on buffers
 
+/*
+ * Cache constructor and destructor for buffers: allocate and free the
+ * data block.
+ */
+static
+int
+buffer_ctor(void *obj)
+{
+	struct buf *b = obj;
+
+	b->b_data = kmalloc(ONE_TRUE_BUFFER_SIZE);
+	if (b->b_data == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+buffer_dtor(void *obj)
+{
+	struct buf *b = obj;
+
+	kfree(b->b_data);
+}
+
 /*
  * Create a fresh buffer.
  */
@@ -729,17 +768,12 @@ buffer_create(void)
 		return NULL;
 	}
 
-	b = kmalloc(sizeof(*b));
+	/* comes with b_data already allocated */
+	b = kmem_cache_alloc(buffer_cache);
 	if (b == NULL) {
 		return NULL;
 	}
 
-	b->b_data = kmalloc(ONE_TRUE_BUFFER_SIZE);
-	if (b->b_data == NULL) {
-		kfree(b);
-		return NULL;
-	}
-
 	b->b_tableindex = INVALID_INDEX;
 	b->b_dirtyindex = INVALID_INDEX;
 	b->b_bucketindex = INVALID_INDEX;
@@ -750,6 +784,7 @@ buffer_create(void)
 	b->b_dirty = 0;
 	b->b_fsmanaged = 0;
 	b->b_holder = NULL;
+	b->b_waiters = 0;
 	b->b_timestamp.tv_sec = 0;
 	b->b_timestamp.tv_nsec = 0;
 	b->b_fs = NULL;
@@ -760,6 +795,24 @@ buffer_create(void)
 	return b;
 }
 
+/*
+ * Destroy a detached buffer. Nobody may be waiting for it in
+ * buffer_mark_busy; they'd wake up on freed memory.
+ */
+static
+void
+buffer_destroy(struct buf *b)
+{
+	KASSERT(b->b_attached == 0);
+	KASSERT(b->b_busy == 0);
+	KASSERT(b->b_waiters == 0);
+	KASSERT(b->b_tableindex == INVALID_INDEX);
+	KASSERT(num_total_buffers > 0);
+
+	num_total_buffers--;
+	kmem_cache_free(buffer_cache, b);
+}
+
 /*
  * Attach a buffer to a given key (fs and block number)
  */
@@ -834,7 +887,9 @@ buffer_mark_busy(struct buf *b)
 		    block != b->b_physblock) {
 			return EDEADBUF;
 		}
+		b->b_waiters++;
 		cv_wait(buffer_busy_cv, buffer_lock);
+		b->b_waiters--;
 	}
 	if (!b->b_attached || fs != b->b_fs || block != b->b_physblock) {
 		return EDEADBUF;
@@ -1005,7 +1060,10 @@ buffer_mark_dirty(struct buf *b)
 
 	buffer_insert_dirty(b);
 	dirty_buffers_count++;
-	/* Here we might prod the syncer, but currently it doesn't need it */
+	if (dirty_buffers_count == SCALE(max_total_buffers, SYNCER_DIRTY)) {
+		/* Getting full; don't wait for the syncer's next run */
+		cv_signal(syncer_cv, buffer_lock);
+	}
 	lock_release(buffer_lock);
 }
 
@@ -1243,6 +1301,86 @@ buffer_evict(struct buf **ret)
 	return 0;
 }
 
+/*
+ * Shrinker callback: give back up to NPAGES pages of buffer memory.
+ *
+ * Only detached buffers are destroyed, and only ones nobody is still
+ * waiting for in buffer_mark_busy (a buffer that was just detached
+ * can have sleepers who haven't woken up yet to notice). If there
+ * aren't enough, clean idle attached buffers, oldest first, onto the
+ * detached list for a later call to free; dirty buffers are left for
+ * the syncer. The buffers' memory goes back to kmalloc, so drain the
+ * heap afterwards to turn it into free pages, and report those.
+ *
+ * If this thread holds the buffer lock already (the allocation came
+ * from inside the buffer cache) there's nothing we can safely do.
+ */
+static
+unsigned
+buffer_shrink(unsigned npages)
+{
+	unsigned want, freed, cleaned, i;
+	struct buf *b, *last;
+
+	if (lock_do_i_hold(buffer_lock)) {
+		return 0;
+	}
+
+	want = npages * (PAGE_SIZE / ONE_TRUE_BUFFER_SIZE);
+	freed = 0;
+
+	lock_acquire(buffer_lock);
+	bufcheck();
+
+	i = bufarray_num(&detached_buffers);
+	while (freed < want && i-- > 0) {
+		b = bufarray_get(&detached_buffers, i);
+		if (b->b_waiters > 0) {
+			continue;
+		}
+		/* Fill the hole with the last one, which we've seen already */
+		last = buffer_remove_detached();
+		if (last != b) {
+			bufarray_set(&detached_buffers, i, last);
+			last->b_tableindex = i;
+			b->b_tableindex = INVALID_INDEX;
+		}
+		buffer_destroy(b);
+		freed++;
+	}
+
+	/*
+	 * buffer_clean releases the lock, and the table can be
+	 * compacted meanwhile, so start over from the front after
+	 * each one.
+	 */
+	cleaned = 0;
+	i = 0;
+	while (freed + cleaned < want && i < bufarray_num(&attached_buffers)) {
+		b = bufarray_get(&attached_buffers, i);
+		if (b == NULL || b->b_busy || b->b_dirty) {
+			i++;
+			continue;
+		}
+		/* fsmanaged buffers are always busy */
+		KASSERT(b->b_fsmanaged == 0);
+
+		num_total_evictions++;
+		buffer_clean(b);
+		buffer_insert_detached(b);
+		cleaned++;
+		i = 0;
+	}
+
+	lock_release(buffer_lock);
+
+	if (freed == 0) {
+		return 0;
+	}
+	kmem_cache_reap(buffer_cache);
+	return kheap_drain();
+}
+
 static
 struct buf *
 buffer_find(struct fs *fs, daddr_t physblock)
@@ -2050,10 +2188,9 @@ sync_old_buffers(void)
 }
 
 /*
- * If OS/161 had a more powerful clock system, we might arrange to run
- * the syncer either when enough buffers become dirty or every second
- * or two when dirty buffers exist. But we don't really have the
- * facilities for that, so instead we'll just run once a second.
+ * The syncer runs every SYNCER_PERIOD, or straight away when the
+ * proportion of dirty buffers reaches SYNCER_DIRTY (see
+ * buffer_mark_dirty).
  */
 static
 void
@@ -2071,9 +2208,7 @@ syncer(void *x1, unsigned long x2)
 	old_finished = true;
 	while (1) {
 		if (lru_finished && old_finished) {
-			lock_release(buffer_lock);
-			clocksleep(1);
-			lock_acquire(buffer_lock);
+			cv_timedwait(syncer_cv, buffer_lock, SYNCER_PERIOD);
 		}
 
 		if (syncer_needs_help) {
@@ -2263,11 +2398,23 @@ buffer_bootstrap(void)
 		panic("Creating buffer_hash failed\n");
 	}
 
+	buffer_cache = kmem_cache_create("buf", sizeof(struct buf),
+					 buffer_ctor, buffer_dtor);
+	if (buffer_cache == NULL) {
+		panic("Creating buffer object cache failed\n");
+	}
+
 	buffer_lock = lock_create("buffer cache lock");
 	if (buffer_lock == NULL) {
 		panic("Creating buffer cache lock failed\n");
 	}
 
+	result = shrinker_register("buffers", SHRINK_PRIO_CACHE,
+				   buffer_shrink);
+	if (result) {
+		panic("Registering buffer cache shrinker failed\n");
+	}
+
 	buffer_busy_cv = cv_create("bufbusy");
 	if (buffer_busy_cv == NULL) {
 		panic("Creating buffer_busy_cv failed\n");
@@ -2278,6 +2425,11 @@ buffer_bootstrap(void)
 		panic("Creating buffer_reserve_cv failed\n");
 	}
 
+	syncer_cv = cv_create("syncer");
+	if (syncer_cv == NULL) {
+		panic("Creating syncer_cv failed\n");
+	}
+
 	result = thread_fork("syncer", NULL, syncer, NULL, 0);
 	if (result) {
 		panic("Starting syncer failed\n");
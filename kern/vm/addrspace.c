@@ -27,18 +27,42 @@
  * SUCH DAMAGE.
  */
 
+#define ADDRSPACEINLINE
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
 #include <proc.h>
+#include <cpu.h>
+#include <vnode.h>
+#include <pagecache.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
+ *
+ * Pages are not allocated when regions are defined; vm_fault fills
+ * them in one at a time when they are first touched, from the
+ * backing file if the region has one and with zeros otherwise.
+ *
+ * Resident pages can be taken away by the pageout daemon at any
+ * time, so code here that looks at a resident page pins its frame
+ * first (see coremap.h).
+ */
+
+/*
+ * Default limit on the size of the user stack, in pages. Only pages
+ * that are touched take up memory. Settable from the menu.
  */
+#define VM_STACKMAXPAGES	1024
+
+size_t as_stacklimit = VM_STACKMAXPAGES;
 
 struct addrspace *
 as_create(void)
@@ -50,28 +74,175 @@ as_create(void)
 		return NULL;
 	}
 
-	/*
-	 * Initialize as needed.
-	 */
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	regionarray_init(&as->as_regions);
+	as->as_stack = NULL;
+	as->as_stackmax = as_stacklimit;
+	as->as_loading = false;
+	bzero(&as->as_stats, sizeof(as->as_stats));
 
 	return as;
 }
 
+/*
+ * Add a region to an address space.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t vbase, size_t npages,
+	     bool readable, bool writeable, bool executable)
+{
+	struct region *rg;
+	int result;
+
+	rg = kmalloc(sizeof(*rg));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vbase;
+	rg->rg_npages = npages;
+	rg->rg_readable = readable;
+	rg->rg_writeable = writeable;
+	rg->rg_executable = executable;
+	rg->rg_vnode = NULL;
+	rg->rg_fileoffset = 0;
+	rg->rg_filevaddr = vbase;
+	rg->rg_filesize = 0;
+	rg->rg_cached = false;
+	rg->rg_mmap = false;
+
+	result = regionarray_add(&as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * Attach a backing file to a region.
+ */
+static
+void
+as_setfile(struct region *rg, struct vnode *v, off_t offset,
+	   vaddr_t vaddr, size_t filesize)
+{
+	KASSERT(rg->rg_vnode == NULL);
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_fileoffset = offset;
+	rg->rg_filevaddr = vaddr;
+	rg->rg_filesize = filesize;
+}
+
+/*
+ * Copy an address space. Resident pages are not copied: the new
+ * address space maps the same frames, and both sides are marked
+ * copy-on-write so the first write to a page by either one gets a
+ * private copy (see vm_fault). Untouched pages stay untouched.
+ */
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	unsigned i, j;
+	pte_t *oldl2, *newpte;
+	paddr_t paddr;
+	vaddr_t va;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
+	newas->as_stackmax = old->as_stackmax;
+
+	for (i=0; i<regionarray_num(&old->as_regions); i++) {
+		rg = regionarray_get(&old->as_regions, i);
+		result = as_addregion(newas, rg->rg_vbase, rg->rg_npages,
+				      rg->rg_readable, rg->rg_writeable,
+				      rg->rg_executable);
+		if (result) {
+			as_destroy(newas);
+			return result;
+		}
+		newrg = regionarray_get(&newas->as_regions, i);
+		if (rg == old->as_stack) {
+			newas->as_stack = newrg;
+		}
+		if (rg->rg_vnode != NULL) {
+			as_setfile(newrg, rg->rg_vnode, rg->rg_fileoffset,
+				   rg->rg_filevaddr, rg->rg_filesize);
+			newrg->rg_cached = rg->rg_cached;
+			newrg->rg_mmap = rg->rg_mmap;
+		}
+	}
+
+	for (i=0; i<PT_L1SIZE; i++) {
+		oldl2 = old->as_pt->pt_l2[i];
+		if (oldl2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2SIZE; j++) {
+			if (oldl2[j] == 0) {
+				continue;
+			}
+			va = PT_VADDR(i, j);
+			newpte = pt_lookup(newas->as_pt, va, true);
+			if (newpte == NULL) {
+				as_destroy(newas);
+				return ENOMEM;
+			}
+
+			/* Pin the frame so it can't be paged out under us. */
+			paddr = 0;
+			while (PTE_ISVALID(oldl2[j])) {
+				paddr = PTE_PADDR(oldl2[j]);
+				if (coremap_pin(paddr, &oldl2[j])) {
+					break;
+				}
+			}
+
+			if (PTE_ISVALID(oldl2[j]) && PTE_ISFILE(oldl2[j])) {
+				/* Read-only; just another mapping. */
+				if (pagecache_share(paddr, newas, va)) {
+					coremap_unpin(paddr);
+					as_destroy(newas);
+					return ENOMEM;
+				}
+				*newpte = oldl2[j];
+				coremap_unpin(paddr);
+			}
+			else if (PTE_ISVALID(oldl2[j])) {
+				coremap_share(paddr);
+				oldl2[j] |= PTE_COW;
+				*newpte = oldl2[j];
+				coremap_unpin(paddr);
+			}
+			else if (PTE_ISSWAPPED(oldl2[j])) {
+				swap_share(PTE_SWAPSLOT(oldl2[j]));
+				*newpte = oldl2[j];
+			}
+			else {
+				/* The page cache dropped it while we waited. */
+				KASSERT(oldl2[j] == 0);
+			}
+		}
+	}
 
 	/*
-	 * Write this.
+	 * The old address space is normally the one we're running in
+	 * and its pages may be in our TLB as writeable. Drop them so
+	 * its next write to each page faults.
 	 */
-
-	(void)old;
+	if (old == proc_getas()) {
+		vm_tlbflush();
+	}
 
 	*ret = newas;
 	return 0;
@@ -80,9 +251,51 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	unsigned i, j, num;
+	pte_t *l2;
+	paddr_t paddr;
+	struct region *rg;
+
+	/* Release all resident pages. */
+	for (i=0; i<PT_L1SIZE; i++) {
+		l2 = as->as_pt->pt_l2[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j=0; j<PT_L2SIZE; j++) {
+			/* Wait out the pageout daemon, if it has the page. */
+			while (PTE_ISVALID(l2[j])) {
+				paddr = PTE_PADDR(l2[j]);
+				if (!coremap_pin(paddr, &l2[j])) {
+					continue;
+				}
+				if (PTE_ISFILE(l2[j])) {
+					pagecache_release(paddr, as,
+							  PT_VADDR(i, j));
+				}
+				else {
+					coremap_freeuser(paddr);
+				}
+				break;
+			}
+			if (PTE_ISSWAPPED(l2[j])) {
+				swap_free(PTE_SWAPSLOT(l2[j]));
+			}
+			l2[j] = 0;
+		}
+	}
+	pt_destroy(as->as_pt);
+
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
+	regionarray_setsize(&as->as_regions, 0);
+	regionarray_cleanup(&as->as_regions);
 
 	kfree(as);
 }
@@ -102,17 +315,19 @@ as_activate(void)
 	}
 
 	/*
-	 * Write this.
+	 * No ASIDs; just flush the TLB. Note that this cpu now holds
+	 * mappings of this address space, so shootdowns find it.
 	 */
+	ipi_tlbshootdown_setas(as);
+	vm_tlbflush();
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do; as_activate flushes the TLB when the next
+	 * address space is activated.
 	 */
 }
 
@@ -122,61 +337,365 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Writes
+ * to a region that is not writeable fault (except while loading).
+ * MIPS cannot enforce read or execute permission separately, so
+ * those are only recorded.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 		 int readable, int writeable, int executable)
 {
+	size_t npages;
+	vaddr_t top;
+	struct region *rg;
+	unsigned i;
+
+	/* Align the region. First, the base... */
+	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = memsize / PAGE_SIZE;
+	top = vaddr + memsize;
+
+	if (npages == 0 || top > USERSPACETOP || top < vaddr) {
+		return EFAULT;
+	}
+
+	/* Regions may not overlap. */
+	for (i=0; i<regionarray_num(&as->as_regions); i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_vbase < top) {
+			return EINVAL;
+		}
+	}
+
+	return as_addregion(as, vaddr, npages,
+			    readable != 0, writeable != 0, executable != 0);
+}
+
+/*
+ * Set up a segment as with as_define_region, whose first FILESIZE
+ * bytes starting at VADDR are the contents of V at OFFSET. Nothing
+ * is read now; vm_fault reads each page when it is first touched.
+ * FILESIZE may be less than MEMSIZE, in which case the rest of the
+ * segment is zero-filled.
+ */
+int
+as_define_fileregion(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+		     struct vnode *v, off_t offset, size_t filesize,
+		     int readable, int writeable, int executable)
+{
+	struct region *rg;
+	int result;
+
+	KASSERT(filesize <= memsize);
+
+	result = as_define_region(as, vaddr, memsize,
+				  readable, writeable, executable);
+	if (result) {
+		return result;
+	}
+	if (filesize == 0) {
+		return 0;
+	}
+
+	/* as_define_region appends the new region. */
+	rg = regionarray_get(&as->as_regions,
+			     regionarray_num(&as->as_regions) - 1);
+	as_setfile(rg, v, offset, vaddr, filesize);
+
 	/*
-	 * Write this.
+	 * Share its pages if it's read-only and every page is an
+	 * exact page of the file.
 	 */
+	rg->rg_cached = !writeable && filesize == memsize &&
+		offset % PAGE_SIZE == vaddr % PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Find room for NPAGES pages between the other regions, as high up as
+ * possible below where the stack can grow to.
+ */
+static
+int
+as_findgap(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+	struct region *rg;
+	vaddr_t vaddr, top;
+	size_t size;
+	unsigned i, num;
+	bool moved;
+
+	size = npages * PAGE_SIZE;
+	top = USERSTACK - as->as_stackmax * PAGE_SIZE;
+	if (size > top - PAGE_SIZE) {
+		return ENOMEM;
+	}
+	vaddr = top - size;
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+	num = regionarray_num(&as->as_regions);
+	do {
+		moved = false;
+		for (i=0; i<num; i++) {
+			rg = regionarray_get(&as->as_regions, i);
+			if (rg == as->as_stack ||
+			    vaddr >= rg->rg_vbase + rg->rg_npages * PAGE_SIZE ||
+			    rg->rg_vbase >= vaddr + size) {
+				continue;
+			}
+			/* Overlaps; try just below it. */
+			if (rg->rg_vbase < size + PAGE_SIZE) {
+				return ENOMEM;
+			}
+			vaddr = rg->rg_vbase - size;
+			moved = true;
+		}
+	} while (moved);
+
+	*ret = vaddr;
+	return 0;
+}
+
+/*
+ * Map LEN bytes of V starting at OFFSET, which must be page-aligned,
+ * somewhere in AS, writeable or not. Pages come from the page cache
+ * and are shared with everybody else who has them mapped; writes go
+ * back to the file when the last mapping goes. The address chosen is
+ * returned in *RET.
+ *
+ * The caller is responsible for checking that V was opened in a way
+ * that allows the mapping.
+ */
+int
+as_mmap(struct addrspace *as, struct vnode *v, off_t offset, size_t len,
+	bool writeable, vaddr_t *ret)
+{
+	struct region *rg;
+	size_t npages;
+	vaddr_t vaddr;
+	int result;
+
+	if (len == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (npages == 0) {
+		/* len + PAGE_SIZE - 1 overflowed */
+		return ENOMEM;
+	}
+
+	result = VOP_MMAP(v);
+	if (result) {
+		return result;
+	}
+
+	result = as_findgap(as, npages, &vaddr);
+	if (result) {
+		return result;
+	}
+	result = as_addregion(as, vaddr, npages, true, writeable, false);
+	if (result) {
+		return result;
+	}
+	rg = regionarray_get(&as->as_regions,
+			     regionarray_num(&as->as_regions) - 1);
+	as_setfile(rg, v, offset, vaddr, npages * PAGE_SIZE);
+	rg->rg_cached = true;
+	rg->rg_mmap = true;
+
+	DEBUG(DB_VM, "vm: mapped %lu pages at 0x%x\n",
+	      (unsigned long) npages, vaddr);
+
+	*ret = vaddr;
+	return 0;
+}
+
+/*
+ * Take the N pinned page cache frames PADDRS, whose page table entries
+ * for VADDRS in AS have been cleared, out of the TLBs and drop them.
+ */
+static
+void
+as_unmappages(struct addrspace *as, const vaddr_t *vaddrs,
+	      const paddr_t *paddrs, unsigned n)
+{
+	unsigned i;
+
+	vm_tlbshootdown_pages(as, vaddrs, n);
+	for (i=0; i<n; i++) {
+		pagecache_release(paddrs[i], as, vaddrs[i]);
+	}
+}
+
+/*
+ * Undo as_mmap. VADDR and LEN must describe a whole mapping.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t vaddrs[TLBSHOOTDOWN_MAX];
+	paddr_t paddrs[TLBSHOOTDOWN_MAX];
+	vaddr_t va, top;
+	pte_t *pte;
+	unsigned i, num, n;
+
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (rg->rg_vbase == vaddr) {
+			break;
+		}
+	}
+	if (i == num || !rg->rg_mmap ||
+	    (len + PAGE_SIZE - 1) / PAGE_SIZE != rg->rg_npages) {
+		return EINVAL;
+	}
+
+	n = 0;
+	top = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	for (va = rg->rg_vbase; va < top; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			continue;
+		}
+		while (PTE_ISVALID(*pte)) {
+			if (coremap_pin(PTE_PADDR(*pte), pte)) {
+				KASSERT(PTE_ISFILE(*pte));
+				vaddrs[n] = va;
+				paddrs[n] = PTE_PADDR(*pte);
+				n++;
+				break;
+			}
+		}
+		*pte = 0;
+		if (n == TLBSHOOTDOWN_MAX) {
+			as_unmappages(as, vaddrs, paddrs, n);
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		as_unmappages(as, vaddrs, paddrs, n);
+	}
+
+	DEBUG(DB_VM, "vm: unmapped %lu pages at 0x%x\n",
+	      (unsigned long) rg->rg_npages, vaddr);
+
+	regionarray_remove(&as->as_regions, i);
+	VOP_DECREF(rg->rg_vnode);
+	kfree(rg);
+	return 0;
+}
+
+/*
+ * Look up the region containing VADDR.
+ */
+struct region *
+as_findregion(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i, num;
+
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Grow the stack down to cover VADDR, if VADDR is within the stack
+ * size limit and no other region is in the way.
+ */
+struct region *
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack, *rg;
+	vaddr_t bottom;
+	unsigned i, num;
+
+	stack = as->as_stack;
+	if (stack == NULL) {
+		return NULL;
+	}
+	bottom = USERSTACK - as->as_stackmax * PAGE_SIZE;
+	vaddr &= PAGE_FRAME;
+	if (vaddr >= stack->rg_vbase || vaddr < bottom) {
+		return NULL;
+	}
+
+	num = regionarray_num(&as->as_regions);
+	for (i=0; i<num; i++) {
+		rg = regionarray_get(&as->as_regions, i);
+		if (rg != stack &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE &&
+		    rg->rg_vbase < stack->rg_vbase) {
+			return NULL;
+		}
+	}
+
+	DEBUG(DB_VM, "vm: stack grows to 0x%x\n", vaddr);
+	stack->rg_npages += (stack->rg_vbase - vaddr) / PAGE_SIZE;
+	stack->rg_vbase = vaddr;
+	return stack;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Nothing is allocated here. While loading, let the kernel
+	 * write into read-only segments; vm_fault honors this.
 	 */
-
-	(void)as;
+	as->as_loading = true;
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
+	as->as_loading = false;
+
 	/*
-	 * Write this.
+	 * Pages of read-only segments may have been entered in the TLB
+	 * as writeable during loading. Get rid of them.
 	 */
-
-	(void)as;
+	vm_tlbflush();
 	return 0;
 }
 
+/*
+ * The stack starts out as a single page just below USERSTACK. Pages
+ * are filled in as they're touched, like any other region's, and
+ * faults below the stack grow it (see as_growstack).
+ */
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+	int result;
+
+	KASSERT(as->as_stack == NULL);
 
-	(void)as;
+	result = as_define_region(as, USERSTACK - PAGE_SIZE, PAGE_SIZE,
+				  1, 1, 0);
+	if (result) {
+		return result;
+	}
+	as->as_stack = regionarray_get(&as->as_regions,
+				       regionarray_num(&as->as_regions) - 1);
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
 	return 0;
 }
-
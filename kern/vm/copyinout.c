@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <setjmp.h>
+#include <uio.h>
 #include <thread.h>
 #include <current.h>
 #include <vm.h>
@@ -84,6 +85,10 @@
  * To make use of this code, in addition to tm_badfaultfunc the
  * thread_machdep structure should contain a jmp_buf called
  * "tm_copyjmp".
+ *
+ * Because setjmp is not free, the actual copying is done a word at a
+ * time where the alignment allows, and copyuio sets up the recovery
+ * once for a whole uio rather than once per iovec.
  */
 
 /*
@@ -142,6 +147,94 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Copy LEN bytes from SRC to DEST, which must not overlap. If the two
+ * pointers are aligned the same way relative to a word, copy bytes up
+ * to a word boundary, then whole words, four at a time while there
+ * are enough, then the leftover bytes. Otherwise there is nothing for
+ * it but to go a byte at a time.
+ *
+ * This is memcpy, but we want it to stay fast for the unaligned-head
+ * case that user buffers hit all the time, and to be sure of what it
+ * touches: nothing outside the two ranges.
+ */
+static
+void
+copyblock(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+	long *wd;
+	const long *ws;
+
+	if (len >= 2*sizeof(long) &&
+	    ((uintptr_t)d - (uintptr_t)s) % sizeof(long) == 0) {
+		while ((uintptr_t)d % sizeof(long) != 0) {
+			*d++ = *s++;
+			len--;
+		}
+		wd = (long *)d;
+		ws = (const long *)s;
+		while (len >= 4*sizeof(long)) {
+			wd[0] = ws[0];
+			wd[1] = ws[1];
+			wd[2] = ws[2];
+			wd[3] = ws[3];
+			wd += 4;
+			ws += 4;
+			len -= 4*sizeof(long);
+		}
+		while (len >= sizeof(long)) {
+			*wd++ = *ws++;
+			len -= sizeof(long);
+		}
+		d = (char *)wd;
+		s = (const char *)ws;
+	}
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
+/*
+ * True if any byte of the word W is zero. (Subtracting 1 from each
+ * byte only borrows out of the top bit of a byte that was zero, or
+ * that was above 0x80 to begin with; the ~W weeds out the latter.)
+ */
+#define WORD_ONES	(~0UL / 0xff)
+#define WORD_HIGHS	(WORD_ONES * 0x80)
+#define WORD_HASZERO(w)	((((w) - WORD_ONES) & ~(w) & WORD_HIGHS) != 0)
+
+/*
+ * Return the length of the string at S, not counting the null, or LIM
+ * if there's no null in the first LIM bytes. Goes a word at a time
+ * once S is word-aligned. An aligned word never crosses a page, so
+ * this never touches a page the string doesn't reach into.
+ */
+static
+size_t
+copystrlen(const char *s, size_t lim)
+{
+	size_t i;
+
+	i = 0;
+	while (i < lim && (uintptr_t)(s + i) % sizeof(long) != 0) {
+		if (s[i] == 0) {
+			return i;
+		}
+		i++;
+	}
+	while (i + sizeof(long) <= lim &&
+	       !WORD_HASZERO(*(const unsigned long *)(s + i))) {
+		i += sizeof(long);
+	}
+	while (i < lim && s[i] != 0) {
+		i++;
+	}
+	return i;
+}
+
 /*
  * copyin
  *
@@ -172,7 +265,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copyblock(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -208,7 +301,7 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copyblock((void *)userdest, src, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -235,16 +328,20 @@ int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
-
-	for (i=0; i<maxlen && i<stoplen; i++) {
-		dest[i] = src[i];
-		if (src[i] == 0) {
-			if (gotlen != NULL) {
-				*gotlen = i+1;
-			}
-			return 0;
+	size_t len;
+
+	len = copystrlen(src, maxlen < stoplen ? maxlen : stoplen);
+	if (len < maxlen && len < stoplen) {
+		copyblock(dest, src, len);
+		/*
+		 * Store the null ourselves: a user string can change
+		 * between the scan and the copy.
+		 */
+		dest[len] = 0;
+		if (gotlen != NULL) {
+			*gotlen = len+1;
 		}
+		return 0;
 	}
 	if (stoplen < maxlen) {
 		/* ran into user-kernel boundary */
@@ -319,3 +416,86 @@ copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return result;
 }
+
+/*
+ * The part of copyuio that runs under the fault handler: move N bytes
+ * between PTR and the user buffers of UIO, updating UIO as we go. The
+ * bookkeeping for each iovec is only done once it has been copied, so
+ * after a fault UIO describes what was moved before the faulting
+ * iovec.
+ */
+static
+int
+copyuio_iovecs(void *ptr, size_t n, struct uio *uio)
+{
+	struct iovec *iov;
+	size_t size, stoplen;
+	int result;
+
+	while (n > 0 && uio->uio_resid > 0) {
+		iov = uio->uio_iov;
+		size = iov->iov_len;
+		if (size > n) {
+			size = n;
+		}
+
+		if (size == 0) {
+			/* move to the next iovec and try again */
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			if (uio->uio_iovcnt == 0) {
+				/* uio_resid is bigger than the buffers */
+				panic("uiomove: ran out of buffers\n");
+			}
+			continue;
+		}
+
+		result = copycheck(iov->iov_ubase, size, &stoplen);
+		if (result) {
+			return result;
+		}
+		if (stoplen != size) {
+			return EFAULT;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			copyblock((void *)iov->iov_ubase, ptr, size);
+		}
+		else {
+			copyblock(ptr, (const void *)iov->iov_ubase, size);
+		}
+
+		iov->iov_ubase += size;
+		iov->iov_len -= size;
+		uio->uio_resid -= size;
+		uio->uio_offset += size;
+		ptr = ((char *)ptr + size);
+		n -= size;
+	}
+	return 0;
+}
+
+/*
+ * copyuio
+ *
+ * Do the work of uiomove for a uio whose buffers are in user space,
+ * with one setjmp for all the iovecs.
+ */
+int
+copyuio(void *ptr, size_t n, struct uio *uio)
+{
+	int result;
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	result = copyuio_iovecs(ptr, n, uio);
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return result;
+}
@@ -0,0 +1,1280 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Coremap: physical page frame accounting.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <shrinker.h>
+#include <coremap.h>
+
+/*
+ * One entry per physical page frame.
+ *
+ * For kernel allocations, the first frame of each run records the
+ * length of the run in cme_npages so free_kpages can release the
+ * whole thing given only its address. For user pages, cme_as and
+ * cme_vaddr record which page of which address space the frame holds.
+ *
+ * User frames can be shared copy-on-write between address spaces
+ * after as_copy; cme_refcount counts the page table entries that
+ * refer to the frame. While a frame is shared, cme_as is NULL: we
+ * don't know every owner, only how many there are. The last one left
+ * takes it over again the next time it faults on the page, for a
+ * read as well as a write, so that it can be paged out once more
+ * (see coremap_cowclaim).
+ *
+ * cme_busy is a per-frame sleep lock ("pinned"): it is set while a
+ * fault is being handled on the frame or while the frame is being
+ * paged out, and whoever sets it is the only one allowed to change
+ * the page table entry that maps the frame. cme_referenced is the
+ * use bit for the pageout clock. MIPS has no hardware reference bit;
+ * we set it whenever a page is entered in the TLB, which, since the
+ * TLB is flushed on every context switch, happens often enough for
+ * pages that are really in use.
+ *
+ * Idle cpus zero free frames ahead of time and keep them in the zero
+ * pool (state CME_ZERO), so that demand-zero faults usually don't
+ * have to. Pool frames don't count as free, but they're given back
+ * before anybody is made to wait for memory.
+ *
+ * Free frames are managed with a buddy system: they're grouped into
+ * naturally aligned blocks of 2^k frames, for k up to
+ * COREMAP_MAXORDER, kept on one free list per order. The first frame
+ * of a free block has cme_npages set to the size of the block; the
+ * rest have it zero. The list links live in the free frames
+ * themselves. Allocating splits a larger block if need be, and
+ * freeing merges a block with its buddy (the other half of the block
+ * of the next order up) for as long as the buddy is free too.
+ *
+ * Single-page kernel allocations are served from small per-cpu
+ * caches of frames when possible, so that kmalloc's page traffic
+ * doesn't all go through coremap_lock. Cached frames stay CME_KERNEL
+ * with cme_npages 1, so taking one from a cache or putting one back
+ * doesn't touch the coremap.
+ */
+struct coremap_entry {
+	struct addrspace *cme_as;	/* owning address space (user pages) */
+	vaddr_t cme_vaddr;		/* virtual address of page (user pages) */
+	unsigned cme_npages:20;		/* length of run (kernel run head) */
+	unsigned cme_state:3;		/* CME_* value */
+	unsigned cme_busy:1;		/* pinned (user pages) */
+	unsigned cme_referenced:1;	/* recently used (user pages) */
+	uint16_t cme_refcount;		/* number of mappings (user pages) */
+};
+
+/* Frame states */
+#define CME_FREE	0	/* available */
+#define CME_FIXED	1	/* kernel image or taken before bootstrap */
+#define CME_KERNEL	2	/* allocated with alloc_kpages */
+#define CME_USER	3	/* holds a user page */
+#define CME_ZERO	4	/* zeroed, in (or going into) the zero pool */
+
+/* Largest buddy block is 2^COREMAP_MAXORDER frames (4M). */
+#define COREMAP_MAXORDER	10
+
+/*
+ * Per-cpu single-frame caches hold up to COREMAP_PCPU_MAX frames and
+ * are refilled COREMAP_PCPU_BATCH at a time.
+ */
+#define COREMAP_MAXCPUS		32
+#define COREMAP_PCPU_MAX	16
+#define COREMAP_PCPU_BATCH	8
+
+/* Most frames we keep pre-zeroed. */
+#define COREMAP_ZEROPOOL_MAX	64
+
+/*
+ * Number of times a kernel allocation goes back to the pageout
+ * daemon before giving up. Evicting user pages does not necessarily
+ * produce a contiguous run, so this can't be unbounded.
+ */
+#define COREMAP_KERNEL_RETRIES	8
+
+/*
+ * The coremap and all the counters are protected by coremap_lock.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+static struct coremap_entry *coremap;
+static unsigned coremap_npages;		/* total number of frames */
+static unsigned coremap_firstpage;	/* first frame we manage */
+static unsigned coremap_clockhand;	/* next frame the clock looks at */
+static bool coremap_ready;
+
+static unsigned coremap_numfree;
+static unsigned coremap_numkernel;
+static unsigned coremap_numuser;
+
+/*
+ * Buddy free lists. Each is circular, with a dummy head; the entries
+ * are the first frames of free blocks, through their kernel mappings.
+ */
+struct coremap_freeblock {
+	struct coremap_freeblock *fb_next;
+	struct coremap_freeblock *fb_prev;
+};
+static struct coremap_freeblock coremap_freelists[COREMAP_MAXORDER + 1];
+static unsigned coremap_numblocks[COREMAP_MAXORDER + 1];
+
+/*
+ * Per-cpu frame caches, indexed by cpu number. Each has its own lock.
+ * pc_lock may be taken while holding coremap_lock, never the other
+ * way around.
+ */
+struct coremap_pcpu {
+	struct spinlock pc_lock;
+	unsigned pc_num;
+	unsigned pc_frames[COREMAP_PCPU_MAX];
+};
+static struct coremap_pcpu coremap_pcpu[COREMAP_MAXCPUS];
+static unsigned coremap_pcpu_hits;	/* not locked; approximate */
+
+/*
+ * Zero pool: a stack of frame numbers. coremap_zerotarget is how many
+ * we aim to keep, scaled down on small machines.
+ */
+static unsigned coremap_zeropool[COREMAP_ZEROPOOL_MAX];
+static unsigned coremap_numzero;
+static unsigned coremap_zerotarget;
+static unsigned coremap_zerofills_pool;	/* zero-fills served from pool */
+static unsigned coremap_zerofills_inline;	/* zero-fills done on demand */
+
+/*
+ * Pageout state. The daemon is woken when the free count drops below
+ * coremap_lowater and runs until it is back up to coremap_hiwater or
+ * until it finds nothing it can evict (coremap_stuck). Threads that
+ * find memory exhausted wait on coremap_memwchan for it.
+ */
+static struct thread *coremap_pageout_thread;
+static unsigned coremap_lowater;
+static unsigned coremap_hiwater;
+static unsigned coremap_memwaiters;
+static bool coremap_stuck;
+
+static struct wchan *coremap_busywchan;	/* waiting for a busy frame */
+static struct wchan *coremap_memwchan;	/* waiting for free memory */
+static struct wchan *coremap_pageoutwchan;	/* pageout daemon sleeps */
+
+/*
+ * Buddy system.
+ */
+
+static
+struct coremap_freeblock *
+coremap_block(unsigned ix)
+{
+	return (struct coremap_freeblock *)
+		PADDR_TO_KVADDR((paddr_t)ix * PAGE_SIZE);
+}
+
+static
+unsigned
+coremap_blockindex(struct coremap_freeblock *fb)
+{
+	return KVADDR_TO_PADDR((vaddr_t)fb) / PAGE_SIZE;
+}
+
+/*
+ * Smallest order whose blocks hold NPAGES frames.
+ */
+static
+unsigned
+coremap_order(unsigned npages)
+{
+	unsigned order;
+
+	order = 0;
+	while ((1U << order) < npages) {
+		order++;
+	}
+	return order;
+}
+
+/*
+ * Put the free block of order ORDER at IX on its free list. Its
+ * frames must already be CME_FREE with cme_npages 0.
+ */
+static
+void
+coremap_addblock(unsigned ix, unsigned order)
+{
+	struct coremap_freeblock *fb, *head;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(ix % (1U << order) == 0);
+
+	coremap[ix].cme_npages = 1U << order;
+	head = &coremap_freelists[order];
+	fb = coremap_block(ix);
+	fb->fb_next = head->fb_next;
+	fb->fb_prev = head;
+	head->fb_next->fb_prev = fb;
+	head->fb_next = fb;
+	coremap_numblocks[order]++;
+}
+
+/*
+ * Take the free block of order ORDER at IX off its free list.
+ */
+static
+void
+coremap_removeblock(unsigned ix, unsigned order)
+{
+	struct coremap_freeblock *fb;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(coremap[ix].cme_state == CME_FREE);
+	KASSERT(coremap[ix].cme_npages == 1U << order);
+
+	fb = coremap_block(ix);
+	fb->fb_prev->fb_next = fb->fb_next;
+	fb->fb_next->fb_prev = fb->fb_prev;
+	coremap[ix].cme_npages = 0;
+	coremap_numblocks[order]--;
+}
+
+/*
+ * Allocate a block of order ORDER and return the index of its first
+ * frame, or 0 (which is always a fixed frame) if there isn't one.
+ * The frames are left CME_FREE for the caller to change.
+ */
+static
+unsigned
+coremap_buddyalloc(unsigned order)
+{
+	unsigned k, ix;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(order <= COREMAP_MAXORDER);
+
+	for (k = order; k <= COREMAP_MAXORDER; k++) {
+		if (coremap_numblocks[k] > 0) {
+			break;
+		}
+	}
+	if (k > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	ix = coremap_blockindex(coremap_freelists[k].fb_next);
+	coremap_removeblock(ix, k);
+
+	/* Split, giving back the upper halves. */
+	while (k > order) {
+		k--;
+		coremap_addblock(ix + (1U << k), k);
+	}
+	return ix;
+}
+
+/*
+ * Free the block of order ORDER at IX, merging it with its buddies.
+ * Its frames must already be CME_FREE with cme_npages 0.
+ */
+static
+void
+coremap_buddyfree(unsigned ix, unsigned order)
+{
+	unsigned buddy;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	while (order < COREMAP_MAXORDER) {
+		buddy = ix ^ (1U << order);
+		if (buddy < coremap_firstpage ||
+		    buddy + (1U << order) > coremap_npages ||
+		    coremap[buddy].cme_state != CME_FREE ||
+		    coremap[buddy].cme_npages != 1U << order) {
+			break;
+		}
+		coremap_removeblock(buddy, order);
+		if (buddy < ix) {
+			ix = buddy;
+		}
+		order++;
+	}
+	coremap_addblock(ix, order);
+}
+
+/*
+ * Free NPAGES frames starting at IX, which need not be a block: break
+ * the range into the largest aligned blocks that fit. The frames must
+ * already be CME_FREE with cme_npages 0.
+ */
+static
+void
+coremap_freerange(unsigned ix, unsigned npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < COREMAP_MAXORDER &&
+		       ix % (2U << order) == 0 &&
+		       (2U << order) <= npages) {
+			order++;
+		}
+		coremap_buddyfree(ix, order);
+		ix += 1U << order;
+		npages -= 1U << order;
+	}
+}
+
+/*
+ * Take over physical memory from ram.c. The coremap itself is placed
+ * in the first free pages; those, and everything below them, become
+ * fixed frames that are never handed out.
+ */
+void
+coremap_bootstrap(void)
+{
+	paddr_t lastpaddr, firstpaddr, cmpaddr;
+	size_t cmsize;
+	unsigned i;
+
+	/* must call ram_getsize first; ram_getfirstfree clears it */
+	lastpaddr = ram_getsize();
+	coremap_npages = lastpaddr / PAGE_SIZE;
+
+	cmsize = coremap_npages * sizeof(struct coremap_entry);
+	cmpaddr = ram_stealmem(DIVROUNDUP(cmsize, PAGE_SIZE));
+	if (cmpaddr == 0) {
+		panic("coremap_bootstrap: Out of memory for coremap\n");
+	}
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(cmpaddr);
+
+	firstpaddr = ram_getfirstfree();
+	KASSERT(firstpaddr % PAGE_SIZE == 0);
+	coremap_firstpage = firstpaddr / PAGE_SIZE;
+	KASSERT(coremap_firstpage < coremap_npages);
+
+	for (i=0; i<coremap_npages; i++) {
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_state =
+			i < coremap_firstpage ? CME_FIXED : CME_FREE;
+		coremap[i].cme_busy = 0;
+		coremap[i].cme_referenced = 0;
+		coremap[i].cme_refcount = 0;
+	}
+	for (i=0; i<=COREMAP_MAXORDER; i++) {
+		coremap_freelists[i].fb_next = &coremap_freelists[i];
+		coremap_freelists[i].fb_prev = &coremap_freelists[i];
+		coremap_numblocks[i] = 0;
+	}
+	for (i=0; i<COREMAP_MAXCPUS; i++) {
+		spinlock_init(&coremap_pcpu[i].pc_lock);
+		coremap_pcpu[i].pc_num = 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap_freerange(coremap_firstpage,
+			  coremap_npages - coremap_firstpage);
+	coremap_clockhand = coremap_firstpage;
+	coremap_numfree = coremap_npages - coremap_firstpage;
+	coremap_numkernel = 0;
+	coremap_numuser = 0;
+	coremap_lowater = coremap_numfree / 32 + 4;
+	coremap_hiwater = coremap_lowater * 2;
+	coremap_zerotarget = coremap_numfree / 16;
+	if (coremap_zerotarget > COREMAP_ZEROPOOL_MAX) {
+		coremap_zerotarget = COREMAP_ZEROPOOL_MAX;
+	}
+	coremap_ready = true;
+	spinlock_release(&coremap_lock);
+
+	/* Now that kmalloc works. */
+	coremap_busywchan = wchan_create("coremap busy");
+	coremap_memwchan = wchan_create("coremap mem");
+	coremap_pageoutwchan = wchan_create("pageout");
+	if (coremap_busywchan == NULL || coremap_memwchan == NULL ||
+	    coremap_pageoutwchan == NULL) {
+		panic("coremap_bootstrap: Out of memory for wchans\n");
+	}
+
+	kprintf("vm: %u of %u page frames available\n",
+		coremap_numfree, coremap_npages);
+}
+
+/*
+ * Return true once the coremap is in charge of physical memory.
+ */
+bool
+coremap_bootstrapped(void)
+{
+	bool ret;
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_ready;
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Account for frames becoming free: let anyone waiting for memory
+ * try again. Must hold coremap_lock.
+ */
+static
+void
+coremap_freed(unsigned npages)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	coremap_numfree += npages;
+	coremap_stuck = false;
+	if (coremap_memwaiters > 0) {
+		wchan_wakeall(coremap_memwchan, &coremap_lock);
+	}
+}
+
+/*
+ * Account for frames being allocated, and poke the pageout daemon if
+ * memory is getting low. Must hold coremap_lock.
+ */
+static
+void
+coremap_allocated(unsigned npages)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	coremap_numfree -= npages;
+	if (coremap_numfree < coremap_lowater &&
+	    coremap_pageout_thread != NULL) {
+		wchan_wakeone(coremap_pageoutwchan, &coremap_lock);
+	}
+}
+
+/*
+ * Give the zero pool back to the free list. Returns true if there was
+ * anything in it. Must hold coremap_lock.
+ */
+static
+bool
+coremap_drainzero(void)
+{
+	unsigned ix, n;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	n = coremap_numzero;
+	if (n == 0) {
+		return false;
+	}
+	while (coremap_numzero > 0) {
+		ix = coremap_zeropool[--coremap_numzero];
+		KASSERT(coremap[ix].cme_state == CME_ZERO);
+		coremap[ix].cme_state = CME_FREE;
+		coremap_buddyfree(ix, 0);
+	}
+	coremap_numfree += n;
+	return true;
+}
+
+/*
+ * Give all the frames in the per-cpu caches back. Returns true if
+ * there were any. Must hold coremap_lock.
+ */
+static
+bool
+coremap_pcpu_drain(void)
+{
+	struct coremap_pcpu *pc;
+	unsigned i, ix, n;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	n = 0;
+	for (i=0; i<COREMAP_MAXCPUS; i++) {
+		pc = &coremap_pcpu[i];
+		spinlock_acquire(&pc->pc_lock);
+		while (pc->pc_num > 0) {
+			ix = pc->pc_frames[--pc->pc_num];
+			KASSERT(coremap[ix].cme_state == CME_KERNEL);
+			KASSERT(coremap[ix].cme_npages == 1);
+			coremap[ix].cme_state = CME_FREE;
+			coremap[ix].cme_npages = 0;
+			coremap_buddyfree(ix, 0);
+			n++;
+		}
+		spinlock_release(&pc->pc_lock);
+	}
+	if (n == 0) {
+		return false;
+	}
+	coremap_numkernel -= n;
+	coremap_freed(n);
+	return true;
+}
+
+/*
+ * Get a frame from this cpu's cache, refilling it if it's empty and
+ * memory is plentiful. Returns 0 if there's none to be had this way.
+ */
+static
+unsigned
+coremap_pcpu_get(void)
+{
+	struct coremap_pcpu *pc;
+	unsigned frames[COREMAP_PCPU_BATCH];
+	unsigned i, n, ix;
+
+	pc = &coremap_pcpu[curcpu->c_number % COREMAP_MAXCPUS];
+
+	spinlock_acquire(&pc->pc_lock);
+	if (pc->pc_num > 0) {
+		ix = pc->pc_frames[--pc->pc_num];
+		spinlock_release(&pc->pc_lock);
+		coremap_pcpu_hits++;
+		return ix;
+	}
+	spinlock_release(&pc->pc_lock);
+
+	/* Refill, unless that would eat into the pageout reserve. */
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_ready ||
+	    coremap_numfree < coremap_hiwater + COREMAP_PCPU_BATCH) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+	for (n=0; n<COREMAP_PCPU_BATCH; n++) {
+		ix = coremap_buddyalloc(0);
+		KASSERT(ix != 0);
+		coremap[ix].cme_state = CME_KERNEL;
+		coremap[ix].cme_npages = 1;
+		frames[n] = ix;
+	}
+	coremap_allocated(n);
+	coremap_numkernel += n;
+	spinlock_release(&coremap_lock);
+
+	/* Keep the first for ourselves. */
+	spinlock_acquire(&pc->pc_lock);
+	for (i=1; i<n && pc->pc_num < COREMAP_PCPU_MAX; i++) {
+		pc->pc_frames[pc->pc_num++] = frames[i];
+	}
+	spinlock_release(&pc->pc_lock);
+
+	/* If an interrupt filled the cache meanwhile, free the rest. */
+	if (i < n) {
+		spinlock_acquire(&coremap_lock);
+		for (; i<n; i++) {
+			coremap[frames[i]].cme_state = CME_FREE;
+			coremap[frames[i]].cme_npages = 0;
+			coremap_buddyfree(frames[i], 0);
+			coremap_numkernel--;
+			coremap_freed(1);
+		}
+		spinlock_release(&coremap_lock);
+	}
+	return frames[0];
+}
+
+/*
+ * Put a single kernel frame in this cpu's cache. Returns false if the
+ * cache is full.
+ */
+static
+bool
+coremap_pcpu_put(unsigned ix)
+{
+	struct coremap_pcpu *pc;
+	bool ret;
+
+	pc = &coremap_pcpu[curcpu->c_number % COREMAP_MAXCPUS];
+
+	spinlock_acquire(&pc->pc_lock);
+	ret = pc->pc_num < COREMAP_PCPU_MAX;
+	if (ret) {
+		pc->pc_frames[pc->pc_num++] = ix;
+	}
+	spinlock_release(&pc->pc_lock);
+	return ret;
+}
+
+/*
+ * Wait for the pageout daemon to free some memory. Returns false if
+ * that isn't possible or the daemon has already tried and failed
+ * since we started waiting (*TRIED remembers that). Must hold
+ * coremap_lock, which is released while sleeping.
+ */
+static
+bool
+coremap_waitformem(bool *tried)
+{
+	bool drained;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	/* Try the zero pool and the per-cpu caches first. */
+	drained = coremap_drainzero();
+	drained = coremap_pcpu_drain() || drained;
+	if (drained) {
+		return true;
+	}
+
+	if (coremap_pageout_thread == NULL ||
+	    curthread == coremap_pageout_thread ||
+	    curthread->t_in_interrupt ||
+	    curcpu->c_spinlocks > 1) {
+		return false;
+	}
+	if (*tried && coremap_stuck) {
+		return false;
+	}
+	*tried = true;
+	coremap_stuck = false;
+
+	coremap_memwaiters++;
+	wchan_wakeone(coremap_pageoutwchan, &coremap_lock);
+	wchan_sleep(coremap_memwchan, &coremap_lock);
+	coremap_memwaiters--;
+	return true;
+}
+
+/*
+ * Allocate a run of frames for the kernel.
+ */
+paddr_t
+coremap_allockernel(unsigned npages)
+{
+	unsigned base, i, order, tries;
+	bool tried = false, shrunk = false;
+
+	KASSERT(npages > 0);
+
+	if (npages == 1) {
+		base = coremap_pcpu_get();
+		if (base != 0) {
+			return (paddr_t)base * PAGE_SIZE;
+		}
+	}
+
+	order = coremap_order(npages);
+	if (order > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	tries = 0;
+	while ((base = coremap_buddyalloc(order)) == 0) {
+		if (tries++ >= COREMAP_KERNEL_RETRIES ||
+		    !coremap_waitformem(&tried)) {
+			/* Last resort: have the caches give some back. */
+			spinlock_release(&coremap_lock);
+			if (shrunk || shrinker_run(1U << order) == 0) {
+				return 0;
+			}
+			shrunk = true;
+			spinlock_acquire(&coremap_lock);
+		}
+	}
+
+	/* Give back the part of the block we don't need. */
+	coremap_freerange(base + npages, (1U << order) - npages);
+
+	for (i=base; i<base+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_FREE);
+		coremap[i].cme_state = CME_KERNEL;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+	}
+	coremap[base].cme_npages = npages;
+
+	coremap_allocated(npages);
+	coremap_numkernel += npages;
+
+	spinlock_release(&coremap_lock);
+
+	return (paddr_t)base * PAGE_SIZE;
+}
+
+/*
+ * Release a run of kernel frames.
+ */
+void
+coremap_freekernel(paddr_t paddr)
+{
+	unsigned base, npages, i;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	base = paddr / PAGE_SIZE;
+	KASSERT(base < coremap_npages);
+
+	/* These fields don't change while the caller owns the frames. */
+	if (coremap[base].cme_state == CME_FIXED) {
+		/* Came from ram_stealmem; we don't know how big it is. */
+		return;
+	}
+	KASSERT(coremap[base].cme_state == CME_KERNEL);
+	npages = coremap[base].cme_npages;
+	KASSERT(npages > 0);
+	KASSERT(base + npages <= coremap_npages);
+
+	if (npages == 1 && coremap_pcpu_put(base)) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	for (i=base; i<base+npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_KERNEL);
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_npages = 0;
+	}
+	coremap_freerange(base, npages);
+
+	coremap_numkernel -= npages;
+	coremap_freed(npages);
+
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Allocate one frame to hold the user page VADDR of address space AS.
+ * If ZERO is set the frame is zeroed, preferably by taking one from
+ * the zero pool; otherwise its contents are garbage. It is returned
+ * pinned; the caller unpins it once the page table entry points at
+ * it.
+ *
+ * If memory is exhausted, wait for the pageout daemon to free some.
+ */
+paddr_t
+coremap_allocuser(struct addrspace *as, vaddr_t vaddr, bool zero)
+{
+	unsigned ix;
+	bool tried = false, needzero = false, shrunk = false;
+
+	KASSERT(as != NULL);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	spinlock_acquire(&coremap_lock);
+
+	if (zero && coremap_numzero > 0) {
+		ix = coremap_zeropool[--coremap_numzero];
+		KASSERT(coremap[ix].cme_state == CME_ZERO);
+		coremap_zerofills_pool++;
+	}
+	else {
+		while ((ix = coremap_buddyalloc(0)) == 0) {
+			if (!coremap_waitformem(&tried)) {
+				/* Last resort, as in coremap_allockernel. */
+				spinlock_release(&coremap_lock);
+				if (shrunk || shrinker_run(1) == 0) {
+					return 0;
+				}
+				shrunk = true;
+				spinlock_acquire(&coremap_lock);
+			}
+		}
+		KASSERT(coremap[ix].cme_state == CME_FREE);
+		coremap_allocated(1);
+		if (zero) {
+			needzero = true;
+			coremap_zerofills_inline++;
+		}
+	}
+
+	coremap[ix].cme_state = CME_USER;
+	coremap[ix].cme_npages = 0;
+	coremap[ix].cme_as = as;
+	coremap[ix].cme_vaddr = vaddr;
+	coremap[ix].cme_busy = 1;
+	coremap[ix].cme_referenced = 1;
+	coremap[ix].cme_refcount = 1;
+
+	coremap_numuser++;
+
+	spinlock_release(&coremap_lock);
+
+	if (needzero) {
+		bzero((void *)PADDR_TO_KVADDR((paddr_t)ix * PAGE_SIZE),
+		      PAGE_SIZE);
+	}
+
+	return (paddr_t)ix * PAGE_SIZE;
+}
+
+/*
+ * Zero one free frame for the zero pool, if the pool is short and
+ * memory isn't. Called by idle cpus; never sleeps. Returns true if it
+ * did anything.
+ */
+bool
+coremap_zeroone(void)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+	if (!coremap_ready ||
+	    coremap_numzero >= coremap_zerotarget ||
+	    coremap_numfree <= coremap_hiwater) {
+		spinlock_release(&coremap_lock);
+		return false;
+	}
+	ix = coremap_buddyalloc(0);
+	KASSERT(ix != 0);
+	KASSERT(coremap[ix].cme_state == CME_FREE);
+	coremap[ix].cme_state = CME_ZERO;
+	coremap_numfree--;
+	spinlock_release(&coremap_lock);
+
+	bzero((void *)PADDR_TO_KVADDR((paddr_t)ix * PAGE_SIZE), PAGE_SIZE);
+
+	spinlock_acquire(&coremap_lock);
+	if (coremap_numzero < COREMAP_ZEROPOOL_MAX) {
+		coremap_zeropool[coremap_numzero++] = ix;
+	}
+	else {
+		/* Another cpu filled it meanwhile. */
+		coremap[ix].cme_state = CME_FREE;
+		coremap_buddyfree(ix, 0);
+		coremap_freed(1);
+	}
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+/*
+ * Get the coremap index of a user frame. Must hold coremap_lock.
+ */
+static
+unsigned
+coremap_userindex(paddr_t paddr)
+{
+	unsigned ix;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+	KASSERT(paddr % PAGE_SIZE == 0);
+	ix = paddr / PAGE_SIZE;
+	KASSERT(ix >= coremap_firstpage && ix < coremap_npages);
+	KASSERT(coremap[ix].cme_state == CME_USER);
+	KASSERT(coremap[ix].cme_refcount > 0);
+	return ix;
+}
+
+/*
+ * Pin the user frame PADDR, which the page table entry PTE maps. If
+ * the frame is busy, wait for it. Returns false if, by the time we
+ * get it, PTE no longer maps PADDR (the page was paged out or freed
+ * in the meantime); the caller should look at PTE again.
+ */
+bool
+coremap_pin(paddr_t paddr, const pte_t *pte)
+{
+	unsigned ix;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	ix = paddr / PAGE_SIZE;
+	KASSERT(ix >= coremap_firstpage && ix < coremap_npages);
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		if (!PTE_ISVALID(*pte) || PTE_PADDR(*pte) != paddr) {
+			spinlock_release(&coremap_lock);
+			return false;
+		}
+		KASSERT(coremap[ix].cme_state == CME_USER);
+		if (!coremap[ix].cme_busy) {
+			break;
+		}
+		wchan_sleep(coremap_busywchan, &coremap_lock);
+	}
+	coremap[ix].cme_busy = 1;
+	spinlock_release(&coremap_lock);
+	return true;
+}
+
+/*
+ * Unpin a user frame. This also marks it recently used.
+ */
+void
+coremap_unpin(paddr_t paddr)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_busy);
+	coremap[ix].cme_busy = 0;
+	coremap[ix].cme_referenced = 1;
+	wchan_wakeall(coremap_busywchan, &coremap_lock);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Add a mapping to a pinned user frame, for copy-on-write sharing.
+ */
+void
+coremap_share(paddr_t paddr)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_busy);
+	KASSERT(coremap[ix].cme_refcount < 0xffff);
+	coremap[ix].cme_refcount++;
+	coremap[ix].cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Make a pinned user frame ownerless, so it is never paged out. It
+ * is then up to the caller to know when to free it. Used for the
+ * page cache.
+ */
+void
+coremap_disown(paddr_t paddr)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_busy);
+	coremap[ix].cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Pin an ownerless user frame. Unlike coremap_pin there's no page
+ * table entry to check; the caller must hold a reference that keeps
+ * the frame from being freed.
+ */
+void
+coremap_pinshared(paddr_t paddr)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_as == NULL);
+	while (coremap[ix].cme_busy) {
+		wchan_sleep(coremap_busywchan, &coremap_lock);
+	}
+	coremap[ix].cme_busy = 1;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Like coremap_pinshared, but return false instead of waiting if the
+ * frame is busy. Never sleeps, so it may be called with other
+ * spinlocks held.
+ */
+bool
+coremap_trypinshared(paddr_t paddr)
+{
+	unsigned ix;
+	bool ret;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_as == NULL);
+	ret = !coremap[ix].cme_busy;
+	if (ret) {
+		coremap[ix].cme_busy = 1;
+	}
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Called on a fault on a copy-on-write page, with the frame pinned.
+ * If the faulting mapping is the only one left, the frame becomes
+ * the private property of AS at VADDR and we return true; the caller
+ * can then just make it writeable. Otherwise return false, and on a
+ * write the caller must copy.
+ */
+bool
+coremap_cowclaim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned ix;
+	bool ret;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_busy);
+	ret = coremap[ix].cme_refcount == 1;
+	if (ret) {
+		coremap[ix].cme_as = as;
+		coremap[ix].cme_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * Mark a user frame free. Must hold coremap_lock.
+ */
+static
+void
+coremap_release(unsigned ix)
+{
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	coremap[ix].cme_state = CME_FREE;
+	coremap[ix].cme_as = NULL;
+	coremap[ix].cme_vaddr = 0;
+	coremap[ix].cme_busy = 0;
+	coremap[ix].cme_referenced = 0;
+	coremap[ix].cme_refcount = 0;
+
+	coremap_numuser--;
+	coremap_buddyfree(ix, 0);
+	coremap_freed(1);
+	wchan_wakeall(coremap_busywchan, &coremap_lock);
+}
+
+/*
+ * Drop a mapping of a pinned user frame, and release the frame if
+ * that was the last one. Either way the caller's pin goes away.
+ */
+void
+coremap_freeuser(paddr_t paddr)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_busy);
+	coremap[ix].cme_refcount--;
+	if (coremap[ix].cme_refcount > 0) {
+		coremap[ix].cme_busy = 0;
+		wchan_wakeall(coremap_busywchan, &coremap_lock);
+		spinlock_release(&coremap_lock);
+		return;
+	}
+
+	coremap_release(ix);
+
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Check if a user frame can be paged out: it must have a single,
+ * known owner and not be pinned. Must hold coremap_lock.
+ */
+static
+bool
+coremap_evictable(unsigned ix)
+{
+	return coremap[ix].cme_state == CME_USER &&
+		!coremap[ix].cme_busy &&
+		coremap[ix].cme_refcount == 1 &&
+		coremap[ix].cme_as != NULL;
+}
+
+/*
+ * Pageout daemon interface.
+ *
+ * The daemon registers itself with coremap_pageout_start, then loops
+ * calling coremap_pageout_wait to sleep until there's work and
+ * coremap_clock to pick victims. Victims are returned pinned; they are
+ * either released with coremap_evicted once their contents are safely
+ * in swap or given back with coremap_unpin.
+ */
+void
+coremap_pageout_start(void)
+{
+	spinlock_acquire(&coremap_lock);
+	KASSERT(coremap_pageout_thread == NULL);
+	coremap_pageout_thread = curthread;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_pageout_wait(void)
+{
+	spinlock_acquire(&coremap_lock);
+	KASSERT(curthread == coremap_pageout_thread);
+	while (coremap_stuck ||
+	       (coremap_numfree >= coremap_hiwater &&
+		coremap_memwaiters == 0)) {
+		wchan_sleep(coremap_pageoutwchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * The daemon couldn't free anything (no victims, or swap is full).
+ * Tell anyone waiting for memory to give up, and don't try again
+ * until something changes.
+ */
+void
+coremap_pageout_stuck(void)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap_stuck = true;
+	if (coremap_memwaiters > 0) {
+		wchan_wakeall(coremap_memwchan, &coremap_lock);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Choose a frame to page out, using the clock (second chance)
+ * algorithm: sweep the hand around the coremap, clearing the use bit
+ * of recently used frames and taking the first evictable frame whose
+ * use bit is already clear. Returns the frame, pinned, and its owner
+ * in *AS and *VADDR, or 0 if two full sweeps turn up nothing.
+ */
+paddr_t
+coremap_clock(struct addrspace **as, vaddr_t *vaddr)
+{
+	unsigned ix, n, nframes;
+
+	spinlock_acquire(&coremap_lock);
+
+	nframes = coremap_npages - coremap_firstpage;
+	for (n=0; n<2*nframes; n++) {
+		ix = coremap_clockhand++;
+		if (coremap_clockhand == coremap_npages) {
+			coremap_clockhand = coremap_firstpage;
+		}
+		if (!coremap_evictable(ix)) {
+			continue;
+		}
+		if (coremap[ix].cme_referenced) {
+			coremap[ix].cme_referenced = 0;
+			continue;
+		}
+		coremap[ix].cme_busy = 1;
+		*as = coremap[ix].cme_as;
+		*vaddr = coremap[ix].cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return (paddr_t)ix * PAGE_SIZE;
+	}
+
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+/*
+ * Pin PADDR as an additional victim if it holds page VADDR of AS, is
+ * evictable, and hasn't been used recently. This is how the daemon
+ * gathers neighbours of a clock victim into one swap cluster.
+ */
+bool
+coremap_pinvictim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned ix;
+	bool ret;
+
+	KASSERT(paddr % PAGE_SIZE == 0);
+	ix = paddr / PAGE_SIZE;
+	if (ix < coremap_firstpage || ix >= coremap_npages) {
+		return false;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	ret = coremap_evictable(ix) &&
+		!coremap[ix].cme_referenced &&
+		coremap[ix].cme_as == as &&
+		coremap[ix].cme_vaddr == vaddr;
+	if (ret) {
+		coremap[ix].cme_busy = 1;
+	}
+	spinlock_release(&coremap_lock);
+	return ret;
+}
+
+/*
+ * A victim's page is now in swap and its page table entry no longer
+ * maps it; release the frame.
+ */
+void
+coremap_evicted(paddr_t paddr)
+{
+	unsigned ix;
+
+	spinlock_acquire(&coremap_lock);
+	ix = coremap_userindex(paddr);
+	KASSERT(coremap[ix].cme_busy);
+	KASSERT(coremap[ix].cme_refcount == 1);
+	coremap_release(ix);
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Print memory usage.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned nfree, nkernel, nuser, nfixed, nzero, ncached;
+	unsigned zpool, zinline;
+	unsigned blocks[COREMAP_MAXORDER + 1];
+	unsigned i;
+
+	spinlock_acquire(&coremap_lock);
+	ncached = 0;
+	for (i=0; i<COREMAP_MAXCPUS; i++) {
+		spinlock_acquire(&coremap_pcpu[i].pc_lock);
+		ncached += coremap_pcpu[i].pc_num;
+		spinlock_release(&coremap_pcpu[i].pc_lock);
+	}
+	for (i=0; i<=COREMAP_MAXORDER; i++) {
+		blocks[i] = coremap_numblocks[i];
+	}
+	nfree = coremap_numfree;
+	nkernel = coremap_numkernel;
+	nuser = coremap_numuser;
+	nfixed = coremap_firstpage;
+	nzero = coremap_numzero;
+	zpool = coremap_zerofills_pool;
+	zinline = coremap_zerofills_inline;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u frames: %u fixed, %u kernel, %u user, "
+		"%u free, %u pre-zeroed\n",
+		coremap_npages, nfixed, nkernel, nuser, nfree, nzero);
+	kprintf("coremap: zero-fills: %u from pool, %u inline\n",
+		zpool, zinline);
+	kprintf("coremap: %u kernel frames in per-cpu caches, "
+		"%u single-page allocations from them\n",
+		ncached, coremap_pcpu_hits);
+	kprintf("coremap: free blocks by order:");
+	for (i=0; i<=COREMAP_MAXORDER; i++) {
+		kprintf(" %u", blocks[i]);
+	}
+	kprintf("\n");
+}
@@ -30,6 +30,10 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <spl.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
 
 /*
@@ -111,6 +115,11 @@ fill_deadbeef(void *vptr, size_t len)
  * CHECKGUARDS checks that allocated blocks' guard bands are intact
  * when checking kernel heap pages with SLOW and SLOWER. This is also
  * quite slow in its own right.
+ *
+ * MAGAZINES puts per-cpu caches of free blocks in front of the
+ * subpage allocator (see below). It is on unless GUARDS or LABELS is
+ * in use, since blocks passing through the magazines would escape
+ * their checks.
  */
 
 #undef  SLOW
@@ -121,6 +130,10 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+#if !defined(GUARDS) && !defined(LABELS)
+#define MAGAZINES
+#endif
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
@@ -168,6 +181,12 @@ struct pageref {
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+/*
+ * Number of subpage pages given back to the page allocator, for
+ * kheap_drain's return value. Protected by kmalloc_spinlock.
+ */
+static unsigned kheap_pagesfreed;
+
 ////////////////////////////////////////
 
 /*
@@ -794,6 +813,12 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+#ifdef MAGAZINES
+static void kmag_printstats(void);
+#else
+#define kmag_printstats()
+#endif
+
 /*
  * Print the whole heap.
  */
@@ -812,6 +837,8 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+	kmag_printstats();
 }
 
 ////////////////////////////////////////
@@ -866,6 +893,60 @@ int blocktype(size_t clientsz)
 	return 0;
 }
 
+/*
+ * Page type table for the magazine layer (see below): for each
+ * physical page that is a subpage page, its block type plus one;
+ * zero for every other page. Written under kmalloc_spinlock when a
+ * subpage page is created or released; read without it by kfree,
+ * which is safe because a caller freeing a block owns a live block
+ * on the page, so the page can't be released out from under it.
+ *
+ * Like the pageref table this assumes System/161's 16M limit on
+ * RAM. Pages past the end of the table are simply never entered in
+ * it, and blocks on them bypass the magazines.
+ */
+#ifdef MAGAZINES
+
+#define KMAG_MAXPAGES (16*1024*1024 / PAGE_SIZE)
+static uint8_t kmalloc_pagetypes[KMAG_MAXPAGES];
+
+static
+void
+kmag_setpagetype(vaddr_t page, unsigned val)
+{
+	paddr_t ix;
+
+	ix = KVADDR_TO_PADDR(page) / PAGE_SIZE;
+	if (ix < KMAG_MAXPAGES) {
+		kmalloc_pagetypes[ix] = val;
+	}
+}
+
+/*
+ * Return the block type of the subpage page PTR is on, or -1 if it
+ * isn't on one we know about.
+ */
+static
+inline
+int
+kmag_pagetype(vaddr_t ptr)
+{
+	paddr_t ix;
+
+	if (ptr < MIPS_KSEG0 || ptr >= MIPS_KSEG1) {
+		return -1;
+	}
+	ix = KVADDR_TO_PADDR(ptr) / PAGE_SIZE;
+	if (ix >= KMAG_MAXPAGES) {
+		return -1;
+	}
+	return (int)kmalloc_pagetypes[ix] - 1;
+}
+
+#else
+#define kmag_setpagetype(page, val) ((void)(page), (void)(val))
+#endif /* MAGAZINES */
+
 /*
  * Allocate a block of size SZ, where SZ is not large enough to
  * warrant a whole-page allocation.
@@ -1012,6 +1093,7 @@ subpage_kmalloc(size_t sz
 
 	pr->next_all = allbase;
 	allbase = pr;
+	kmag_setpagetype(prpage, blktype + 1);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -1138,6 +1220,8 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
+		kmag_setpagetype(prpage, 0);
+		kheap_pagesfreed++;
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
@@ -1155,6 +1239,880 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+//
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazine layer.
+//
+//    In front of the subpage allocator each cpu keeps, for each block
+//    size, two magazines: small stacks of free blocks. This is the
+//    scheme from Bonwick and Adams' 2001 Usenix paper. kmalloc pops
+//    a block from the cpu's loaded magazine and kfree pushes one, so
+//    the common case touches only per-cpu state and never takes
+//    kmalloc_spinlock.
+//
+//    When the loaded magazine runs dry (or fills up) and the other
+//    one is no better, the cpu trades a magazine with the depot,
+//    which holds lists of full and empty magazines for each size.
+//    Only if the depot has nothing suitable do we fall back to the
+//    subpage allocator proper. Keeping two magazines per cpu means a
+//    cpu that alternates allocating and freeing right at a magazine
+//    boundary doesn't go to the depot every time.
+//
+//    Blocks in magazines are still allocated as far as the subpage
+//    pages are concerned, so a page whose blocks are all cached
+//    can't be released; kheap_drain gives the depot's contents back.
+//    So that a burst of frees can't tie up pages indefinitely in the
+//    meantime, the depot holds at most KMAG_DEPOTMAX full magazines
+//    of each size; past that, frees go straight back to the subpage
+//    allocator.
+//
+//    The per-cpu state is only touched by its own cpu with interrupts
+//    off, so it needs no lock. The depot has one spinlock for all
+//    sizes; it is visited at most once per KMAG_ROUNDS operations.
+//
+//    Magazines would hide blocks from the guard band and label code,
+//    so they are compiled out if either is enabled.
+//
+
+#ifdef MAGAZINES
+
+#define KMAG_ROUNDS	30
+#define KMAG_DEPOTMAX	4
+#define KMAG_MAXCPUS	32
+
+struct kmag {
+	struct kmag *km_next;		/* link on depot list */
+	unsigned km_rounds;		/* number of blocks held */
+	void *km_objs[KMAG_ROUNDS];	/* the blocks */
+};
+
+struct kmag_cpu {
+	struct kmag *kc_loaded[NSIZES];	/* allocate/free from this */
+	struct kmag *kc_previous[NSIZES];	/* always full or empty */
+	unsigned kc_hits;		/* kmallocs served here */
+	unsigned kc_misses;		/* kmallocs passed down */
+};
+
+struct kmag_depot {
+	struct kmag *kd_full;
+	struct kmag *kd_empty;
+	unsigned kd_nfull;
+	unsigned kd_nempty;
+};
+
+static struct kmag_cpu kmag_cpus[KMAG_MAXCPUS];
+static struct kmag_depot kmag_depots[NSIZES];
+static struct spinlock kmag_depot_lock = SPINLOCK_INITIALIZER;
+
+static
+struct kmag *
+kmag_pop(struct kmag **list, unsigned *count)
+{
+	struct kmag *mag;
+
+	KASSERT(spinlock_do_i_hold(&kmag_depot_lock));
+	mag = *list;
+	if (mag != NULL) {
+		*list = mag->km_next;
+		mag->km_next = NULL;
+		(*count)--;
+	}
+	return mag;
+}
+
+static
+void
+kmag_push(struct kmag **list, unsigned *count, struct kmag *mag)
+{
+	KASSERT(spinlock_do_i_hold(&kmag_depot_lock));
+	mag->km_next = *list;
+	*list = mag;
+	(*count)++;
+}
+
+/*
+ * Make a new empty magazine. Magazines come straight from the
+ * subpage allocator, never through the magazines themselves.
+ *
+ * This is called from kfree, whose callers may hold spinlocks or be
+ * in an interrupt handler; in those cases we must not risk going to
+ * the page allocator, so just fail and let the block be freed the
+ * slow way.
+ */
+static
+struct kmag *
+kmag_create(void)
+{
+	struct kmag *mag;
+
+	if (curcpu->c_spinlocks > 0 || curthread->t_in_interrupt) {
+		return NULL;
+	}
+	mag = subpage_kmalloc(sizeof(struct kmag));
+	if (mag == NULL) {
+		return NULL;
+	}
+	mag->km_next = NULL;
+	mag->km_rounds = 0;
+	return mag;
+}
+
+/*
+ * Give the blocks in a magazine back to the subpage allocator, and
+ * then the magazine itself.
+ */
+static
+void
+kmag_destroy(struct kmag *mag)
+{
+	unsigned i;
+	int result;
+
+	for (i=0; i<mag->km_rounds; i++) {
+		result = subpage_kfree(mag->km_objs[i]);
+		KASSERT(result == 0);
+	}
+	result = subpage_kfree(mag);
+	KASSERT(result == 0);
+}
+
+/*
+ * Get a block of type BLKTYPE from this cpu's magazines. Returns
+ * NULL if there isn't one without going to the subpage allocator.
+ */
+static
+void *
+kmag_alloc(unsigned blktype)
+{
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	struct kmag *mag, *full;
+	void *ret;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	spl = splhigh();
+	kc = &kmag_cpus[curcpu->c_number % KMAG_MAXCPUS];
+	mag = kc->kc_loaded[blktype];
+	if (mag == NULL || mag->km_rounds == 0) {
+		if (kc->kc_previous[blktype] != NULL &&
+		    kc->kc_previous[blktype]->km_rounds > 0) {
+			/* The previous magazine is full; swap them. */
+			kc->kc_loaded[blktype] = kc->kc_previous[blktype];
+			kc->kc_previous[blktype] = mag;
+		}
+		else {
+			/* Trade the empty previous one for a full one. */
+			kd = &kmag_depots[blktype];
+			spinlock_acquire(&kmag_depot_lock);
+			full = kmag_pop(&kd->kd_full, &kd->kd_nfull);
+			if (full != NULL && kc->kc_previous[blktype] != NULL) {
+				kmag_push(&kd->kd_empty, &kd->kd_nempty,
+					  kc->kc_previous[blktype]);
+			}
+			spinlock_release(&kmag_depot_lock);
+
+			if (full == NULL) {
+				kc->kc_misses++;
+				splx(spl);
+				return NULL;
+			}
+			kc->kc_previous[blktype] = mag;
+			kc->kc_loaded[blktype] = full;
+		}
+		mag = kc->kc_loaded[blktype];
+	}
+
+	KASSERT(mag->km_rounds > 0);
+	ret = mag->km_objs[--mag->km_rounds];
+	kc->kc_hits++;
+	splx(spl);
+	return ret;
+}
+
+/*
+ * Put a block of type BLKTYPE into this cpu's magazines. Returns -1
+ * if that can't be done and the block should go back to the subpage
+ * allocator instead.
+ */
+static
+int
+kmag_free(void *ptr, unsigned blktype)
+{
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	struct kmag *mag, *empty;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return -1;
+	}
+
+	kd = &kmag_depots[blktype];
+	spl = splhigh();
+ again:
+	kc = &kmag_cpus[curcpu->c_number % KMAG_MAXCPUS];
+	mag = kc->kc_loaded[blktype];
+	if (mag == NULL || mag->km_rounds == KMAG_ROUNDS) {
+		if (kc->kc_previous[blktype] != NULL &&
+		    kc->kc_previous[blktype]->km_rounds == 0) {
+			/* The previous magazine is empty; swap them. */
+			kc->kc_loaded[blktype] = kc->kc_previous[blktype];
+			kc->kc_previous[blktype] = mag;
+		}
+		else {
+			/* Trade the full previous one for an empty one. */
+			spinlock_acquire(&kmag_depot_lock);
+			if (kc->kc_previous[blktype] != NULL &&
+			    kd->kd_nfull >= KMAG_DEPOTMAX) {
+				/* The depot has plenty; free it the slow way */
+				spinlock_release(&kmag_depot_lock);
+				splx(spl);
+				return -1;
+			}
+			empty = kmag_pop(&kd->kd_empty, &kd->kd_nempty);
+			if (empty != NULL && kc->kc_previous[blktype] != NULL) {
+				kmag_push(&kd->kd_full, &kd->kd_nfull,
+					  kc->kc_previous[blktype]);
+			}
+			spinlock_release(&kmag_depot_lock);
+
+			if (empty == NULL) {
+				/*
+				 * Make a new magazine with interrupts
+				 * on, hand it to the depot, and start
+				 * over; we may be on another cpu by
+				 * then.
+				 */
+				splx(spl);
+				empty = kmag_create();
+				if (empty == NULL) {
+					return -1;
+				}
+				spinlock_acquire(&kmag_depot_lock);
+				kmag_push(&kd->kd_empty, &kd->kd_nempty,
+					  empty);
+				spinlock_release(&kmag_depot_lock);
+				spl = splhigh();
+				goto again;
+			}
+			kc->kc_previous[blktype] = mag;
+			kc->kc_loaded[blktype] = empty;
+		}
+		mag = kc->kc_loaded[blktype];
+	}
+
+	KASSERT(mag->km_rounds < KMAG_ROUNDS);
+	mag->km_objs[mag->km_rounds++] = ptr;
+	splx(spl);
+	return 0;
+}
+
+/*
+ * Return the depot's magazines, and this cpu's own, to the subpage
+ * allocator so the pages they pin can be released. Other cpus'
+ * loaded magazines are left alone; they are bounded in size and will
+ * cycle through the depot soon enough.
+ *
+ * Returns the number of pages released (approximately; frees on other
+ * cpus meanwhile count too).
+ */
+unsigned
+kheap_drain(void)
+{
+	unsigned before;
+	struct kmag *list, *mag;
+	struct kmag_cpu *kc;
+	struct kmag_depot *kd;
+	unsigned i;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return 0;
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	before = kheap_pagesfreed;
+	spinlock_release(&kmalloc_spinlock);
+
+	list = NULL;
+	spl = splhigh();
+	kc = &kmag_cpus[curcpu->c_number % KMAG_MAXCPUS];
+	spinlock_acquire(&kmag_depot_lock);
+	for (i=0; i<NSIZES; i++) {
+		kd = &kmag_depots[i];
+		if (kc->kc_loaded[i] != NULL) {
+			kmag_push(&kd->kd_full, &kd->kd_nfull,
+				  kc->kc_loaded[i]);
+			kc->kc_loaded[i] = NULL;
+		}
+		if (kc->kc_previous[i] != NULL) {
+			kmag_push(&kd->kd_full, &kd->kd_nfull,
+				  kc->kc_previous[i]);
+			kc->kc_previous[i] = NULL;
+		}
+		while ((mag = kmag_pop(&kd->kd_full, &kd->kd_nfull)) != NULL) {
+			mag->km_next = list;
+			list = mag;
+		}
+		while ((mag = kmag_pop(&kd->kd_empty, &kd->kd_nempty)) != NULL) {
+			mag->km_next = list;
+			list = mag;
+		}
+	}
+	spinlock_release(&kmag_depot_lock);
+	splx(spl);
+
+	while (list != NULL) {
+		mag = list;
+		list = mag->km_next;
+		kmag_destroy(mag);
+	}
+
+	spinlock_acquire(&kmalloc_spinlock);
+	before = kheap_pagesfreed - before;
+	spinlock_release(&kmalloc_spinlock);
+	return before;
+}
+
+/*
+ * Print the magazine layer's counters.
+ */
+static
+void
+kmag_printstats(void)
+{
+	struct kmag_depot *kd;
+	unsigned i, n;
+
+	kprintf("Magazine layer (%u blocks per magazine):\n", KMAG_ROUNDS);
+	n = cpu_count();
+	if (n > KMAG_MAXCPUS) {
+		n = KMAG_MAXCPUS;
+	}
+	for (i=0; i<n; i++) {
+		kprintf("    cpu %u: %u hits, %u misses\n", i,
+			kmag_cpus[i].kc_hits, kmag_cpus[i].kc_misses);
+	}
+	spinlock_acquire(&kmag_depot_lock);
+	for (i=0; i<NSIZES; i++) {
+		kd = &kmag_depots[i];
+		if (kd->kd_nfull == 0 && kd->kd_nempty == 0) {
+			continue;
+		}
+		kprintf("    depot %4zu: %u full, %u empty\n", sizes[i],
+			kd->kd_nfull, kd->kd_nempty);
+	}
+	spinlock_release(&kmag_depot_lock);
+}
+
+#else
+
+unsigned
+kheap_drain(void)
+{
+	return 0;
+}
+
+#endif /* MAGAZINES */
+
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+//
+// Sampling allocation profiler.
+//
+//    When turned on (with kheap_profile_start) kmalloc records one
+//    allocation in every N on each cpu: its call site, the size
+//    requested and the block size it got, and, until the block is
+//    freed, its address. From that kheap_profile_dump reports per
+//    call site allocation counts and rates, internal fragmentation,
+//    and live bytes, all scaled up by N, plus a histogram of request
+//    sizes from which it proposes extra entries for sizes[].
+//
+//    The call site is kmalloc's return address, so allocations made
+//    through wrappers such as kstrdup or kmem_cache_alloc are charged
+//    to the wrapper.
+//
+//    When the profiler is off the cost is one test in kmalloc and one
+//    in kfree. When it is on, unsampled allocations cost a per-cpu
+//    countdown; kfree checks a per-bucket count of sampled live blocks
+//    and only takes the profiler lock if the bucket is nonempty.
+//
+//    The tables are fixed size. Samples from call sites that don't
+//    fit in the site table are counted as dropped; sampled blocks
+//    that don't fit in the live table are not followed to kfree.
+//
+
+#define KPROF_MAXCPUS	32
+#define KPROF_NSITES	128
+#define KPROF_NLIVE	512
+#define KPROF_LIVEHASH	256
+#define KPROF_HISTGRAIN	8
+#define KPROF_HISTSLOTS	(LARGEST_SUBPAGE_SIZE / KPROF_HISTGRAIN)
+#define KPROF_NPROPOSE	4
+#define KPROF_DEFRATE	16
+
+#define KPROF_LIVEHASHFN(ptr) \
+	((((vaddr_t)(ptr)) / SMALLEST_SUBPAGE_SIZE) % KPROF_LIVEHASH)
+
+struct kprof_site {
+	vaddr_t ks_site;		/* return address; 0 if unused */
+	unsigned ks_nallocs;		/* sampled allocations */
+	unsigned ks_nfrees;		/* ...of which followed to kfree */
+	uint64_t ks_reqbytes;		/* bytes they asked for */
+	uint64_t ks_blockbytes;		/* bytes they got */
+	uint64_t ks_livebytes;		/* requested bytes not yet freed */
+	unsigned ks_classes;		/* mask of sizes[] used; bit NSIZES
+					   for whole pages */
+};
+
+struct kprof_live {
+	struct kprof_live *kl_next;	/* hash chain or free list */
+	vaddr_t kl_ptr;			/* the sampled block */
+	struct kprof_site *kl_site;	/* who allocated it */
+	size_t kl_size;			/* how much was asked for */
+};
+
+static struct spinlock kprof_lock = SPINLOCK_INITIALIZER;
+static volatile bool kprof_enabled;
+static unsigned kprof_rate;
+static unsigned kprof_countdown[KPROF_MAXCPUS];
+static struct timespec kprof_starttime, kprof_stoptime;
+
+static struct kprof_site kprof_sites[KPROF_NSITES];
+static unsigned kprof_nsamples;
+static unsigned kprof_ndropped;
+
+static struct kprof_live kprof_live[KPROF_NLIVE];
+static struct kprof_live *kprof_livefree;
+static struct kprof_live *kprof_livehash[KPROF_LIVEHASH];
+static volatile unsigned kprof_livecount[KPROF_LIVEHASH];
+
+static unsigned kprof_hist[KPROF_HISTSLOTS];
+
+/*
+ * Clear all the tables.
+ */
+static
+void
+kprof_reset(void)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	bzero(kprof_sites, sizeof(kprof_sites));
+	bzero(kprof_hist, sizeof(kprof_hist));
+	kprof_nsamples = 0;
+	kprof_ndropped = 0;
+
+	kprof_livefree = NULL;
+	for (i=0; i<KPROF_NLIVE; i++) {
+		kprof_live[i].kl_next = kprof_livefree;
+		kprof_livefree = &kprof_live[i];
+	}
+	for (i=0; i<KPROF_LIVEHASH; i++) {
+		kprof_livehash[i] = NULL;
+		kprof_livecount[i] = 0;
+	}
+	for (i=0; i<KPROF_MAXCPUS; i++) {
+		kprof_countdown[i] = kprof_rate;
+	}
+}
+
+/*
+ * Find or make the table entry for a call site.
+ */
+static
+struct kprof_site *
+kprof_findsite(vaddr_t site)
+{
+	unsigned i, ix;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	ix = (site / 4) % KPROF_NSITES;
+	for (i=0; i<KPROF_NSITES; i++) {
+		if (kprof_sites[ix].ks_site == site) {
+			return &kprof_sites[ix];
+		}
+		if (kprof_sites[ix].ks_site == 0) {
+			kprof_sites[ix].ks_site = site;
+			return &kprof_sites[ix];
+		}
+		ix = (ix + 1) % KPROF_NSITES;
+	}
+	return NULL;
+}
+
+/*
+ * Record a sampled allocation.
+ */
+static
+void
+kprof_record(void *ptr, size_t sz, vaddr_t site)
+{
+	struct kprof_site *ks;
+	struct kprof_live *kl;
+	size_t blocksz;
+	unsigned blktype, h;
+
+	if (sz >= LARGEST_SUBPAGE_SIZE) {
+		blktype = NSIZES;
+		blocksz = ROUNDUP(sz, PAGE_SIZE);
+	}
+	else {
+		blktype = blocktype(sz);
+		blocksz = sizes[blktype];
+	}
+
+	spinlock_acquire(&kprof_lock);
+	kprof_nsamples++;
+	if (sz > 0 && sz < LARGEST_SUBPAGE_SIZE) {
+		kprof_hist[(sz - 1) / KPROF_HISTGRAIN]++;
+	}
+
+	ks = kprof_findsite(site);
+	if (ks == NULL) {
+		kprof_ndropped++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+	ks->ks_nallocs++;
+	ks->ks_reqbytes += sz;
+	ks->ks_blockbytes += blocksz;
+	ks->ks_classes |= 1 << blktype;
+
+	kl = kprof_livefree;
+	if (kl != NULL) {
+		kprof_livefree = kl->kl_next;
+		kl->kl_ptr = (vaddr_t)ptr;
+		kl->kl_site = ks;
+		kl->kl_size = sz;
+		h = KPROF_LIVEHASHFN(ptr);
+		kl->kl_next = kprof_livehash[h];
+		kprof_livehash[h] = kl;
+		kprof_livecount[h]++;
+		ks->ks_livebytes += sz;
+	}
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Called from kmalloc when the profiler is on: count down and record
+ * this allocation if it's this cpu's turn. The countdown isn't
+ * protected against interrupts; losing an occasional decrement just
+ * shifts which allocation gets sampled.
+ */
+static
+void
+kprof_sample(void *ptr, size_t sz, vaddr_t site)
+{
+	unsigned *cd;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+	cd = &kprof_countdown[curcpu->c_number % KPROF_MAXCPUS];
+	if (*cd > 1) {
+		(*cd)--;
+		return;
+	}
+	*cd = kprof_rate;
+	kprof_record(ptr, sz, site);
+}
+
+/*
+ * Called from kfree: if PTR is a sampled block, stop following it.
+ */
+static
+void
+kprof_forget(void *ptr)
+{
+	struct kprof_live **klp, *kl;
+	unsigned h;
+
+	h = KPROF_LIVEHASHFN(ptr);
+	if (kprof_livecount[h] == 0) {
+		return;
+	}
+
+	spinlock_acquire(&kprof_lock);
+	for (klp = &kprof_livehash[h]; *klp != NULL; klp = &(*klp)->kl_next) {
+		kl = *klp;
+		if (kl->kl_ptr == (vaddr_t)ptr) {
+			*klp = kl->kl_next;
+			kprof_livecount[h]--;
+			KASSERT(kl->kl_site->ks_livebytes >= kl->kl_size);
+			kl->kl_site->ks_livebytes -= kl->kl_size;
+			kl->kl_site->ks_nfrees++;
+			kl->kl_next = kprof_livefree;
+			kprof_livefree = kl;
+			break;
+		}
+	}
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Start profiling, sampling one allocation in RATE (0 for the
+ * default), with fresh tables.
+ */
+void
+kheap_profile_start(unsigned rate)
+{
+	spinlock_acquire(&kprof_lock);
+	kprof_rate = rate > 0 ? rate : KPROF_DEFRATE;
+	kprof_reset();
+	gettime(&kprof_starttime);
+	kprof_enabled = true;
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Stop profiling. The tables are kept for kheap_profile_dump.
+ */
+void
+kheap_profile_stop(void)
+{
+	spinlock_acquire(&kprof_lock);
+	if (kprof_enabled) {
+		kprof_enabled = false;
+		gettime(&kprof_stoptime);
+	}
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Size class that a request of SZ bytes would get from the sorted
+ * table CLASSES.
+ */
+static
+size_t
+kprof_classfor(const size_t *classes, unsigned nclasses, size_t sz)
+{
+	unsigned i;
+
+	for (i=0; i<nclasses; i++) {
+		if (sz <= classes[i]) {
+			return classes[i];
+		}
+	}
+	return LARGEST_SUBPAGE_SIZE;
+}
+
+/*
+ * Internal fragmentation, in histogram units times bytes, with the
+ * sorted size table CLASSES. Each histogram slot is treated as if all
+ * its requests were for the top of the slot.
+ */
+static
+uint64_t
+kprof_waste(const size_t *hist, const size_t *classes, unsigned nclasses)
+{
+	uint64_t waste;
+	size_t sz;
+	unsigned i;
+
+	waste = 0;
+	for (i=0; i<KPROF_HISTSLOTS; i++) {
+		sz = (i + 1) * KPROF_HISTGRAIN;
+		waste += (uint64_t)hist[i] *
+			(kprof_classfor(classes, nclasses, sz) - sz);
+	}
+	return waste;
+}
+
+/*
+ * Greedily pick up to KPROF_NPROPOSE extra block sizes that would most
+ * reduce internal fragmentation for the sampled requests, and print
+ * them. Candidates are the tops of nonempty histogram slots, which are
+ * multiples of 8 and so keep blocks aligned, that would fit more
+ * blocks on a page than the next size up does; otherwise a new size
+ * isn't worth having.
+ */
+static
+void
+kprof_propose(const size_t *hist)
+{
+	size_t classes[NSIZES + KPROF_NPROPOSE];
+	unsigned nclasses, i, j, k;
+	uint64_t base, waste, best, total;
+	size_t cand, bestcand, next;
+
+	nclasses = NSIZES;
+	for (i=0; i<NSIZES; i++) {
+		classes[i] = sizes[i];
+	}
+
+	total = 0;
+	for (i=0; i<KPROF_HISTSLOTS; i++) {
+		total += (uint64_t)hist[i] * (i + 1) * KPROF_HISTGRAIN;
+	}
+	base = kprof_waste(hist, classes, nclasses);
+	kprintf("Internal fragmentation: ~%llu of %llu bytes requested\n",
+		(unsigned long long)base * kprof_rate,
+		(unsigned long long)total * kprof_rate);
+	if (base == 0) {
+		return;
+	}
+
+	for (k=0; k<KPROF_NPROPOSE; k++) {
+		best = base;
+		bestcand = 0;
+		for (i=0; i<KPROF_HISTSLOTS; i++) {
+			cand = (i + 1) * KPROF_HISTGRAIN;
+			if (hist[i] == 0 || cand < SMALLEST_SUBPAGE_SIZE) {
+				continue;
+			}
+			next = kprof_classfor(classes, nclasses, cand);
+			if (next == cand ||
+			    PAGE_SIZE / cand <= PAGE_SIZE / next) {
+				continue;
+			}
+
+			/* try it: insert in order, measure, remove */
+			for (j=nclasses; j>0 && classes[j-1] > cand; j--) {
+				classes[j] = classes[j-1];
+			}
+			classes[j] = cand;
+			waste = kprof_waste(hist, classes, nclasses + 1);
+			for (; j<nclasses; j++) {
+				classes[j] = classes[j+1];
+			}
+
+			if (waste < best) {
+				best = waste;
+				bestcand = cand;
+			}
+		}
+		if (bestcand == 0) {
+			break;
+		}
+		kprintf("    add size %4zu: saves ~%llu bytes (%llu%% of "
+			"current waste)\n", bestcand,
+			(unsigned long long)(base - best) * kprof_rate,
+			(unsigned long long)((base - best) * 100 / base));
+		for (j=nclasses; j>0 && classes[j-1] > bestcand; j--) {
+			classes[j] = classes[j-1];
+		}
+		classes[j] = bestcand;
+		nclasses++;
+		base = best;
+	}
+	kprintf("Proposed sizes[]:");
+	for (i=0; i<nclasses; i++) {
+		kprintf(" %zu", classes[i]);
+	}
+	kprintf("\n");
+}
+
+/*
+ * Print what the profiler has seen.
+ */
+void
+kheap_profile_dump(void)
+{
+	static struct kprof_site sites[KPROF_NSITES];
+	static size_t hist[KPROF_HISTSLOTS];
+	struct timespec start, now, elapsed;
+	uint64_t msecs;
+	unsigned nsites, nsamples, ndropped, rate, i, j, best;
+	struct kprof_site tmp;
+	bool enabled;
+
+	/*
+	 * Copy the tables (into static storage; they're too big for
+	 * the stack) so we can sort and print without the lock.
+	 * Concurrent dumps could trample each other's copies, but
+	 * this is called only from the menu.
+	 */
+	spinlock_acquire(&kprof_lock);
+	enabled = kprof_enabled;
+	rate = kprof_rate;
+	nsamples = kprof_nsamples;
+	ndropped = kprof_ndropped;
+	nsites = 0;
+	for (i=0; i<KPROF_NSITES; i++) {
+		if (kprof_sites[i].ks_site != 0) {
+			sites[nsites++] = kprof_sites[i];
+		}
+	}
+	for (i=0; i<KPROF_HISTSLOTS; i++) {
+		hist[i] = kprof_hist[i];
+	}
+	start = kprof_starttime;
+	now = kprof_stoptime;
+	spinlock_release(&kprof_lock);
+
+	if (rate == 0) {
+		kprintf("kmalloc profiler has not been run\n");
+		return;
+	}
+
+	if (enabled) {
+		gettime(&now);
+	}
+	timespec_sub(&now, &start, &elapsed);
+	msecs = (uint64_t)elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000;
+	if (msecs == 0) {
+		msecs = 1;
+	}
+
+	kprintf("kmalloc profile (%s): 1 in %u sampled over %llu.%03llu "
+		"seconds\n", enabled ? "running" : "stopped", rate,
+		(unsigned long long)(msecs / 1000),
+		(unsigned long long)(msecs % 1000));
+	kprintf("%u samples (~%llu allocs/sec), %u dropped\n",
+		nsamples,
+		(unsigned long long)nsamples * rate * 1000 / msecs,
+		ndropped);
+
+	/* sort by allocation count, busiest first */
+	for (i=0; i<nsites; i++) {
+		best = i;
+		for (j=i+1; j<nsites; j++) {
+			if (sites[j].ks_nallocs > sites[best].ks_nallocs) {
+				best = j;
+			}
+		}
+		tmp = sites[i];
+		sites[i] = sites[best];
+		sites[best] = tmp;
+	}
+
+	kprintf("%-10s %8s %8s %10s %10s %10s  %s\n", "site", "allocs",
+		"/sec", "requested", "waste", "live", "sizes");
+	for (i=0; i<nsites; i++) {
+		kprintf("0x%08lx %8llu %8llu %10llu %10llu %10llu ",
+			(unsigned long)sites[i].ks_site,
+			(unsigned long long)sites[i].ks_nallocs * rate,
+			(unsigned long long)sites[i].ks_nallocs * rate
+				* 1000 / msecs,
+			(unsigned long long)sites[i].ks_reqbytes * rate,
+			(unsigned long long)(sites[i].ks_blockbytes -
+					     sites[i].ks_reqbytes) * rate,
+			(unsigned long long)sites[i].ks_livebytes * rate);
+		for (j=0; j<NSIZES; j++) {
+			if (sites[i].ks_classes & (1 << j)) {
+				kprintf(" %zu", sizes[j]);
+			}
+		}
+		if (sites[i].ks_classes & (1 << NSIZES)) {
+			kprintf(" pages");
+		}
+		kprintf("\n");
+	}
+
+	kprof_propose(hist);
+}
+
 //
 ////////////////////////////////////////////////////////////
 
@@ -1166,17 +2124,15 @@ void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
-#ifdef LABELS
 	vaddr_t label;
-#endif
+	void *ptr;
 
-#ifdef LABELS
+	/* The caller, for LABELS and the profiler. */
 #ifdef __GNUC__
 	label = (vaddr_t)__builtin_return_address(0);
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
-#endif /* LABELS */
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
@@ -1191,14 +2147,26 @@ kmalloc(size_t sz)
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
-		return (void *)address;
+		ptr = (void *)address;
 	}
-
+	else {
+		ptr = NULL;
+#ifdef MAGAZINES
+		ptr = kmag_alloc(blocktype(checksz));
+#endif
+		if (ptr == NULL) {
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+			ptr = subpage_kmalloc(sz, label);
 #else
-	return subpage_kmalloc(sz);
+			ptr = subpage_kmalloc(sz);
 #endif
+		}
+	}
+
+	if (kprof_enabled && ptr != NULL) {
+		kprof_sample(ptr, sz, label);
+	}
+	return ptr;
 }
 
 /*
@@ -1210,9 +2178,35 @@ kfree(void *ptr)
 	/*
 	 * Try subpage first; if that fails, assume it's a big allocation.
 	 */
+#ifdef MAGAZINES
+	int blktype;
+#endif
+
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+
+	kprof_forget(ptr);
+
+#ifdef MAGAZINES
+	/*
+	 * If it's on a subpage page, try to stash it in a magazine.
+	 */
+	blktype = kmag_pagetype((vaddr_t)ptr);
+	if (blktype >= 0) {
+		KASSERT(blktype < NSIZES);
+		if (((vaddr_t)ptr % PAGE_SIZE) % sizes[blktype] != 0) {
+			panic("kfree: subpage free of invalid addr %p\n",
+			      ptr);
+		}
+		fill_deadbeef(ptr, sizes[blktype]);
+		if (kmag_free(ptr, blktype) == 0) {
+			return;
+		}
+	}
+#endif
+
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
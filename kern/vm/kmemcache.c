@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Object caches. See kmemcache.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmemcache.h>
+
+struct kmem_cache {
+	char *kc_name;			/* for printstats */
+	size_t kc_size;			/* object size */
+	int (*kc_ctor)(void *obj);	/* constructor, or NULL */
+	void (*kc_dtor)(void *obj);	/* destructor, or NULL */
+	struct kmem_cache *kc_next;	/* on kmem_caches list */
+
+	struct spinlock kc_lock;	/* protects the rest */
+	void *kc_objs[KMEM_CACHE_DEPTH];	/* free constructed objects */
+	unsigned kc_nfree;		/* number in kc_objs */
+	unsigned kc_ninuse;		/* number handed out */
+	unsigned kc_nallocs;		/* total allocations */
+	unsigned kc_nconstructs;	/* total constructor calls */
+};
+
+/*
+ * List of all caches, for reapall and printstats. Destructors called
+ * from kmem_cache_reapall run with this held, so they must not sleep.
+ */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Create a cache.
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_nfree = 0;
+	kc->kc_ninuse = 0;
+	kc->kc_nallocs = 0;
+	kc->kc_nconstructs = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+/*
+ * Destroy one free object.
+ */
+static
+void
+kmem_cache_destroyobj(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+/*
+ * Take all the free objects out of KC and destroy them.
+ */
+static
+void
+kmem_cache_doreap(struct kmem_cache *kc)
+{
+	void *objs[KMEM_CACHE_DEPTH];
+	unsigned i, n;
+
+	spinlock_acquire(&kc->kc_lock);
+	n = kc->kc_nfree;
+	for (i=0; i<n; i++) {
+		objs[i] = kc->kc_objs[i];
+	}
+	kc->kc_nfree = 0;
+	spinlock_release(&kc->kc_lock);
+
+	for (i=0; i<n; i++) {
+		kmem_cache_destroyobj(kc, objs[i]);
+	}
+}
+
+/*
+ * Destroy a cache. Everything allocated from it must have come back.
+ */
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kcp = &kmem_caches; *kcp != NULL; kcp = &(*kcp)->kc_next) {
+		if (*kcp == kc) {
+			*kcp = kc->kc_next;
+			break;
+		}
+	}
+	spinlock_release(&kmem_caches_lock);
+
+	kmem_cache_doreap(kc);
+	KASSERT(kc->kc_ninuse == 0);
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc->kc_name);
+	kfree(kc);
+}
+
+/*
+ * Get a constructed object: a cached one if there is one, otherwise
+ * a fresh one from kmalloc, constructed now.
+ */
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_nallocs++;
+	if (kc->kc_nfree > 0) {
+		obj = kc->kc_objs[--kc->kc_nfree];
+		kc->kc_ninuse++;
+		spinlock_release(&kc->kc_lock);
+		return obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL && kc->kc_ctor(obj)) {
+		kfree(obj);
+		return NULL;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_nconstructs++;
+	kc->kc_ninuse++;
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+/*
+ * Return an object, which must be in its constructed state. If the
+ * cache is already full, destroy it instead.
+ */
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_ninuse > 0);
+	kc->kc_ninuse--;
+	if (kc->kc_nfree < KMEM_CACHE_DEPTH) {
+		kc->kc_objs[kc->kc_nfree++] = obj;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	kmem_cache_destroyobj(kc, obj);
+}
+
+/*
+ * Release the free objects held by a cache.
+ */
+void
+kmem_cache_reap(struct kmem_cache *kc)
+{
+	kmem_cache_doreap(kc);
+}
+
+/*
+ * Release the free objects held by every cache.
+ */
+void
+kmem_cache_reapall(void)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		kmem_cache_doreap(kc);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
+
+/*
+ * Print the caches.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	kprintf("Object caches:\n");
+	kprintf("    %-16s %6s %6s %6s %10s %10s\n", "name", "size",
+		"inuse", "free", "allocs", "ctors");
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		kprintf("    %-16s %6zu %6u %6u %10u %10u\n", kc->kc_name,
+			kc->kc_size, kc->kc_ninuse, kc->kc_nfree,
+			kc->kc_nallocs, kc->kc_nconstructs);
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Page cache: shared pages of mapped files.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <shrinker.h>
+#include <pagecache.h>
+
+/*
+ * Number of hash buckets. Must be a power of 2.
+ */
+#define PAGECACHE_BUCKETS	64
+
+/*
+ * One mapping of a cached page: the page table entry for VADDR in AS.
+ */
+struct cachedmap {
+	struct addrspace *tm_as;	/* address space */
+	vaddr_t tm_vaddr;		/* where it's mapped */
+	struct cachedmap *tm_next;	/* next mapping of the same page */
+};
+
+/*
+ * One cached page. Each is on two hash chains: one by key, for
+ * faults, and one by frame, for as_copy and as_destroy, which only
+ * have the page table entry to go on. The list of mappings is so
+ * the shrinker can find the page table entry to clear.
+ */
+struct cachedpage {
+	struct vnode *tp_vnode;		/* file */
+	off_t tp_offset;		/* offset of page in file */
+	paddr_t tp_paddr;		/* frame holding it */
+	unsigned tp_refs;		/* number of mappings */
+	bool tp_dirty;			/* written through a mapping */
+	struct cachedmap *tp_maps;	/* the mappings */
+	struct cachedpage *tp_next;	/* next on key chain */
+	struct cachedpage *tp_fnext;	/* next on frame chain */
+};
+
+/*
+ * The hash chains and the counters are protected by pagecache_lock.
+ * It is only held across coremap calls that don't sleep. A page
+ * can't leave the cache while its tp_refs is nonzero, so a frame
+ * found in the cache can be pinned after letting go of the lock.
+ */
+static struct spinlock pagecache_lock = SPINLOCK_INITIALIZER;
+static struct cachedpage *pagecache_keys[PAGECACHE_BUCKETS];
+static struct cachedpage *pagecache_frames[PAGECACHE_BUCKETS];
+static unsigned pagecache_numpages;
+static unsigned pagecache_hits;
+static unsigned pagecache_misses;
+static unsigned pagecache_writebacks;
+static unsigned pagecache_reclaims;
+static unsigned pagecache_shrinkhand;	/* frame chain to shrink next */
+
+static
+unsigned
+pagecache_keyhash(struct vnode *v, off_t offset)
+{
+	return (((uintptr_t)v >> 4) ^ (unsigned)(offset / PAGE_SIZE)) &
+		(PAGECACHE_BUCKETS - 1);
+}
+
+static
+unsigned
+pagecache_framehash(paddr_t paddr)
+{
+	return (paddr / PAGE_SIZE) & (PAGECACHE_BUCKETS - 1);
+}
+
+/*
+ * Look up a page by key. Must hold pagecache_lock.
+ */
+static
+struct cachedpage *
+pagecache_find(struct vnode *v, off_t offset)
+{
+	struct cachedpage *tp;
+
+	KASSERT(spinlock_do_i_hold(&pagecache_lock));
+
+	tp = pagecache_keys[pagecache_keyhash(v, offset)];
+	while (tp != NULL) {
+		if (tp->tp_vnode == v && tp->tp_offset == offset) {
+			return tp;
+		}
+		tp = tp->tp_next;
+	}
+	return NULL;
+}
+
+/*
+ * Look up a page by frame. Must hold pagecache_lock.
+ */
+static
+struct cachedpage *
+pagecache_findframe(paddr_t paddr)
+{
+	struct cachedpage *tp;
+
+	KASSERT(spinlock_do_i_hold(&pagecache_lock));
+
+	tp = pagecache_frames[pagecache_framehash(paddr)];
+	while (tp != NULL) {
+		if (tp->tp_paddr == paddr) {
+			return tp;
+		}
+		tp = tp->tp_fnext;
+	}
+	panic("pagecache: frame 0x%x is not cached\n", paddr);
+	return NULL;
+}
+
+/*
+ * Add TM to TP's mappings. Must hold pagecache_lock.
+ */
+static
+void
+pagecache_addmap(struct cachedpage *tp, struct cachedmap *tm)
+{
+	KASSERT(spinlock_do_i_hold(&pagecache_lock));
+
+	tp->tp_refs++;
+	tm->tm_next = tp->tp_maps;
+	tp->tp_maps = tm;
+}
+
+/*
+ * Take the mapping of TP at VADDR in AS off its list and return it
+ * for the caller to free. Must hold pagecache_lock.
+ */
+static
+struct cachedmap *
+pagecache_delmap(struct cachedpage *tp, struct addrspace *as, vaddr_t vaddr)
+{
+	struct cachedmap *tm, **tmp;
+
+	KASSERT(spinlock_do_i_hold(&pagecache_lock));
+	KASSERT(tp->tp_refs > 0);
+
+	for (tmp = &tp->tp_maps; *tmp != NULL; tmp = &(*tmp)->tm_next) {
+		tm = *tmp;
+		if (tm->tm_as == as && tm->tm_vaddr == vaddr) {
+			*tmp = tm->tm_next;
+			tp->tp_refs--;
+			return tm;
+		}
+	}
+	panic("pagecache: 0x%x is not mapped at 0x%x\n",
+	      tp->tp_paddr, vaddr);
+	return NULL;
+}
+
+/*
+ * Take TP out of the hash chains. Must hold pagecache_lock.
+ */
+static
+void
+pagecache_remove(struct cachedpage *tp)
+{
+	struct cachedpage **tpp;
+
+	KASSERT(spinlock_do_i_hold(&pagecache_lock));
+	KASSERT(tp->tp_refs == 0);
+
+	tpp = &pagecache_keys[pagecache_keyhash(tp->tp_vnode, tp->tp_offset)];
+	while (*tpp != tp) {
+		tpp = &(*tpp)->tp_next;
+	}
+	*tpp = tp->tp_next;
+	tpp = &pagecache_frames[pagecache_framehash(tp->tp_paddr)];
+	while (*tpp != tp) {
+		tpp = &(*tpp)->tp_fnext;
+	}
+	*tpp = tp->tp_fnext;
+	pagecache_numpages--;
+}
+
+/*
+ * Read the page at OFFSET in V into the frame PADDR. The part past
+ * the end of the file is zeroed.
+ */
+static
+int
+pagecache_read(struct vnode *v, off_t offset, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	void *kva;
+	int result;
+
+	kva = (void *)PADDR_TO_KVADDR(paddr);
+	uio_kinit(&iov, &ku, kva, PAGE_SIZE, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+	bzero((char *)kva + (PAGE_SIZE - ku.uio_resid), ku.uio_resid);
+	return 0;
+}
+
+/*
+ * Write the page at OFFSET in V back from the frame PADDR. Only the
+ * part inside the file is written; mappings don't extend files.
+ */
+static
+int
+pagecache_write(struct vnode *v, off_t offset, paddr_t paddr)
+{
+	struct stat st;
+	struct iovec iov;
+	struct uio ku;
+	size_t len;
+	int result;
+
+	result = VOP_STAT(v, &st);
+	if (result) {
+		return result;
+	}
+	if (offset >= st.st_size) {
+		return 0;
+	}
+	len = PAGE_SIZE;
+	if (st.st_size - offset < PAGE_SIZE) {
+		len = st.st_size - offset;
+	}
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), len, offset,
+		  UIO_WRITE);
+	return VOP_WRITE(v, &ku);
+}
+
+int
+pagecache_get(struct vnode *v, off_t offset,
+	      struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	struct cachedpage *tp, *newtp;
+	struct cachedmap *tm;
+	paddr_t paddr;
+	unsigned h;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	tm = kmalloc(sizeof(*tm));
+	if (tm == NULL) {
+		return ENOMEM;
+	}
+	tm->tm_as = as;
+	tm->tm_vaddr = vaddr;
+
+	spinlock_acquire(&pagecache_lock);
+	tp = pagecache_find(v, offset);
+	if (tp != NULL) {
+		pagecache_addmap(tp, tm);
+		pagecache_hits++;
+		paddr = tp->tp_paddr;
+		spinlock_release(&pagecache_lock);
+
+		coremap_pinshared(paddr);
+		*ret = paddr;
+		return 0;
+	}
+	spinlock_release(&pagecache_lock);
+
+	/*
+	 * Not there; read it in. Somebody else may be doing the same
+	 * thing; we'll see when we go to insert it.
+	 */
+	newtp = kmalloc(sizeof(*newtp));
+	if (newtp == NULL) {
+		kfree(tm);
+		return ENOMEM;
+	}
+	paddr = coremap_allocuser(as, vaddr, false);
+	if (paddr == 0) {
+		kfree(newtp);
+		kfree(tm);
+		return ENOMEM;
+	}
+	result = pagecache_read(v, offset, paddr);
+	if (result) {
+		coremap_freeuser(paddr);
+		kfree(newtp);
+		kfree(tm);
+		return result;
+	}
+	coremap_disown(paddr);
+
+	spinlock_acquire(&pagecache_lock);
+	tp = pagecache_find(v, offset);
+	if (tp != NULL) {
+		/* Lost the race. Use theirs. */
+		pagecache_addmap(tp, tm);
+		pagecache_hits++;
+		spinlock_release(&pagecache_lock);
+
+		coremap_freeuser(paddr);
+		kfree(newtp);
+		paddr = tp->tp_paddr;
+		coremap_pinshared(paddr);
+		*ret = paddr;
+		return 0;
+	}
+
+	newtp->tp_vnode = v;
+	newtp->tp_offset = offset;
+	newtp->tp_paddr = paddr;
+	newtp->tp_refs = 0;
+	newtp->tp_dirty = false;
+	newtp->tp_maps = NULL;
+	pagecache_addmap(newtp, tm);
+	h = pagecache_keyhash(v, offset);
+	newtp->tp_next = pagecache_keys[h];
+	pagecache_keys[h] = newtp;
+	h = pagecache_framehash(paddr);
+	newtp->tp_fnext = pagecache_frames[h];
+	pagecache_frames[h] = newtp;
+	pagecache_numpages++;
+	pagecache_misses++;
+	spinlock_release(&pagecache_lock);
+
+	*ret = paddr;
+	return 0;
+}
+
+int
+pagecache_share(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct cachedpage *tp;
+	struct cachedmap *tm;
+
+	tm = kmalloc(sizeof(*tm));
+	if (tm == NULL) {
+		return ENOMEM;
+	}
+	tm->tm_as = as;
+	tm->tm_vaddr = vaddr;
+
+	spinlock_acquire(&pagecache_lock);
+	tp = pagecache_findframe(paddr);
+	KASSERT(tp->tp_refs > 0);
+	pagecache_addmap(tp, tm);
+	spinlock_release(&pagecache_lock);
+	return 0;
+}
+
+void
+pagecache_dirty(paddr_t paddr)
+{
+	struct cachedpage *tp;
+
+	spinlock_acquire(&pagecache_lock);
+	tp = pagecache_findframe(paddr);
+	KASSERT(tp->tp_refs > 0);
+	tp->tp_dirty = true;
+	spinlock_release(&pagecache_lock);
+}
+
+void
+pagecache_release(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct cachedpage *tp;
+	struct cachedmap *tm;
+	int result;
+
+	spinlock_acquire(&pagecache_lock);
+	tp = pagecache_findframe(paddr);
+	tm = pagecache_delmap(tp, as, vaddr);
+	if (tp->tp_refs > 0) {
+		spinlock_release(&pagecache_lock);
+		kfree(tm);
+		coremap_unpin(paddr);
+		return;
+	}
+
+	/* Last mapping; take it out of the cache. */
+	pagecache_remove(tp);
+	if (tp->tp_dirty) {
+		pagecache_writebacks++;
+	}
+	spinlock_release(&pagecache_lock);
+
+	/*
+	 * Nobody can find the page now, so nobody can write to it.
+	 * (Somebody may read the file in again meanwhile and see old
+	 * data; see pagecache.h.)
+	 */
+	if (tp->tp_dirty) {
+		result = pagecache_write(tp->tp_vnode, tp->tp_offset, paddr);
+		if (result) {
+			kprintf("pagecache: writeback at offset %llu: %s\n",
+				(unsigned long long) tp->tp_offset,
+				strerror(result));
+		}
+	}
+
+	coremap_freeuser(paddr);
+	kfree(tp);
+	kfree(tm);
+}
+
+/*
+ * Find a page that could be dropped, and pin it: one that is clean
+ * and has only the one mapping. Shared pages are left alone. Frame
+ * chains are visited in turn, so repeated calls don't keep picking
+ * on the same pages. Must hold pagecache_lock.
+ */
+static
+struct cachedpage *
+pagecache_victim(void)
+{
+	struct cachedpage *tp;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&pagecache_lock));
+
+	for (i=0; i<PAGECACHE_BUCKETS; i++) {
+		tp = pagecache_frames[pagecache_shrinkhand];
+		pagecache_shrinkhand = (pagecache_shrinkhand + 1) %
+			PAGECACHE_BUCKETS;
+		for (; tp != NULL; tp = tp->tp_fnext) {
+			/*
+			 * Don't wait for a busy frame: its owner might
+			 * be the one who's out of memory.
+			 */
+			if (tp->tp_refs == 1 && !tp->tp_dirty &&
+			    coremap_trypinshared(tp->tp_paddr)) {
+				return tp;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Shrinker: unmap and drop up to NPAGES pages. Since they're clean
+ * the next fault just reads them in again.
+ *
+ * The pinned frame keeps the one mapping's address space from
+ * getting past this page in as_destroy or as_munmap, so the address
+ * space and its page table stay around while we clear the entry.
+ */
+static
+unsigned
+pagecache_shrink(unsigned npages)
+{
+	struct cachedpage *tp;
+	struct cachedmap *tm;
+	pte_t *pte;
+	unsigned freed;
+
+	freed = 0;
+	while (freed < npages) {
+		spinlock_acquire(&pagecache_lock);
+		tp = pagecache_victim();
+		if (tp == NULL) {
+			spinlock_release(&pagecache_lock);
+			break;
+		}
+		tm = pagecache_delmap(tp, tp->tp_maps->tm_as,
+				      tp->tp_maps->tm_vaddr);
+		pagecache_remove(tp);
+		pagecache_reclaims++;
+		spinlock_release(&pagecache_lock);
+
+		pte = pt_lookup(tm->tm_as->as_pt, tm->tm_vaddr, false);
+		KASSERT(pte != NULL);
+		KASSERT(PTE_ISVALID(*pte) && PTE_PADDR(*pte) == tp->tp_paddr);
+		*pte = 0;
+		vm_tlbshootdown_pages(tm->tm_as, &tm->tm_vaddr, 1);
+
+		coremap_freeuser(tp->tp_paddr);
+		kfree(tp);
+		kfree(tm);
+		freed++;
+	}
+	return freed;
+}
+
+void
+pagecache_bootstrap(void)
+{
+	int result;
+
+	result = shrinker_register("pagecache", SHRINK_PRIO_CACHE,
+				   pagecache_shrink);
+	if (result) {
+		panic("pagecache_bootstrap: shrinker_register failed: %s\n",
+		      strerror(result));
+	}
+}
+
+void
+pagecache_printstats(void)
+{
+	unsigned numpages, hits, misses, writebacks, reclaims;
+
+	spinlock_acquire(&pagecache_lock);
+	numpages = pagecache_numpages;
+	hits = pagecache_hits;
+	misses = pagecache_misses;
+	writebacks = pagecache_writebacks;
+	reclaims = pagecache_reclaims;
+	spinlock_release(&pagecache_lock);
+
+	kprintf("pagecache: %u pages cached, %u hits, %u misses, "
+		"%u writebacks, %u reclaimed\n", numpages, hits, misses,
+		writebacks, reclaims);
+}
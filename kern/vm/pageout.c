@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The pageout daemon.
+ *
+ * A kernel thread that sleeps until free memory runs low (or somebody
+ * is waiting for memory), then evicts user pages to swap until there
+ * is a comfortable reserve again. The coremap clock picks each victim;
+ * we then also take whichever of its virtual neighbours in the same
+ * address space are idle too, so a run of adjacent pages goes out to
+ * adjacent swap slots in a single device write. Besides saving device
+ * passes, that keeps pages that are likely to be needed together next
+ * to each other on disk.
+ *
+ * Locking: each victim frame is pinned (see coremap.h) from the time
+ * it is chosen until it's freed. That keeps its owner's fault handler
+ * and as_destroy away from the page table entry, and since as_destroy
+ * can't finish while a frame of the address space is pinned, it also
+ * keeps the address space and its page table around while we work.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vmstat.h>
+
+struct victim {
+	paddr_t v_paddr;	/* frame */
+	vaddr_t v_vaddr;	/* page it holds */
+	pte_t *v_pte;		/* page table entry mapping it */
+};
+
+/*
+ * Try to pin the page at VADDR in AS as another victim.
+ */
+static
+bool
+pageout_neighbour(struct addrspace *as, vaddr_t vaddr, struct victim *v)
+{
+	pte_t *pte;
+	pte_t val;
+
+	if (vaddr >= USERSPACETOP) {
+		return false;
+	}
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte == NULL) {
+		return false;
+	}
+	val = *pte;
+	if (!PTE_ISVALID(val) ||
+	    !coremap_pinvictim(PTE_PADDR(val), as, vaddr)) {
+		return false;
+	}
+	KASSERT(*pte == val);
+	v->v_paddr = PTE_PADDR(val);
+	v->v_vaddr = vaddr;
+	v->v_pte = pte;
+	return true;
+}
+
+/*
+ * Pick a cluster of victims: the clock's choice plus idle neighbours
+ * on either side, in ascending virtual address order. Returns the
+ * number of victims, and their address space in *RET, or 0 if
+ * nothing can be evicted.
+ */
+static
+unsigned
+pageout_gather(struct victim *vs, struct addrspace **ret)
+{
+	struct addrspace *as;
+	struct victim below[PAGEOUT_CLUSTER - 1];
+	unsigned nbelow, n, i;
+	vaddr_t vaddr;
+	paddr_t paddr;
+
+	paddr = coremap_clock(&as, &vaddr);
+	if (paddr == 0) {
+		return 0;
+	}
+
+	/* Scan down first... */
+	nbelow = 0;
+	while (nbelow < PAGEOUT_CLUSTER / 2 &&
+	       vaddr >= (nbelow + 1) * PAGE_SIZE &&
+	       pageout_neighbour(as, vaddr - (nbelow + 1) * PAGE_SIZE,
+				 &below[nbelow])) {
+		nbelow++;
+	}
+	n = 0;
+	for (i=nbelow; i>0; i--) {
+		vs[n++] = below[i-1];
+	}
+
+	vs[n].v_paddr = paddr;
+	vs[n].v_vaddr = vaddr;
+	vs[n].v_pte = pt_lookup(as->as_pt, vaddr, false);
+	KASSERT(vs[n].v_pte != NULL);
+	KASSERT(PTE_ISVALID(*vs[n].v_pte));
+	KASSERT(PTE_PADDR(*vs[n].v_pte) == paddr);
+	n++;
+
+	/* ...then up. */
+	while (n < PAGEOUT_CLUSTER &&
+	       pageout_neighbour(as, vs[n-1].v_vaddr + PAGE_SIZE, &vs[n])) {
+		n++;
+	}
+
+	*ret = as;
+	return n;
+}
+
+/*
+ * Write out one cluster. Returns the number of frames freed.
+ */
+static
+unsigned
+pageout_cluster(void)
+{
+	struct victim vs[PAGEOUT_CLUSTER];
+	struct addrspace *as;
+	vaddr_t vaddrs[PAGEOUT_CLUSTER];
+	paddr_t paddrs[PAGEOUT_CLUSTER];
+	unsigned n, i, slot;
+	int result;
+
+	n = pageout_gather(vs, &as);
+	if (n == 0) {
+		return 0;
+	}
+
+	/* If swap is too fragmented for the whole cluster, shrink it. */
+	while (swap_alloc(n, &slot)) {
+		n--;
+		coremap_unpin(vs[n].v_paddr);
+		if (n == 0) {
+			/* Swap is full. */
+			return 0;
+		}
+	}
+
+	/*
+	 * Knock the pages out of every TLB before writing them, so
+	 * nobody can change them behind our back.
+	 */
+	for (i=0; i<n; i++) {
+		vaddrs[i] = vs[i].v_vaddr;
+		paddrs[i] = vs[i].v_paddr;
+	}
+	vm_tlbshootdown_pages(as, vaddrs, n);
+
+	result = swap_pageout(slot, paddrs, n);
+	if (result) {
+		for (i=0; i<n; i++) {
+			swap_free(slot + i);
+			coremap_unpin(vs[i].v_paddr);
+		}
+		return 0;
+	}
+
+	/* Count them while AS still has pinned pages and can't go away. */
+	vmstat_add(&as->as_stats, VMS_PAGEOUTS, n);
+	for (i=0; i<n; i++) {
+		*vs[i].v_pte = PTE_MKSWAP(slot + i);
+		coremap_evicted(vs[i].v_paddr);
+	}
+
+	DEBUG(DB_VM, "pageout: 0x%x-0x%x -> slots %u-%u\n",
+	      vs[0].v_vaddr, vs[n-1].v_vaddr + PAGE_SIZE - 1,
+	      slot, slot + n - 1);
+	return n;
+}
+
+static
+void
+pageout_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	coremap_pageout_start();
+	while (1) {
+		coremap_pageout_wait();
+		if (pageout_cluster() == 0) {
+			coremap_pageout_stuck();
+		}
+	}
+}
+
+/*
+ * Start the pageout daemon, if there's swap to page to.
+ */
+void
+pageout_bootstrap(void)
+{
+	int result;
+
+	if (!swap_enabled()) {
+		return;
+	}
+	result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+	if (result) {
+		panic("pageout_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
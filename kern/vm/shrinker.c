@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Shrinker registry. See shrinker.h.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <current.h>
+#include <shrinker.h>
+
+#define SHRINKER_MAX 8
+
+struct shrinker {
+	const char *sh_name;		/* for printstats */
+	unsigned sh_priority;		/* lower runs first */
+	shrinker_func sh_func;		/* the callback */
+	unsigned sh_calls;		/* times called */
+	unsigned sh_freed;		/* pages it claims to have freed */
+};
+
+/*
+ * The table, kept sorted by priority, and its spinlock. The callbacks
+ * can't be called with a spinlock held, so shrinker_run copies what
+ * it needs out first. Everything registers at boot, before the
+ * shrinkers can run, so entries don't move once they can be called.
+ */
+static struct shrinker shrinkers[SHRINKER_MAX];
+static unsigned numshrinkers;
+static struct spinlock shrinker_spinlock = SPINLOCK_INITIALIZER;
+
+/*
+ * The thread running the callbacks, if any. One thread shrinking at
+ * a time is plenty, and others don't wait for it: a callback may need
+ * a lock (the buffer cache lock, say) that the waiter holds, so
+ * waiting could deadlock. They just go on and fail. This also tells
+ * us when an allocation inside a callback has come back around.
+ */
+static struct thread *shrinker_thread;
+
+static unsigned shrinker_runs;
+static unsigned shrinker_fails;
+
+/*
+ * Add a callback.
+ */
+int
+shrinker_register(const char *name, unsigned priority, shrinker_func func)
+{
+	unsigned i;
+
+	KASSERT(func != NULL);
+
+	spinlock_acquire(&shrinker_spinlock);
+	if (numshrinkers == SHRINKER_MAX) {
+		spinlock_release(&shrinker_spinlock);
+		return ENOSPC;
+	}
+	for (i = numshrinkers; i > 0; i--) {
+		if (shrinkers[i-1].sh_priority <= priority) {
+			break;
+		}
+		shrinkers[i] = shrinkers[i-1];
+	}
+	shrinkers[i].sh_name = name;
+	shrinkers[i].sh_priority = priority;
+	shrinkers[i].sh_func = func;
+	shrinkers[i].sh_calls = 0;
+	shrinkers[i].sh_freed = 0;
+	numshrinkers++;
+	spinlock_release(&shrinker_spinlock);
+	return 0;
+}
+
+/*
+ * Run the callbacks, lowest priority first, until NPAGES have been
+ * freed.
+ */
+unsigned
+shrinker_run(unsigned npages)
+{
+	shrinker_func funcs[SHRINKER_MAX];
+	unsigned i, n, got, freed;
+
+	if (!CURCPU_EXISTS() ||
+	    curthread->t_in_interrupt ||
+	    curcpu->c_spinlocks > 0) {
+		return 0;
+	}
+
+	spinlock_acquire(&shrinker_spinlock);
+	if (shrinker_thread != NULL) {
+		spinlock_release(&shrinker_spinlock);
+		return 0;
+	}
+	shrinker_thread = curthread;
+	spinlock_release(&shrinker_spinlock);
+
+	spinlock_acquire(&shrinker_spinlock);
+	n = numshrinkers;
+	for (i=0; i<n; i++) {
+		funcs[i] = shrinkers[i].sh_func;
+	}
+	spinlock_release(&shrinker_spinlock);
+
+	freed = 0;
+	for (i=0; i<n && freed < npages; i++) {
+		got = funcs[i](npages - freed);
+		freed += got;
+
+		spinlock_acquire(&shrinker_spinlock);
+		shrinkers[i].sh_calls++;
+		shrinkers[i].sh_freed += got;
+		spinlock_release(&shrinker_spinlock);
+	}
+
+	spinlock_acquire(&shrinker_spinlock);
+	shrinker_runs++;
+	if (freed == 0) {
+		shrinker_fails++;
+	}
+	KASSERT(shrinker_thread == curthread);
+	shrinker_thread = NULL;
+	spinlock_release(&shrinker_spinlock);
+
+	return freed;
+}
+
+/*
+ * Print the table.
+ */
+void
+shrinker_printstats(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&shrinker_spinlock);
+	kprintf("Shrinkers: %u runs, %u freed nothing\n",
+		shrinker_runs, shrinker_fails);
+	for (i=0; i<numshrinkers; i++) {
+		kprintf("    %-12s priority %2u: %u calls, %u pages\n",
+			shrinkers[i].sh_name, shrinkers[i].sh_priority,
+			shrinkers[i].sh_calls, shrinkers[i].sh_freed);
+	}
+	spinlock_release(&shrinker_spinlock);
+}
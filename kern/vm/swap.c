@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap space management and swap I/O.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+
+/*
+ * Maximum number of pages written in one swap_pageout call. This
+ * bounds the iovec array on the stack.
+ */
+#define SWAP_MAXCLUSTER	16
+
+static struct vnode *swap_vnode;
+
+/*
+ * swap_refs[i] is the number of page table entries that refer to
+ * slot i; zero means the slot is free. Protected by swap_lock.
+ */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static uint16_t *swap_refs;
+static unsigned swap_nslots;
+static unsigned swap_numfree;
+static unsigned swap_hint;
+
+/*
+ * Attach the swap device.
+ */
+void
+swap_bootstrap(void)
+{
+	struct vnode *vn;
+	struct stat st;
+	unsigned nslots;
+	int result;
+
+	result = vfs_swapon(SWAP_DEVICE, &vn);
+	if (result) {
+		kprintf("swap: %s: %s; paging to disk disabled\n",
+			SWAP_DEVICE, strerror(result));
+		return;
+	}
+
+	result = VOP_STAT(vn, &st);
+	if (result) {
+		panic("swap: stat of %s failed: %s\n", SWAP_DEVICE,
+		      strerror(result));
+	}
+	nslots = st.st_size / PAGE_SIZE;
+	if (nslots == 0) {
+		kprintf("swap: %s is too small; paging to disk disabled\n",
+			SWAP_DEVICE);
+		return;
+	}
+
+	swap_refs = kmalloc(nslots * sizeof(swap_refs[0]));
+	if (swap_refs == NULL) {
+		panic("swap: Out of memory for swap map\n");
+	}
+	bzero(swap_refs, nslots * sizeof(swap_refs[0]));
+
+	spinlock_acquire(&swap_lock);
+	swap_vnode = vn;
+	swap_nslots = nslots;
+	swap_numfree = nslots;
+	swap_hint = 0;
+	spinlock_release(&swap_lock);
+
+	kprintf("swap: %u pages on %s\n", nslots, SWAP_DEVICE);
+}
+
+/*
+ * Return true if there is swap space.
+ */
+bool
+swap_enabled(void)
+{
+	bool ret;
+
+	spinlock_acquire(&swap_lock);
+	ret = swap_vnode != NULL;
+	spinlock_release(&swap_lock);
+	return ret;
+}
+
+/*
+ * Allocate a run of NSLOTS free slots, next-fit from the hint so that
+ * successive clusters land next to each other on the disk.
+ */
+int
+swap_alloc(unsigned nslots, unsigned *slot)
+{
+	unsigned i, n, base, run;
+
+	KASSERT(nslots > 0);
+
+	spinlock_acquire(&swap_lock);
+
+	if (swap_numfree < nslots) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+
+	base = 0;
+	run = 0;
+	i = swap_hint;
+	for (n=0; n<swap_nslots + nslots; n++, i++) {
+		if (i == swap_nslots) {
+			/* runs don't wrap around */
+			i = 0;
+			run = 0;
+		}
+		if (swap_refs[i] != 0) {
+			run = 0;
+			continue;
+		}
+		if (run == 0) {
+			base = i;
+		}
+		run++;
+		if (run == nslots) {
+			break;
+		}
+	}
+	if (run < nslots) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+
+	for (i=base; i<base+nslots; i++) {
+		swap_refs[i] = 1;
+	}
+	swap_numfree -= nslots;
+	swap_hint = (base + nslots) % swap_nslots;
+
+	spinlock_release(&swap_lock);
+
+	*slot = base;
+	return 0;
+}
+
+/*
+ * Add a reference to a slot.
+ */
+void
+swap_share(unsigned slot)
+{
+	spinlock_acquire(&swap_lock);
+	KASSERT(slot < swap_nslots);
+	KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Drop a reference to a slot.
+ */
+void
+swap_free(unsigned slot)
+{
+	spinlock_acquire(&swap_lock);
+	KASSERT(slot < swap_nslots);
+	KASSERT(swap_refs[slot] > 0);
+	swap_refs[slot]--;
+	if (swap_refs[slot] == 0) {
+		swap_numfree++;
+	}
+	spinlock_release(&swap_lock);
+}
+
+/*
+ * Read a page in from swap.
+ */
+int
+swap_pagein(unsigned slot, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &ku);
+	if (result) {
+		kprintf("swap: read of slot %u failed: %s\n", slot,
+			strerror(result));
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
+
+/*
+ * Write a cluster of pages out to consecutive slots. One uio with an
+ * iovec per page means the device sees a single transfer.
+ */
+int
+swap_pageout(unsigned slot, const paddr_t *paddrs, unsigned npages)
+{
+	struct iovec iov[SWAP_MAXCLUSTER];
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(npages > 0 && npages <= SWAP_MAXCLUSTER);
+	KASSERT(slot + npages <= swap_nslots);
+
+	for (i=0; i<npages; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = npages;
+	ku.uio_offset = (off_t)slot * PAGE_SIZE;
+	ku.uio_resid = npages * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+
+	result = VOP_WRITE(swap_vnode, &ku);
+	if (result) {
+		kprintf("swap: write of slots %u-%u failed: %s\n", slot,
+			slot + npages - 1, strerror(result));
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return EIO;
+	}
+	return 0;
+}
@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Machine-independent parts of the VM system: kernel page allocation
+ * and the page fault handler.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <proc.h>
+#include <current.h>
+#include <uio.h>
+#include <vnode.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <kmemcache.h>
+#include <shrinker.h>
+#include <vmstat.h>
+#include <vm.h>
+
+/*
+ * Most cpus a shootdown can have to wait for. (LAMEbus has 32 slots.)
+ */
+#define VM_MAXCPUS	32
+
+/*
+ * Wrap ram_stealmem in a spinlock. It is only used until the coremap
+ * takes over.
+ */
+static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Shrinker for the kernel heap: destroy the free objects sitting in
+ * object caches, then give the blocks in the kmalloc magazines back
+ * so any pages left wholly free are released. Runs after the other
+ * caches' shrinkers, which mostly free into the heap.
+ */
+static
+unsigned
+vm_shrinkheap(unsigned npages)
+{
+	(void)npages;
+
+	kmem_cache_reapall();
+	return kheap_drain();
+}
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	swap_bootstrap();
+	pageout_bootstrap();
+	pagecache_bootstrap();
+	shrinker_register("kheap", SHRINK_PRIO_HEAP, vm_shrinkheap);
+}
+
+/*
+ * Check if we're in a context that can sleep.
+ */
+static
+void
+vm_can_sleep(void)
+{
+	if (CURCPU_EXISTS()) {
+		/* must not hold spinlocks */
+		KASSERT(curcpu->c_spinlocks == 0);
+
+		/* must not be in an interrupt handler */
+		KASSERT(curthread->t_in_interrupt == 0);
+	}
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+	paddr_t pa;
+
+	vm_can_sleep();
+
+	if (coremap_bootstrapped()) {
+		pa = coremap_allockernel(npages);
+	}
+	else {
+		spinlock_acquire(&stealmem_lock);
+		pa = ram_stealmem(npages);
+		spinlock_release(&stealmem_lock);
+	}
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	KASSERT(addr % PAGE_SIZE == 0);
+
+	if (!coremap_bootstrapped()) {
+		/* nothing - leak the memory. */
+		return;
+	}
+
+	coremap_freekernel(KVADDR_TO_PADDR(addr));
+}
+
+/*
+ * Called by cpu_idle: use the time to pre-zero a frame.
+ */
+bool
+vm_idle(void)
+{
+	return coremap_zeroone();
+}
+
+/*
+ * Invalidate the current cpu's TLB entry for VADDR, if it has one.
+ */
+static
+void
+vm_tlbinvalidate(vaddr_t vaddr)
+{
+	int i, spl;
+
+	spl = splhigh();
+	i = tlb_probe(vaddr, 0);
+	if (i >= 0) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	vm_tlbinvalidate(ts->ts_vaddr);
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	vm_tlbflush();
+}
+
+/*
+ * Remove the N pages in VADDRS of address space AS from every TLB
+ * that might hold them, and wait until that's done.
+ *
+ * Only cpus that have AS active are interrupted (see c_tlbas in
+ * cpu.h), and each of those gets the whole lot in one interrupt, up
+ * to TLBSHOOTDOWN_MAX pages; past that it just flushes its TLB.
+ */
+void
+vm_tlbshootdown_pages(struct addrspace *as, const vaddr_t *vaddrs,
+		      unsigned n)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX + 1];
+	unsigned tickets[VM_MAXCPUS];
+	bool sent[VM_MAXCPUS];
+	struct cpu *c, *self;
+	unsigned i, ncpus, nts;
+	int spl;
+
+	KASSERT(n > 0);
+
+	ncpus = cpu_count();
+	KASSERT(ncpus <= VM_MAXCPUS);
+
+	/* Queueing more than TLBSHOOTDOWN_MAX turns into a full flush. */
+	nts = n <= TLBSHOOTDOWN_MAX ? n : TLBSHOOTDOWN_MAX + 1;
+	for (i=0; i<nts; i++) {
+		ts[i].ts_vaddr = vaddrs[i];
+	}
+
+	/* Stay on this cpu while deciding who "everyone else" is. */
+	spl = splhigh();
+	self = curcpu->c_self;
+	if (n > TLBSHOOTDOWN_MAX) {
+		vm_tlbflush();
+	}
+	else {
+		for (i=0; i<n; i++) {
+			vm_tlbinvalidate(vaddrs[i]);
+		}
+	}
+	for (i=0; i<ncpus; i++) {
+		c = cpu_get(i);
+		sent[i] = c != self &&
+			ipi_tlbshootdown_batch(c, as, ts, nts, &tickets[i]);
+	}
+	splx(spl);
+
+	for (i=0; i<ncpus; i++) {
+		if (sent[i]) {
+			ipi_tlbshootdown_wait(cpu_get(i), tickets[i]);
+		}
+	}
+}
+
+/*
+ * Invalidate the whole TLB of the current cpu.
+ */
+void
+vm_tlbflush(void)
+{
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	curcpu->c_tlbhand = 0;
+
+	splx(spl);
+}
+
+/*
+ * Enter a translation in the TLB of the current cpu.
+ *
+ * If there is already an entry for the page (a read-only one that is
+ * being upgraded) it is replaced. Otherwise slots are handed out
+ * round-robin by a per-cpu clock hand. Since the hand is reset when
+ * the TLB is flushed, it fills the empty slots first, and after that
+ * replaces the oldest entries, FIFO. (The TLB keeps no use bits, so
+ * there is nothing better for a clock to go on.) Slots emptied by
+ * shootdowns are reused when the hand gets to them.
+ */
+static
+void
+vm_tlbload(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	   bool writeable)
+{
+	uint32_t ehi, elo, newlo;
+	int i, spl;
+
+	newlo = paddr | TLBLO_VALID;
+	if (writeable) {
+		newlo |= TLBLO_DIRTY;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	vmstat_inc(&as->as_stats, VMS_TLBMISSES);
+
+	i = tlb_probe(vaddr, 0);
+	if (i < 0) {
+		i = curcpu->c_tlbhand;
+		curcpu->c_tlbhand = (i + 1) % NUM_TLB;
+
+		tlb_read(&ehi, &elo, i);
+		if (elo & TLBLO_VALID) {
+			vmstat_inc(&as->as_stats, VMS_TLBEVICTIONS);
+		}
+	}
+	tlb_write(vaddr, newlo, i);
+
+	splx(spl);
+}
+
+/*
+ * If every other mapping of the copy-on-write page PTE maps at VADDR
+ * in AS has gone away, the frame is ours alone: take it back, so the
+ * pageout daemon can have it again, and stop treating it as
+ * copy-on-write. The frame must be pinned.
+ */
+static
+void
+vm_cowreclaim(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	if (coremap_cowclaim(PTE_PADDR(*pte), as, vaddr)) {
+		*pte &= ~PTE_COW;
+		vmstat_inc(&as->as_stats, VMS_COWCLAIMS);
+	}
+}
+
+/*
+ * Fast path for TLB refills: if the page is resident and the page
+ * table entry alone says what we need to know, enter it without
+ * looking at the region list. Returns false if the slow path has
+ * to handle the fault.
+ */
+static
+bool
+vm_fastfault(struct addrspace *as, int faulttype, vaddr_t faultaddress)
+{
+	pte_t *pte;
+	paddr_t paddr;
+	bool writeable;
+
+	if (faulttype == VM_FAULT_READONLY || as->as_loading) {
+		return false;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, false);
+	if (pte == NULL || !PTE_ISVALID(*pte)) {
+		return false;
+	}
+	writeable = PTE_ISWRITE(*pte) && !PTE_ISCOW(*pte);
+	if (faulttype == VM_FAULT_WRITE && !writeable) {
+		return false;
+	}
+
+	paddr = PTE_PADDR(*pte);
+	if (!coremap_pin(paddr, pte)) {
+		return false;
+	}
+	if (PTE_ISCOW(*pte)) {
+		vm_cowreclaim(as, faultaddress, pte);
+		writeable = PTE_ISWRITE(*pte) && !PTE_ISCOW(*pte);
+	}
+	vm_tlbload(as, faultaddress, paddr, writeable);
+	coremap_unpin(paddr);
+	vmstat_inc(&as->as_stats, VMS_FASTFAULTS);
+	return true;
+}
+
+/*
+ * Give the page mapped by PTE at VADDR in AS its own frame, after a
+ * write to a copy-on-write page. If nobody else maps the frame any
+ * more, just take it over. The frame is pinned on entry; on success,
+ * whatever frame PTE maps afterwards is pinned.
+ */
+static
+int
+vm_cowbreak(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	oldpaddr = PTE_PADDR(*pte);
+	if (coremap_cowclaim(oldpaddr, as, vaddr)) {
+		*pte &= ~PTE_COW;
+		vmstat_inc(&as->as_stats, VMS_COWCLAIMS);
+		return 0;
+	}
+
+	newpaddr = coremap_allocuser(as, vaddr, false);
+	if (newpaddr == 0) {
+		return ENOMEM;
+	}
+	memmove((void *)PADDR_TO_KVADDR(newpaddr),
+		(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+	*pte = newpaddr | PTE_WRITE | PTE_VALID;
+	coremap_freeuser(oldpaddr);
+	vmstat_inc(&as->as_stats, VMS_COWCOPIES);
+
+	DEBUG(DB_VM, "vm: cow 0x%x: 0x%x -> 0x%x\n", vaddr, oldpaddr,
+	      newpaddr);
+	return 0;
+}
+
+/*
+ * Bring in the page at VADDR in AS, whose entry PTE says it's in
+ * swap. The new frame is left pinned.
+ */
+static
+int
+vm_swapin(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	  pte_t *pte)
+{
+	unsigned slot;
+	paddr_t paddr;
+	int result;
+
+	slot = PTE_SWAPSLOT(*pte);
+	paddr = coremap_allocuser(as, vaddr, false);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	result = swap_pagein(slot, paddr);
+	if (result) {
+		coremap_freeuser(paddr);
+		return result;
+	}
+	*pte = paddr | PTE_VALID;
+	if (rg->rg_writeable) {
+		*pte |= PTE_WRITE;
+	}
+	swap_free(slot);
+	vmstat_inc(&as->as_stats, VMS_SWAPINS);
+
+	DEBUG(DB_VM, "vm: 0x%x <- slot %u\n", vaddr, slot);
+	return 0;
+}
+
+/*
+ * Bring in the page at VADDR in AS for the first time, reading
+ * whatever part of it is backed by the region's file and zeroing the
+ * rest. The new frame is left pinned.
+ *
+ * The read goes through VOP_READ on the kernel mapping of the frame,
+ * so it is served from the file system's buffer cache.
+ */
+static
+int
+vm_filein(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	  pte_t *pte)
+{
+	vaddr_t start, end, kva;
+	off_t offset;
+	struct iovec iov;
+	struct uio ku;
+	paddr_t paddr;
+	int result;
+
+	/* The part of the page that comes from the file. */
+	start = vaddr > rg->rg_filevaddr ? vaddr : rg->rg_filevaddr;
+	end = rg->rg_filevaddr + rg->rg_filesize;
+	if (end > vaddr + PAGE_SIZE) {
+		end = vaddr + PAGE_SIZE;
+	}
+	KASSERT(start < end);
+
+	paddr = coremap_allocuser(as, vaddr, false);
+	if (paddr == 0) {
+		return ENOMEM;
+	}
+	kva = PADDR_TO_KVADDR(paddr);
+	bzero((void *)kva, start - vaddr);
+	bzero((void *)(kva + (end - vaddr)), vaddr + PAGE_SIZE - end);
+
+	offset = rg->rg_fileoffset + (start - rg->rg_filevaddr);
+	uio_kinit(&iov, &ku, (void *)(kva + (start - vaddr)), end - start,
+		  offset, UIO_READ);
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result == 0 && ku.uio_resid != 0) {
+		/* load_elf checked the file size; it must have shrunk. */
+		result = EIO;
+	}
+	if (result) {
+		coremap_freeuser(paddr);
+		return result;
+	}
+
+	*pte = paddr | PTE_VALID;
+	if (rg->rg_writeable) {
+		*pte |= PTE_WRITE;
+	}
+	vmstat_inc(&as->as_stats, VMS_FILEINS);
+
+	DEBUG(DB_VM, "vm: 0x%x <- file offset %llu\n", vaddr,
+	      (unsigned long long) offset);
+	return 0;
+}
+
+/*
+ * True if any of the page at VADDR comes from RG's backing file.
+ */
+static
+bool
+vm_filebacked(struct region *rg, vaddr_t vaddr)
+{
+	return rg->rg_vnode != NULL &&
+		vaddr < rg->rg_filevaddr + rg->rg_filesize &&
+		rg->rg_filevaddr < vaddr + PAGE_SIZE;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	paddr_t paddr;
+	bool writeable;
+	enum vmstat_counter kind;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+		/*
+		 * A write to a page we entered read-only: either the
+		 * region is read-only, or the page is copy-on-write.
+		 * Sort it out below.
+		 */
+		kind = VMS_ROFAULTS;
+		break;
+	    case VM_FAULT_READ:
+		kind = VMS_READFAULTS;
+		break;
+	    case VM_FAULT_WRITE:
+		kind = VMS_WRITEFAULTS;
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	vmstat_inc(&as->as_stats, VMS_FAULTS);
+	vmstat_inc(&as->as_stats, kind);
+
+	if (vm_fastfault(as, faulttype, faultaddress)) {
+		return 0;
+	}
+
+	rg = as_findregion(as, faultaddress);
+	if (rg == NULL) {
+		rg = as_growstack(as, faultaddress);
+		if (rg == NULL) {
+			return EFAULT;
+		}
+	}
+	writeable = rg->rg_writeable || as->as_loading;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		return EFAULT;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	/*
+	 * Get the page resident and its frame pinned, so the pageout
+	 * daemon leaves it alone until it's in the TLB.
+	 */
+	while (PTE_ISVALID(*pte)) {
+		paddr = PTE_PADDR(*pte);
+		if (coremap_pin(paddr, pte)) {
+			break;
+		}
+		/* Paged out while we waited; look again. */
+	}
+
+	if (PTE_ISVALID(*pte)) {
+		if (PTE_ISCOW(*pte)) {
+			if (faulttype == VM_FAULT_READ) {
+				/* Share it until somebody writes. */
+				vm_cowreclaim(as, faultaddress, pte);
+				if (PTE_ISCOW(*pte)) {
+					writeable = false;
+				}
+			}
+			else {
+				result = vm_cowbreak(as, faultaddress, pte);
+				if (result) {
+					coremap_unpin(PTE_PADDR(*pte));
+					return result;
+				}
+			}
+		}
+	}
+	else if (PTE_ISSWAPPED(*pte)) {
+		result = vm_swapin(as, rg, faultaddress, pte);
+		if (result) {
+			return result;
+		}
+	}
+	else if (rg->rg_cached) {
+		/* Mapped file: share the page with everybody else. */
+		result = pagecache_get(rg->rg_vnode,
+				       rg->rg_fileoffset +
+				       ((off_t)faultaddress -
+					(off_t)rg->rg_filevaddr),
+				       as, faultaddress, &paddr);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID | PTE_FILE;
+		vmstat_inc(&as->as_stats, VMS_CACHEFAULTS);
+	}
+	else if (vm_filebacked(rg, faultaddress)) {
+		/* First touch of a page of an executable. */
+		result = vm_filein(as, rg, faultaddress, pte);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		/* First touch: demand-zero. */
+		paddr = coremap_allocuser(as, faultaddress, true);
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		*pte = paddr | PTE_VALID;
+		if (rg->rg_writeable) {
+			*pte |= PTE_WRITE;
+		}
+		vmstat_inc(&as->as_stats, VMS_ZEROFILLS);
+		DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	}
+	paddr = PTE_PADDR(*pte);
+
+	/*
+	 * A writeable mapped file page stays read-only in the TLB until
+	 * it's written to, so we know to write it back.
+	 */
+	if (PTE_ISFILE(*pte) && writeable && !PTE_ISWRITE(*pte)) {
+		if (faulttype == VM_FAULT_READ) {
+			writeable = false;
+		}
+		else {
+			pagecache_dirty(paddr);
+			*pte |= PTE_WRITE;
+		}
+	}
+
+	vm_tlbload(as, faultaddress, paddr, writeable);
+	coremap_unpin(paddr);
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VM event counters. See vmstat.h.
+ */
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <current.h>
+#include <vmstat.h>
+
+static const char *const vmstat_names[VMS_NCOUNTERS] = {
+	[VMS_FAULTS] = "faults",
+	[VMS_READFAULTS] = "read faults",
+	[VMS_WRITEFAULTS] = "write faults",
+	[VMS_ROFAULTS] = "read-only faults",
+	[VMS_FASTFAULTS] = "fast refills",
+	[VMS_TLBMISSES] = "TLB misses",
+	[VMS_TLBEVICTIONS] = "TLB evictions",
+	[VMS_ZEROFILLS] = "zero-fills",
+	[VMS_COWCOPIES] = "COW copies",
+	[VMS_COWCLAIMS] = "COW claims",
+	[VMS_CACHEFAULTS] = "page cache maps",
+	[VMS_FILEINS] = "file page-ins",
+	[VMS_SWAPINS] = "swap page-ins",
+	[VMS_PAGEOUTS] = "page-outs",
+};
+
+/*
+ * The last process to exit, and its counters, for the menu.
+ */
+#define VMSTAT_NAMELEN 32
+static struct spinlock vmstat_exitlock = SPINLOCK_INITIALIZER;
+static char vmstat_exitname[VMSTAT_NAMELEN];
+static struct vmstats vmstat_exitstats;
+
+void
+vmstat_add(struct vmstats *vs, enum vmstat_counter which, unsigned n)
+{
+	int spl;
+
+	KASSERT(which < VMS_NCOUNTERS);
+
+	if (vs != NULL) {
+		vs->vs_count[which] += n;
+	}
+
+	/* Keep the thread from moving to another cpu halfway through. */
+	spl = splhigh();
+	if (CURCPU_EXISTS()) {
+		curcpu->c_vmstats.vs_count[which] += n;
+	}
+	splx(spl);
+}
+
+void
+vmstat_global(struct vmstats *vs)
+{
+	struct cpu *c;
+	unsigned i, j;
+
+	bzero(vs, sizeof(*vs));
+	for (i=0; i<cpu_count(); i++) {
+		c = cpu_get(i);
+		for (j=0; j<VMS_NCOUNTERS; j++) {
+			vs->vs_count[j] += c->c_vmstats.vs_count[j];
+		}
+	}
+}
+
+void
+vmstat_print(const char *who, const struct vmstats *vs)
+{
+	unsigned i;
+
+	kprintf("%s:\n", who);
+	for (i=0; i<VMS_NCOUNTERS; i++) {
+		kprintf("    %-18s %u\n", vmstat_names[i], vs->vs_count[i]);
+	}
+}
+
+void
+vmstat_exited(const char *name, const struct vmstats *vs)
+{
+	spinlock_acquire(&vmstat_exitlock);
+	snprintf(vmstat_exitname, sizeof(vmstat_exitname), "%s", name);
+	vmstat_exitstats = *vs;
+	spinlock_release(&vmstat_exitlock);
+}
+
+void
+vmstat_printall(void)
+{
+	struct vmstats vs;
+	char name[VMSTAT_NAMELEN];
+
+	vmstat_global(&vs);
+	vmstat_print("All processes", &vs);
+
+	spinlock_acquire(&vmstat_exitlock);
+	strcpy(name, vmstat_exitname);
+	vs = vmstat_exitstats;
+	spinlock_release(&vmstat_exitlock);
+
+	if (name[0] != 0) {
+		kprintf("\n");
+		vmstat_print(name, &vs);
+	}
+}
@@ -45,6 +45,7 @@
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/resource.h>	/* uses struct timeval */
 
 
 /*
@@ -68,6 +69,7 @@
  *     remove:   stdio.h
  *     rename:   stdio.h
  *     time:     time.h
+ *     getrusage: sys/resource.h
  *
  * Also note that the prototypes for open() and mkdir() contain, for
  * compatibility with Unix, an extra argument that is not meaningful
@@ -147,7 +149,11 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int getrusage(int who, struct rusage *usage);
+int setaffinity(unsigned mask);
+int getaffinity(unsigned *mask);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 